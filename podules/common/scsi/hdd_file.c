@@ -1,24 +1,15 @@
-#define _LARGEFILE_SOURCE
-#define _LARGEFILE64_SOURCE
-#define _GNU_SOURCE
 #include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "hdd_file.h"
 
-#ifdef __APPLE__
-#define fopen64 fopen
-#define fseeko64 fseek
-#define off64_t off_t
-#endif
-
 void hdd_load(hdd_file_t *hdd, const char *fn, int sectors)
 {
 	if (hdd->f == NULL)
 	{
 		/* Try to open existing hard disk image */
-		hdd->f = fopen64(fn, "rb+");
+		hdd->f = blockdev_open(fn, "rb+");
 		if (hdd->f == NULL)
 		{
 			/* Failed to open existing hard disk image */
@@ -26,7 +17,7 @@ void hdd_load(hdd_file_t *hdd, const char *fn, int sectors)
 			{
 				/* Failed because it does not exist,
 				   so try to create new file */
-				hdd->f = fopen64(fn, "wb+");
+				hdd->f = blockdev_open(fn, "wb+");
 				if (hdd->f == NULL)
 				{
 //					aka31_log("Cannot create file '%s': %s",
@@ -51,39 +42,39 @@ void hdd_close(hdd_file_t *hdd)
 {
 	if (hdd->f)
 	{
-		fclose(hdd->f);
+		blockdev_close(hdd->f);
 		hdd->f = NULL;
 	}
 }
 
 int hdd_read_sectors(hdd_file_t *hdd, int offset, int nr_sectors, void *buffer)
 {
-	off64_t addr;
+	uint64_t addr;
 	int transfer_sectors = nr_sectors;
 
 	if ((hdd->sectors - offset) < transfer_sectors)
 		transfer_sectors = hdd->sectors - offset;
 	addr = (uint64_t)offset * 512;
 
-	fseeko64(hdd->f, addr, SEEK_SET);
-	size_t s = fread(buffer, transfer_sectors*512, 1, hdd->f);
+	blockdev_seek(hdd->f, addr);
+	size_t s = blockdev_read(hdd->f, buffer, transfer_sectors*512);
 
-	if (s != 1 || nr_sectors != transfer_sectors)
+	if (s != transfer_sectors*512 || nr_sectors != transfer_sectors)
 		return 1;
 	return 0;
 }
 
 int hdd_write_sectors(hdd_file_t *hdd, int offset, int nr_sectors, void *buffer)
 {
-	off64_t addr;
+	uint64_t addr;
 	int transfer_sectors = nr_sectors;
 
 	if ((hdd->sectors - offset) < transfer_sectors)
 		transfer_sectors = hdd->sectors - offset;
 	addr = (uint64_t)offset * 512;
 
-	fseeko64(hdd->f, addr, SEEK_SET);
-	fwrite(buffer, transfer_sectors*512, 1, hdd->f);
+	blockdev_seek(hdd->f, addr);
+	blockdev_write(hdd->f, buffer, transfer_sectors*512);
 
 	if (nr_sectors != transfer_sectors)
 		return 1;
@@ -92,7 +83,7 @@ int hdd_write_sectors(hdd_file_t *hdd, int offset, int nr_sectors, void *buffer)
 
 int hdd_format_sectors(hdd_file_t *hdd, int offset, int nr_sectors)
 {
-	off64_t addr;
+	uint64_t addr;
 	int c;
 	uint8_t zero_buffer[512];
 	int transfer_sectors = nr_sectors;
@@ -102,9 +93,9 @@ int hdd_format_sectors(hdd_file_t *hdd, int offset, int nr_sectors)
 	if ((hdd->sectors - offset) < transfer_sectors)
 		transfer_sectors = hdd->sectors - offset;
 	addr = (uint64_t)offset * 512;
-	fseeko64(hdd->f, addr, SEEK_SET);
+	blockdev_seek(hdd->f, addr);
 	for (c = 0; c < transfer_sectors; c++)
-		fwrite(zero_buffer, 512, 1, hdd->f);
+		blockdev_write(hdd->f, zero_buffer, 512);
 
 	if (nr_sectors != transfer_sectors)
 		return 1;
@@ -1,6 +1,8 @@
+#include "blockdev.h"
+
 typedef struct hdd_file_t
 {
-	FILE *f;
+	blockdev_t *f;
 	int sectors;
 } hdd_file_t;
 
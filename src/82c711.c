@@ -7,6 +7,7 @@
 #include "ide.h"
 #include "ioc.h"
 #include "printer.h"
+#include "snapshot.h"
 
 static int configmode, configindex;
 static uint8_t configregs[16];
@@ -90,6 +91,13 @@ static void c82c711_ide_irq_clear(ide_t *ide)
 	ioc_irqbc(IOC_IRQB_IDE);
 }
 
+void c82c711_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, configmode);
+	SNAPSHOT_VAR(s, configindex);
+	SNAPSHOT_ARRAY(s, configregs);
+}
+
 void c82c711_init(void)
 {
 	resetide(&ide_internal,
@@ -9,6 +9,7 @@
 #include "config.h"
 #include "disc.h"
 #include "ioc.h"
+#include "snapshot.h"
 #include "timer.h"
 
 static fdc_funcs_t c82c711_fdc_funcs;
@@ -115,6 +116,12 @@ void c82c711_fdc_init(void)
 	}
 }
 
+void c82c711_fdc_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_STRUCT_TO(s, _fdc, timer);
+	timer_snapshot(s, &_fdc.timer);
+}
+
 void *c82c711_fdc_init_override(void (*fdc_irq)(int state, void *p),
 			       void (*fdc_index_irq)(void *p),
 			       void (*fdc_fiq)(int state, void *p), void *p)
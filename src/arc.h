@@ -78,10 +78,11 @@ void arc_print_error(const char *format, ...);
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-extern void arc_set_cpu(int cpu, int memc);
+extern void arc_set_cpu(int cpu, int memc, int timing);
 extern void updatewindowsize(int x, int y);
 
 extern int update_status_text,inssec;
+extern uint32_t timer_callbacks_sec;
 
 /*ARM*/
 extern uint32_t armregs[16];
@@ -133,13 +134,41 @@ extern uint32_t readmemfl(uint32_t a);
 extern void writememfb(uint32_t a,uint8_t v);
 extern void writememfl(uint32_t a,uint32_t v);
 
+/*Per physical RAM page flags. A write to a page with any flag set is passed to
+  mem_ram_page_written(), so pages nobody is watching only cost a table lookup*/
+#define RAM_PAGE_CODE  1 /*Page holds translated ARM code*/
+#define RAM_PAGE_CLEAN 2 /*Page not written since the last snapshot checkpoint*/
+
+extern uint8_t *ram_page_flags;
+extern uintptr_t ram_nr_pages;
+extern void mem_ram_page_written(uintptr_t page);
+
+static inline void mem_ram_write_check(const uint8_t *p)
+{
+	uintptr_t page = ((uintptr_t)p - (uintptr_t)ram) >> 12;
+
+	if (page < ram_nr_pages && ram_page_flags[page])
+		mem_ram_page_written(page);
+}
+
+/*Returns a host pointer to emulated memory at a if the current mode can read
+  (or, if write is set, write) it directly, and sets *span to the number of
+  bytes from a to the end of its page. Returns NULL if the page has to go
+  through readmemb()/writememb() - it is unmapped, protected or I/O, or the
+  debugger is watching writes. Call mem_ram_write_check() after writing
+  through the pointer*/
+extern uint8_t *mem_direct_ptr(uint32_t a, int write, uint32_t *span);
+
 static inline void writememb(uint32_t a, uint8_t v)
 {
 	if (debugon)
 		debug_writememb(a, v);
 
 	if (modepritablew[memmode][memstat[((a) >> 12) & 0x3FFF]])
+	{
 		mempoint[((a) >> 12) & 0x3FFF][(a)] = v;
+		mem_ram_write_check(&mempoint[((a) >> 12) & 0x3FFF][(a)]);
+	}
 	else
 		writememfb(a, v);
 }
@@ -150,7 +179,10 @@ static inline void writememl(uint32_t a, uint32_t v)
 		debug_writememl(a, v);
 
 	if (modepritablew[memmode][memstat[((a) >> 12) & 0x3FFF]])
+	{
 		*(uint32_t *)&mempoint[((a) >> 12) & 0x3FFF][(a) & ~3] = v;
+		mem_ram_write_check(&mempoint[((a) >> 12) & 0x3FFF][(a) & ~3]);
+	}
 	else
 		writememfl(a, v);
 }
@@ -176,6 +208,10 @@ extern int dblscan;
 extern int stereoimages[8];
 extern int flyback;
 extern int skip_video_render;
+extern int take_screenshot, record_video;
+/*Run emulation only - VIDC keeps its timing, DMA and interrupts but draws no
+  pixels, and sound DMA runs but no audio is generated*/
+extern int turbo_mode;
 
 extern void initvid();
 extern void reinitvideo();
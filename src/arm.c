@@ -16,6 +16,8 @@
 #include "mem.h"
 #include "memc.h"
 #include "podules.h"
+#include "profiler.h"
+#include "snapshot.h"
 #include "sound.h"
 #include "timer.h"
 #include "vidc.h"
@@ -25,12 +27,15 @@ uint32_t armregs[16];
 void refillpipeline();
 void refillpipeline2();
 
-static uint8_t arm3_cache[((1 << 26) >> 4) >> 3];
+/*ARM3 cache - 4 sets of 64 16-byte lines. arm3_cache_tag holds the address of
+  the line in each slot, and arm3_cache_lines indexes the lines held by address
+  so lookups don't have to search a set*/
+#define ARM3_CACHE_LINES_SIZE 1024 /*Hash table, kept at most a quarter full*/
+static uint32_t arm3_cache_lines[ARM3_CACHE_LINES_SIZE]; /*Line number + 1, 0 if free*/
 static uint32_t arm3_cache_tag[4][64];
 static int arm3_slot = 1;
 #define TAG_INVALID -1
 
-static int cyc_s, cyc_n;
 
 #define cyc_i (1ull << 32)
 
@@ -200,16 +205,46 @@ static void sync_to_fclk(void)
 
 static uint64_t last_cycle_length = 0;
 
+/*Direct mapped cache of mem_speed[] entries for recently accessed pages, so
+  the cycle timing code doesn't index the 256kb table on every access. Must be
+  flushed with arm_timing_flush() whenever mem_speed[] changes*/
+#define TIMING_CACHE_SIZE 64
+static struct
+{
+	uint32_t key; /*Page + 1, 0 if empty*/
+	uint64_t speed[2]; /*S-cycle, N-cycle length*/
+} timing_cache[TIMING_CACHE_SIZE];
+
+static inline const uint64_t *mem_timing(uint32_t addr)
+{
+	uint32_t page = (addr >> 12) & 0x3fff;
+	int c = page & (TIMING_CACHE_SIZE - 1);
+
+	if (timing_cache[c].key != page + 1)
+	{
+		timing_cache[c].key = page + 1;
+		timing_cache[c].speed[0] = mem_speed[page][0];
+		timing_cache[c].speed[1] = mem_speed[page][1];
+	}
+
+	return timing_cache[c].speed;
+}
+
+void arm_timing_flush(void)
+{
+	memset(timing_cache, 0, sizeof(timing_cache));
+}
+
 static void CLOCK_N(uint32_t addr)
 {
-	tsc += mem_speed[(addr >> 12) & 0x3fff][1];
-	last_cycle_length = mem_speed[(addr >> 12) & 0x3fff][1];
+	last_cycle_length = mem_timing(addr)[1];
+	tsc += last_cycle_length;
 }
 
 static void CLOCK_S(uint32_t addr)
 {
-	tsc += mem_speed[(addr >> 12) & 0x3fff][0];
-	last_cycle_length = mem_speed[(addr >> 12) & 0x3fff][0];
+	last_cycle_length = mem_timing(addr)[0];
+	tsc += last_cycle_length;
 }
 
 static void CLOCK_I()
@@ -233,16 +268,88 @@ static void CLOCK_I()
 	}
 }
 
+/*Fast timing tier costs for nr reads or writes. Reads take one CPU cycle with
+  the ARM3 cache on, as if they all hit, otherwise one MCLK cycle*/
+static inline void fast_read_timing(int nr)
+{
+	tsc += nr * (cp15_cacheon ? cyc_i : mem_spd_multi);
+}
+
+static inline void fast_write_timing(int nr)
+{
+	tsc += nr * mem_spd_multi;
+}
+
 void arm_clock_i(int i_cycles)
 {
+	if (arm_timing_fast)
+	{
+		tsc += i_cycles * cyc_i;
+		return;
+	}
+
 	while (i_cycles--)
 		CLOCK_I();
 }
 
+static inline int arm3_cache_hash(uint32_t key)
+{
+	return (key * 0x9e3779b1u) >> (32 - 10);
+}
+
+/*Is the line holding addr in the cache?*/
+static inline int arm3_cache_lookup(uint32_t addr)
+{
+	uint32_t key = (addr >> 4) + 1;
+	int c = arm3_cache_hash(key);
+
+	while (arm3_cache_lines[c])
+	{
+		if (arm3_cache_lines[c] == key)
+			return 1;
+		c = (c + 1) & (ARM3_CACHE_LINES_SIZE - 1);
+	}
+
+	return 0;
+}
+
+static void arm3_cache_insert(uint32_t addr)
+{
+	uint32_t key = (addr >> 4) + 1;
+	int c = arm3_cache_hash(key);
+
+	while (arm3_cache_lines[c])
+		c = (c + 1) & (ARM3_CACHE_LINES_SIZE - 1);
+	arm3_cache_lines[c] = key;
+}
+
+static void arm3_cache_remove(uint32_t addr)
+{
+	uint32_t key = (addr >> 4) + 1;
+	int c = arm3_cache_hash(key);
+	int next;
+
+	while (arm3_cache_lines[c] != key)
+		c = (c + 1) & (ARM3_CACHE_LINES_SIZE - 1);
+
+	/*Move later entries in the probe sequence back over the hole, unless
+	  that would put them before their hash position*/
+	for (next = (c + 1) & (ARM3_CACHE_LINES_SIZE - 1); arm3_cache_lines[next];
+	     next = (next + 1) & (ARM3_CACHE_LINES_SIZE - 1))
+	{
+		int home = arm3_cache_hash(arm3_cache_lines[next]);
+
+		if (((next - home) & (ARM3_CACHE_LINES_SIZE - 1)) >= ((next - c) & (ARM3_CACHE_LINES_SIZE - 1)))
+		{
+			arm3_cache_lines[c] = arm3_cache_lines[next];
+			c = next;
+		}
+	}
+	arm3_cache_lines[c] = 0;
+}
+
 static void cache_line_fill(uint32_t addr)
 {
-	int byte_offset = addr >> (4+3);
-	int bit_offset = (addr >> 4) & 7;
 	int set = (addr >> 4) & 3;
 
 #ifndef RELEASE_BUILD
@@ -251,18 +358,13 @@ static void cache_line_fill(uint32_t addr)
 #endif
 
 	if (arm3_cache_tag[set][arm3_slot] != TAG_INVALID)
-	{
-		int old_bit_offset = (arm3_cache_tag[set][arm3_slot] >> 4) & 7;
-		int old_byte_offset = (arm3_cache_tag[set][arm3_slot] >> (4+3));
-
-		arm3_cache[old_byte_offset] &= ~(1 << old_bit_offset);
-	}
+		arm3_cache_remove(arm3_cache_tag[set][arm3_slot]);
 
 	arm3_cache_tag[set][arm3_slot] = addr & ~0xf;
-	arm3_cache[byte_offset] |= (1 << bit_offset);
+	arm3_cache_insert(addr);
 	sync_to_mclk();
 
-	mem_available_ts = tsc + mem_speed[addr >> 12][1] + 3*mem_speed[addr >> 12][0];
+	mem_available_ts = tsc + mem_timing(addr)[1] + 3*mem_timing(addr)[0];
 
 	/*ARM3 will start to clock the CPU again once the requested word has been
 	  read. So only 'charge' the emulated CPU up to that point, and promote
@@ -303,6 +405,12 @@ void cache_read_timing(uint32_t addr, int is_n_cycle, int is_merged_fetch)
 		fatal("cache_read_timing outside of valid range %08x\n", addr);
 #endif
 
+	if (arm_timing_fast)
+	{
+		fast_read_timing(1);
+		return;
+	}
+
   //      if (output) rpclog("Read %c-cycle %07x\n", is_n_cycle?'N':'S', addr);
 	if (is_n_cycle)
 	{
@@ -327,10 +435,7 @@ void cache_read_timing(uint32_t addr, int is_n_cycle, int is_merged_fetch)
 			  cache lookup*/
 			sync_to_fclk();
 
-			int bit_offset = (addr >> 4) & 7;
-			int byte_offset = addr >> (4+3);
-
-			if (arm3_cache[byte_offset] & (1 << bit_offset))
+			if (arm3_cache_lookup(addr))
 			{
 				cache_was_on = 1;
 				CLOCK_I(); /*Data is in cache*/
@@ -354,7 +459,7 @@ void cache_read_timing(uint32_t addr, int is_n_cycle, int is_merged_fetch)
 			mem_available_ts = tsc;
 			/*Merged fetch doesn't cause extended I-cycle on MEMC1*/
 			if (memc_is_memc1 && is_merged_fetch == PROMOTE_MERGE)
-				last_cycle_length = mem_speed[(addr >> 12) & 0x3fff][0];
+				last_cycle_length = mem_timing(addr)[0];
 		}
 	}
 	else
@@ -383,10 +488,7 @@ void cache_read_timing(uint32_t addr, int is_n_cycle, int is_merged_fetch)
 			else if (cache_was_on)
 			{
 #ifndef RELEASE_BUILD
-				int bit_offset = (addr >> 4) & 7;
-				int byte_offset = ((addr & 0x3ffffff) >> (4+3));
-
-				if (!(arm3_cache[byte_offset] & (1 << bit_offset)))
+				if (!arm3_cache_lookup(addr))
 					fatal("S-cycle - cache_was_on but data not in cache %08x\n", addr);
 				if ((clock_domain != DOMAIN_FCLK) && ((addr & ~0xf) != cache_fill_addr))
 					fatal("Data in cache - clock_domain != FCLK %08x\n", addr);
@@ -420,35 +522,21 @@ void cache_read_timing(uint32_t addr, int is_n_cycle, int is_merged_fetch)
 
 void cache_flush()
 {
-	int set, slot;
 //	rpclog("cache_flush\n");
-	for (set = 0; set < 4; set++)
-	{
-		for (slot = 0; slot < 64; slot++)
-		{
-			if (arm3_cache_tag[set][slot] != TAG_INVALID)
-			{
-				int bit_offset = (arm3_cache_tag[set][slot] >> 4) & 7;
-				int byte_offset = (arm3_cache_tag[set][slot] >> (4+3));
-
-				arm3_cache[byte_offset] &= ~(1 << bit_offset);
-
-				arm3_cache_tag[set][arm3_slot] = TAG_INVALID;
-			}
-		}
-	}
+	memset(arm3_cache_lines, 0, sizeof(arm3_cache_lines));
+	memset(arm3_cache_tag, TAG_INVALID, sizeof(arm3_cache_tag));
 
 	cache_was_on = 0;
-
-/*	for (set = 0; set < (((1 << 26) >> 4) >> 3); set++)
-	{
-		if (arm3_cache[set])
-			fatal("Flush didn't flush - %x %x\n", set, arm3_cache[set]);
-	}*/
 }
 
 void cache_write_timing(uint32_t addr, int is_n_cycle)
 {
+	if (arm_timing_fast)
+	{
+		fast_write_timing(1);
+		return;
+	}
+
 	addr &= 0x3ffffff;
 
 //        if (output) rpclog("Write %c-cycle %08x\n", is_n_cycle ? 'N' : 'S', addr);
@@ -496,6 +584,9 @@ void cache_write_timing(uint32_t addr, int is_n_cycle)
   instruction fetch. On ARM3 the final cycle is just an I-cycle.*/
 static void merge_timing(uint32_t addr)
 {
+	if (arm_timing_fast)
+		return;
+
 	promote_fetch_to_n = PROMOTE_MERGE; /*Merge writeback with next fetch*/
 	if (memc_is_memc1)
 	{
@@ -515,10 +606,13 @@ static void merge_timing(uint32_t addr)
 
 
 int arm_cpu_type;
+int arm_cpu_core = ARM_CORE_INTERPRETER;
+int arm_cpu_timing = ARM_TIMING_CYCLE_EXACT;
 
 int arm_cpu_speed, arm_mem_speed;
 int arm_has_swp;
 int arm_has_cp15;
+int arm_timing_fast;
 
 int fpaena=0;
 
@@ -637,6 +731,10 @@ void updatemode(int m)
 }
 
 static uint32_t pccache,*pccache2;
+/*Decoded instruction cache entries for the physical page mapped at pccache, or
+  NULL if that page can not be cached*/
+static struct arm_decoded_t *pcdecode;
+static struct arm_decoded_t *arm_decode_page(const uint32_t *host);
 #define countbits(c) countbitstable[c]
 static int countbitstable[65536];
 
@@ -712,9 +810,12 @@ void resetarm()
 	resetcp15();
 	resetfpa();
 
-	memset(arm3_cache, 0, sizeof(arm3_cache));
+	memset(arm3_cache_lines, 0, sizeof(arm3_cache_lines));
 	memset(arm3_cache_tag, TAG_INVALID, sizeof(arm3_cache_tag));
 
+	/*RAM and ROM may have been reallocated or reloaded*/
+	arm_code_flush();
+
 	ins = 0;
 	tsc = 0;
 	mem_available_ts = 0;
@@ -1017,9 +1118,8 @@ static inline uint32_t shift_mem(uint32_t opcode)
 				{ \
 					pccache=templ2; \
 					pccache2 = (uint32_t *)(mempoint[templ2]); \
+					pcdecode = arm_decode_page(&pccache2[templ2 << 10]); \
 					opcode = pccache2[addr >> 2]; \
-					cyc_s = mem_speed[templ2 & 0x3fff][0];  \
-					cyc_n = mem_speed[templ2 & 0x3fff][1];  \
 				} \
 				else \
 				{ \
@@ -2238,16 +2338,58 @@ opSTR(7a)
 opSTR(7c)
 opSTR(7e)
 
+/*LDM/STM transfers that fall within a single directly accessible page are
+  done through a pointer to the page, rather than a readmeml()/writememl() per
+  register. ldm_block()/stm_block() return a pointer to the first word, or NULL
+  if the transfer has to go through the normal memory handlers. The debugger
+  watches every write, so STMs always take the slow path while it's active.
+
+  In the fast timing tier the whole transfer is charged at once, otherwise each
+  access is timed as it happens*/
+static inline uint32_t *ldm_block(uint32_t addr, int bytes)
+{
+	uint32_t page = addr >> 12;
+
+	if (((addr + bytes - 4) >> 12) != page || !modepritabler[memmode][memstat[page]])
+		return NULL;
+
+	return (uint32_t *)&mempoint[page][addr & ~3];
+}
+
+static inline uint32_t *stm_block(uint32_t addr, int bytes)
+{
+	uint32_t page = addr >> 12;
+
+	if (((addr + bytes - 4) >> 12) != page || !modepritablew[memmode][memstat[page]] || debugon)
+		return NULL;
+
+	return (uint32_t *)&mempoint[page][addr & ~3];
+}
+
+#define LDM_READ(addr)  (block ? *block++ : readmeml(addr))
+#define STM_WRITE(addr, v) \
+			if (block) \
+				*block++ = (v); \
+			else \
+				writememl(addr, v)
+#define LDM_TIMING(addr, is_n)  if (!arm_timing_fast) cache_read_timing(addr, is_n, 0)
+#define STM_TIMING(addr, is_n)  if (!arm_timing_fast) cache_write_timing(addr, is_n)
+
 #define STMfirst()      int c; \
 			mask=1; \
 			CHECK_ADDR_EXCEPTION(addr); \
+			uint32_t *block = stm_block(addr, countbits(opcode & 0xFFFF)); \
+			if (arm_timing_fast) \
+				fast_write_timing(countbits(opcode & 0xFFFF) >> 2); \
 			for (c = 0; c < 16; c++) \
 			{ \
 				if (opcode & mask) \
 				{ \
-					if (c == 15) { writememl(addr, armregs[c] + 4); } \
-					else         { writememl(addr, armregs[c]); } \
-					cache_write_timing(addr, 1); \
+					if (c == 15) { STM_WRITE(addr, armregs[c] + 4); } \
+					else         { STM_WRITE(addr, armregs[c]); } \
+					if (block) \
+						mem_ram_write_check((uint8_t *)(block - 1)); \
+					STM_TIMING(addr, 1); \
 					addr += 4; \
 					break; \
 				} \
@@ -2259,9 +2401,9 @@ opSTR(7e)
 			{ \
 				if (opcode & mask) \
 				{ \
-					if (c == 15) { writememl(addr, armregs[c] + 4); } \
-					else         { writememl(addr, armregs[c]); } \
-					cache_write_timing(addr, !(addr & 0xc)); \
+					if (c == 15) { STM_WRITE(addr, armregs[c] + 4); } \
+					else         { STM_WRITE(addr, armregs[c]); } \
+					STM_TIMING(addr, !(addr & 0xc)); \
 					addr += 4; \
 				} \
 				mask <<= 1; \
@@ -2270,13 +2412,18 @@ opSTR(7e)
 #define STMfirstS()     int c; \
 			mask = 1; \
 			CHECK_ADDR_EXCEPTION(addr); \
+			uint32_t *block = stm_block(addr, countbits(opcode & 0xFFFF)); \
+			if (arm_timing_fast) \
+				fast_write_timing(countbits(opcode & 0xFFFF) >> 2); \
 			for (c = 0; c < 16; c++) \
 			{ \
 				if (opcode & mask) \
 				{ \
-					if (c == 15) { writememl(addr, armregs[c] + 4); } \
-					else         { writememl(addr, *usrregs[c]); } \
-					cache_write_timing(addr, 1); \
+					if (c == 15) { STM_WRITE(addr, armregs[c] + 4); } \
+					else         { STM_WRITE(addr, *usrregs[c]); } \
+					if (block) \
+						mem_ram_write_check((uint8_t *)(block - 1)); \
+					STM_TIMING(addr, 1); \
 					addr += 4; \
 					break; \
 				} \
@@ -2288,9 +2435,9 @@ opSTR(7e)
 			{ \
 				if (opcode & mask) \
 				{ \
-					if (c == 15) { writememl(addr, armregs[c] + 4); } \
-					else         { writememl(addr, *usrregs[c]); } \
-					cache_write_timing(addr, !(addr & 0xc)); \
+					if (c == 15) { STM_WRITE(addr, armregs[c] + 4); } \
+					else         { STM_WRITE(addr, *usrregs[c]); } \
+					STM_TIMING(addr, !(addr & 0xc)); \
 					addr += 4; \
 				} \
 				mask <<= 1; \
@@ -2299,12 +2446,15 @@ opSTR(7e)
 #define LDMall()        mask = 1; \
 			CHECK_ADDR_EXCEPTION(addr); \
 			int first_access = 1; \
+			uint32_t *block = ldm_block(addr, countbits(opcode & 0xFFFF)); \
+			if (arm_timing_fast) \
+				fast_read_timing(countbits(opcode & 0xFFFF) >> 2); \
 			for (int c = 0; c < 15; c++) \
 			{ \
 				if (opcode & mask) \
 				{ \
-					uint32_t templ = readmeml(addr); if (!databort) armregs[c] = templ; \
-					cache_read_timing(addr, first_access || !(addr & 0xc), 0); \
+					uint32_t templ = LDM_READ(addr); if (!databort) armregs[c] = templ; \
+					LDM_TIMING(addr, first_access || !(addr & 0xc)); \
 					first_access = 0; \
 					addr = (addr + 4) & 0x3fffffc; \
 				} \
@@ -2312,8 +2462,8 @@ opSTR(7e)
 			} \
 			if (opcode & 0x8000) \
 			{ \
-				uint32_t templ = readmeml(addr); \
-				cache_read_timing(addr, first_access || !(addr & 0xc), 0); \
+				uint32_t templ = LDM_READ(addr); \
+				LDM_TIMING(addr, first_access || !(addr & 0xc)); \
 				if (!databort) armregs[15] = (armregs[15] & 0xFC000003) | ((templ+4) & 0x3FFFFFC); \
 				refillpipeline(); \
 			}
@@ -2321,21 +2471,24 @@ opSTR(7e)
 #define LDMallS()       mask = 1; \
 			CHECK_ADDR_EXCEPTION(addr); \
 			int first_access = 1; \
+			uint32_t *block = ldm_block(addr, countbits(opcode & 0xFFFF)); \
+			if (arm_timing_fast) \
+				fast_read_timing(countbits(opcode & 0xFFFF) >> 2); \
 			if (opcode & 0x8000) \
 			{ \
 				for (int c = 0; c < 15; c++) \
 				{ \
 					if (opcode & mask) \
 					{ \
-						uint32_t templ = readmeml(addr); if (!databort) armregs[c] = templ; \
-						cache_read_timing(addr, first_access || !(addr & 0xc), 0); \
+						uint32_t templ = LDM_READ(addr); if (!databort) armregs[c] = templ; \
+						LDM_TIMING(addr, first_access || !(addr & 0xc)); \
 						first_access = 0; \
 						addr = (addr + 4) & 0x3fffffc; \
 					} \
 					mask <<= 1; \
 				} \
-				uint32_t templ = readmeml(addr); \
-				cache_read_timing(addr, first_access || !(addr & 0xc), 0); \
+				uint32_t templ = LDM_READ(addr); \
+				LDM_TIMING(addr, first_access || !(addr & 0xc)); \
 				if (!databort) \
 				{ \
 					if (armregs[15] & 3) \
@@ -2355,8 +2508,8 @@ opSTR(7e)
 				{ \
 					if (opcode & mask) \
 					{ \
-						uint32_t templ = readmeml(addr); if (!databort) *usrregs[c] = templ; \
-						cache_read_timing(addr, first_access || !(addr & 0xc), 0); \
+						uint32_t templ = LDM_READ(addr); if (!databort) *usrregs[c] = templ; \
+						LDM_TIMING(addr, first_access || !(addr & 0xc)); \
 						first_access = 0; \
 						addr = (addr + 4) & 0x3fffffc; \
 					} \
@@ -2622,6 +2775,643 @@ static const OpFn opcode_fns[256] =
 /*f8*/	opSWI,		opSWI,		opSWI,		opSWI,		opSWI,		opSWI,		opSWI,		opSWI
 };
 
+static inline void arm_handle_exceptions(void)
+{
+	if (prefabort)       /*Prefetch abort*/
+	{
+		if (debugon)
+			debug_trap(DEBUG_TRAP_PREF_ABORT, opcode);
+		prefabort = 0;
+		EXCEPTION_PREF_ABORT();
+	}
+	else if (databort == 1)     /*Data abort*/
+	{
+		if (debugon)
+			debug_trap(DEBUG_TRAP_DATA_ABORT, opcode);
+		databort = 0;
+		EXCEPTION_DATA_ABORT();
+	}
+	else if (databort == 2) /*Address Exception*/
+	{
+		if (debugon)
+			debug_trap(DEBUG_TRAP_ADDR_EXCEP, opcode);
+		databort = 0;
+		EXCEPTION_ADDRESS();
+	}
+	else if ((armirq&2) && !(armregs[15]&0x4000000)) /*FIQ*/
+	{
+//                rpclog("FIQ %02X %i\n",ioc.fiq&ioc.mskf, 0);
+		EXCEPTION_FIQ();
+	}
+	else if ((armirq&1) && !(armregs[15]&0x8000000)) /*IRQ*/
+	{
+//                rpclog("IRQ %02X %02X\n",ioc.irqa&ioc.mska,ioc.irqb&ioc.mskb);
+		EXCEPTION_IRQ();
+	}
+}
+
+/*Decoded instruction cache.
+
+  Every physical page of RAM or ROM that code runs from is given an array of
+  decoded entries, one per word, which is found through pcdecode alongside
+  pccache/pccache2. An entry holds the handler for its instruction with the
+  register numbers and operand already extracted, so that the common forms of
+  data processing instructions and branches skip the decode done by the
+  generic handlers. Anything else goes through dopGeneric to the usual
+  opcode_fns handler.
+
+  Each entry is tagged with the opcode it was decoded from and is decoded again
+  when that differs from the instruction being executed. This catches writes to
+  the page as well as instructions that were already in the pipeline when the
+  page was written, without putting any extra work on the store path. Entries
+  are keyed on physical address, so MEMC remaps only need pccache dropping.*/
+#define DECODE_POOL_SIZE 256 /*Pages*/
+#define DECODE_PAGE_INS  1024
+
+typedef struct arm_decoded_t
+{
+	void (*fn)(const struct arm_decoded_t *d);
+	OpFn op_fn;
+	uint32_t opcode;
+	uint32_t imm; /*Rotated immediate, or branch offset*/
+	uint8_t rd, rn, rm, shift;
+} arm_decoded_t;
+
+static arm_decoded_t *decode_pool;
+static intptr_t decode_pool_owner[DECODE_POOL_SIZE];
+static int decode_pool_next;
+/*Decoded entries for each physical page, RAM pages followed by ROM pages*/
+static arm_decoded_t **decode_pages;
+static uintptr_t decode_nr_pages;
+
+static void dopGeneric(const arm_decoded_t *d)
+{
+	d->op_fn(d->opcode);
+}
+
+/*Data processing with an immediate or LSL #n register operand, and neither
+  Rd nor Rn being R15*/
+#define DOP_ARITH(name, op2)                                                    \
+	static void dop##name##AND(const arm_decoded_t *d) { armregs[d->rd] = armregs[d->rn] & op2; }  \
+	static void dop##name##EOR(const arm_decoded_t *d) { armregs[d->rd] = armregs[d->rn] ^ op2; }  \
+	static void dop##name##SUB(const arm_decoded_t *d) { armregs[d->rd] = armregs[d->rn] - op2; }  \
+	static void dop##name##RSB(const arm_decoded_t *d) { armregs[d->rd] = op2 - armregs[d->rn]; }  \
+	static void dop##name##ADD(const arm_decoded_t *d) { armregs[d->rd] = armregs[d->rn] + op2; }  \
+	static void dop##name##ORR(const arm_decoded_t *d) { armregs[d->rd] = armregs[d->rn] | op2; }  \
+	static void dop##name##MOV(const arm_decoded_t *d) { armregs[d->rd] = op2; }                   \
+	static void dop##name##BIC(const arm_decoded_t *d) { armregs[d->rd] = armregs[d->rn] & ~op2; } \
+	static void dop##name##MVN(const arm_decoded_t *d) { armregs[d->rd] = ~op2; }                  \
+	static void dop##name##SUBS(const arm_decoded_t *d)                     \
+	{                                                                       \
+		uint32_t op1 = armregs[d->rn], templ = op2;                     \
+		setsub(op1, templ, op1 - templ);                                \
+		armregs[d->rd] = op1 - templ;                                   \
+	}                                                                       \
+	static void dop##name##ADDS(const arm_decoded_t *d)                     \
+	{                                                                       \
+		uint32_t op1 = armregs[d->rn], templ = op2;                     \
+		setadd(op1, templ, op1 + templ);                                \
+		armregs[d->rd] = op1 + templ;                                   \
+	}                                                                       \
+	static void dop##name##CMP(const arm_decoded_t *d) { setsub(armregs[d->rn], op2, armregs[d->rn] - op2); } \
+	static void dop##name##CMN(const arm_decoded_t *d) { setadd(armregs[d->rn], op2, armregs[d->rn] + op2); } \
+	/*The following leave C alone, so are only used when the shifter does too*/ \
+	static void dop##name##TST(const arm_decoded_t *d) { setzn(armregs[d->rn] & op2); } \
+	static void dop##name##TEQ(const arm_decoded_t *d) { setzn(armregs[d->rn] ^ op2); } \
+	static void dop##name##MOVS(const arm_decoded_t *d)                     \
+	{                                                                       \
+		armregs[d->rd] = op2;                                           \
+		setzn(armregs[d->rd]);                                          \
+	}
+
+DOP_ARITH(imm, d->imm)
+DOP_ARITH(reg, (armregs[d->rm] << d->shift))
+
+static void dopB(const arm_decoded_t *d)
+{
+	armregs[15] = ((armregs[15] + d->imm + 4) & 0x3FFFFFC) | (armregs[15] & 0xFC000003);
+	refillpipeline();
+}
+
+static void dopBL(const arm_decoded_t *d)
+{
+	armregs[14] = armregs[15] - 4;
+	armregs[15] = ((armregs[15] + d->imm + 4) & 0x3FFFFFC) | (armregs[15] & 0xFC000003);
+	refillpipeline();
+}
+
+#define DOP_CASE(op, name)                                      \
+	case op:                                                \
+	d->fn = imm_op ? dopimm##name : dopreg##name;           \
+	break;
+
+static void arm_decode(arm_decoded_t *d, uint32_t opcode)
+{
+	int imm_op = opcode & 0x2000000;
+
+	d->opcode = opcode;
+	d->op_fn = opcode_fns[(opcode >> 20) & 0xff];
+	d->fn = dopGeneric;
+	d->rd = RD;
+	d->rn = RN;
+	d->rm = RM;
+	d->shift = (opcode >> 7) & 31;
+	d->imm = imm_op ? rotatelookup[opcode & 0xfff] : 0;
+
+	switch ((opcode >> 25) & 7)
+	{
+		case 0: /*Data processing, register operand*/
+		/*Only LSL by immediate. Bit 4 set is either a register
+		  specified shift, or a multiply or swap*/
+		if ((opcode & 0x70) || d->rm == 15)
+			break;
+		/*Fall through*/
+		case 1: /*Data processing, immediate operand*/
+		if (d->rd == 15 || d->rn == 15)
+			break;
+
+		switch ((opcode >> 20) & 0x1f)
+		{
+			DOP_CASE(0x00, AND)
+			DOP_CASE(0x02, EOR)
+			DOP_CASE(0x04, SUB)
+			DOP_CASE(0x05, SUBS)
+			DOP_CASE(0x06, RSB)
+			DOP_CASE(0x08, ADD)
+			DOP_CASE(0x09, ADDS)
+			DOP_CASE(0x15, CMP)
+			DOP_CASE(0x17, CMN)
+			DOP_CASE(0x18, ORR)
+			DOP_CASE(0x1a, MOV)
+			DOP_CASE(0x1c, BIC)
+			DOP_CASE(0x1e, MVN)
+
+			case 0x11: case 0x13: case 0x1b:
+			/*Shifter carry out is only unchanged for an unrotated
+			  immediate or LSL #0*/
+			if (opcode & (imm_op ? 0xf00 : 0xf80))
+				break;
+			switch ((opcode >> 20) & 0x1f)
+			{
+				DOP_CASE(0x11, TST)
+				DOP_CASE(0x13, TEQ)
+				DOP_CASE(0x1b, MOVS)
+			}
+			break;
+		}
+		break;
+
+		case 5: /*B/BL*/
+		d->imm = (opcode & 0xFFFFFF) << 2;
+		d->fn = (opcode & 0x1000000) ? dopBL : dopB;
+		break;
+	}
+}
+
+/*Returns the decoded entries for the 4k page at host, allocating them if
+  needed, or NULL if host is not in RAM or ROM*/
+static arm_decoded_t *arm_decode_page(const uint32_t *host)
+{
+	arm_decoded_t *page;
+	uintptr_t index;
+	int c;
+
+	if ((uintptr_t)host - (uintptr_t)ram < (ram_nr_pages << 12))
+		index = ((uintptr_t)host - (uintptr_t)ram) >> 12;
+	else if ((uintptr_t)host - (uintptr_t)rom < 0x200000)
+		index = ram_nr_pages + (((uintptr_t)host - (uintptr_t)rom) >> 12);
+	else
+		return NULL;
+
+	if (index >= decode_nr_pages)
+		return NULL;
+	if (decode_pages[index])
+		return decode_pages[index];
+
+	if (!decode_pool)
+		decode_pool = malloc(DECODE_POOL_SIZE * DECODE_PAGE_INS * sizeof(arm_decoded_t));
+
+	/*Reuse pages in allocation order once the pool is full*/
+	if (decode_pool_owner[decode_pool_next] >= 0)
+		decode_pages[decode_pool_owner[decode_pool_next]] = NULL;
+	decode_pool_owner[decode_pool_next] = index;
+	page = &decode_pool[decode_pool_next * DECODE_PAGE_INS];
+	decode_pool_next = (decode_pool_next + 1) % DECODE_POOL_SIZE;
+
+	/*Give every entry a valid tag, so only the opcode needs checking on use*/
+	arm_decode(&page[0], 0);
+	for (c = 1; c < DECODE_PAGE_INS; c++)
+		page[c] = page[0];
+
+	decode_pages[index] = page;
+	return page;
+}
+
+static void arm_decode_flush(void)
+{
+	int c;
+
+	if (decode_nr_pages != ram_nr_pages + 0x200)
+	{
+		free(decode_pages);
+		decode_nr_pages = ram_nr_pages + 0x200;
+		decode_pages = malloc(decode_nr_pages * sizeof(arm_decoded_t *));
+	}
+	memset(decode_pages, 0, decode_nr_pages * sizeof(arm_decoded_t *));
+	for (c = 0; c < DECODE_POOL_SIZE; c++)
+		decode_pool_owner[c] = -1;
+	decode_pool_next = 0;
+	pccache = 0xFFFFFFFF;
+	pcdecode = NULL;
+}
+
+/*Execute opcode, which has passed its condition check, through its decoded
+  entry if it is on the page in pccache*/
+static inline void arm_exec_decoded(uint32_t opcode)
+{
+	uint32_t exec_addr = PC - 8;
+
+	if (((exec_addr >> 12) == pccache) && pcdecode)
+	{
+		arm_decoded_t *d = &pcdecode[(exec_addr >> 2) & (DECODE_PAGE_INS-1)];
+
+		if (d->opcode != opcode)
+			arm_decode(d, opcode);
+		d->fn(d);
+	}
+	else
+		opcode_fns[(opcode >> 20) & 0xff](opcode);
+}
+
+/*Threaded code core.
+
+  Straight-line runs of instructions are decoded once into blocks of
+  arm_decoded_t entries. Blocks never cross a 4k page and are keyed on the host
+  address of their first instruction, ie on physical memory, so they stay valid
+  across MEMC remaps and are shared between logical aliases of the same page.
+  Writes to a RAM page holding blocks (see RAM_PAGE_CODE) throw away every block
+  on that page. ROM blocks are only discarded on a full flush.
+
+  Within a block the per-instruction bookkeeping of the interpreter loop is
+  skipped - timers that were not already run by the memory timing code,
+  interrupt sampling and the cycle count are all handled at the end of the
+  block. This means IRQs and FIQs can be taken up to BLOCK_MAX_INS instructions
+  later than in the interpreter; aborts are still taken immediately.*/
+#define BLOCK_MAX_INS   32
+#define BLOCK_POOL_SIZE 4096
+#define BLOCK_HASH_SIZE 4096
+
+typedef struct arm_block_t
+{
+	const uint32_t *host; /*Host address of first instruction, NULL if invalidated*/
+	struct arm_block_t *hash_next, **hash_pprev;
+	struct arm_block_t *page_next;
+	int nr_ins;
+
+	arm_decoded_t ins[BLOCK_MAX_INS];
+} arm_block_t;
+
+static arm_block_t *block_pool;
+static int block_pool_used;
+static arm_block_t *block_hash[BLOCK_HASH_SIZE];
+/*Blocks translated from each physical RAM page*/
+static arm_block_t **block_ram_pages;
+static uintptr_t block_ram_nr_pages;
+/*Set when the block currently being executed may no longer be valid*/
+static int block_exit;
+
+#define BLOCK_HASH(host) (((uintptr_t)(host) >> 2) & (BLOCK_HASH_SIZE-1))
+
+void arm_code_flush(void)
+{
+	uintptr_t c;
+
+	memset(block_hash, 0, sizeof(block_hash));
+	block_pool_used = 0;
+	block_exit = 1;
+
+	if (block_ram_nr_pages != ram_nr_pages)
+	{
+		free(block_ram_pages);
+		block_ram_nr_pages = ram_nr_pages;
+		block_ram_pages = malloc(block_ram_nr_pages * sizeof(arm_block_t *));
+	}
+	memset(block_ram_pages, 0, block_ram_nr_pages * sizeof(arm_block_t *));
+	for (c = 0; c < ram_nr_pages; c++)
+		ram_page_flags[c] &= ~RAM_PAGE_CODE;
+
+	arm_decode_flush();
+}
+
+/*Called when the logical to physical mapping may have changed. The fetch cache
+  is keyed on logical address so must be dropped; blocks are keyed on physical
+  address and survive*/
+void arm_code_remap(void)
+{
+	pccache = 0xFFFFFFFF;
+	block_exit = 1;
+}
+
+void arm_invalidate_code_page(uintptr_t page)
+{
+	arm_block_t *block = block_ram_pages[page];
+
+	while (block)
+	{
+		*block->hash_pprev = block->hash_next;
+		if (block->hash_next)
+			block->hash_next->hash_pprev = block->hash_pprev;
+		block->host = NULL;
+		block = block->page_next;
+	}
+	block_ram_pages[page] = NULL;
+	ram_page_flags[page] &= ~RAM_PAGE_CODE;
+	block_exit = 1;
+}
+
+/*Returns non-zero if opcode will always change R15, making the rest of the
+  block unreachable*/
+static int arm_ins_ends_block(uint32_t opcode)
+{
+	if ((opcode >> 28) != 0xe)
+		return 0;
+
+	switch ((opcode >> 25) & 7)
+	{
+		case 0: case 1: /*Data processing*/
+		return RD == 15 && ((opcode >> 21) & 0xc) != 0x8;
+		case 2: case 3: /*LDR*/
+		return (opcode & (1 << 20)) && RD == 15;
+		case 4: /*LDM*/
+		return (opcode & (1 << 20)) && (opcode & 0x8000);
+		case 5: /*B/BL*/
+		return 1;
+		case 7: /*SWI*/
+		return (opcode & (1 << 24)) ? 1 : 0;
+	}
+	return 0;
+}
+
+static arm_block_t *arm_block_translate(const uint32_t *host, uint32_t addr)
+{
+	arm_block_t *block;
+	uintptr_t page;
+	int nr_ins = 0;
+
+	if (!block_pool)
+		block_pool = malloc(BLOCK_POOL_SIZE * sizeof(arm_block_t));
+	if (block_pool_used == BLOCK_POOL_SIZE)
+		arm_code_flush();
+	block = &block_pool[block_pool_used++];
+
+	do
+	{
+		uint32_t opcode = host[nr_ins];
+
+		arm_decode(&block->ins[nr_ins], opcode);
+		nr_ins++;
+
+		if (arm_ins_ends_block(opcode))
+			break;
+	} while (nr_ins < BLOCK_MAX_INS && ((addr + nr_ins*4) & 0xfff));
+
+	block->host = host;
+	block->nr_ins = nr_ins;
+
+	block->hash_pprev = &block_hash[BLOCK_HASH(host)];
+	block->hash_next = *block->hash_pprev;
+	if (block->hash_next)
+		block->hash_next->hash_pprev = &block->hash_next;
+	*block->hash_pprev = block;
+
+	page = ((uintptr_t)host - (uintptr_t)ram) >> 12;
+	if (page < ram_nr_pages)
+	{
+		block->page_next = block_ram_pages[page];
+		block_ram_pages[page] = block;
+		ram_page_flags[page] |= RAM_PAGE_CODE;
+	}
+	else
+		block->page_next = NULL;
+
+	return block;
+}
+
+static inline arm_block_t *arm_block_lookup(const uint32_t *host, uint32_t addr)
+{
+	arm_block_t *block = block_hash[BLOCK_HASH(host)];
+
+	while (block)
+	{
+		if (block->host == host)
+			return block;
+		block = block->hash_next;
+	}
+
+	return arm_block_translate(host, addr);
+}
+
+/*Execute the block starting at the current instruction. Returns 0 if there is
+  no usable block, in which case the caller should interpret one instruction*/
+static int arm_exec_block(void)
+{
+	uint32_t exec_addr = (PC - 8) & 0x3fffffc;
+	uint32_t templ, templ2;
+	uint64_t oldcyc = tsc;
+	arm_block_t *block;
+	int c;
+
+	if (((exec_addr >> 12) != pccache) || armirq || prefabort || prefabort_next)
+		return 0;
+
+	block = arm_block_lookup(&pccache2[exec_addr >> 2], exec_addr);
+	block_exit = 0;
+
+	for (c = 0; c < block->nr_ins; c++)
+	{
+		opcode = opcode2;
+		opcode2 = opcode3;
+		if (c + 2 < block->nr_ins)
+			opcode3 = block->ins[c + 2].opcode;
+		else
+			readmemfff(PC, opcode3);
+		cache_read_timing(PC, ((PC & 0xc) && !promote_fetch_to_n) ? 0 : 1, promote_fetch_to_n);
+		promote_fetch_to_n = PROMOTE_NONE;
+
+		if (flaglookup[opcode >> 28][armregs[15] >> 28])
+		{
+			/*The first two instructions come from the pipeline, which
+			  may predate the block if memory has been modified*/
+			if (c >= 2)
+				block->ins[c].fn(&block->ins[c]);
+			else
+				opcode_fns[(opcode >> 20) & 0xff](opcode);
+		}
+
+		if (databort)
+			arm_handle_exceptions();
+		prefabort = prefabort_next;
+		armregs[15] += 4;
+
+		if (block_exit || prefabort || (PC != ((exec_addr + (c + 1) * 4 + 8) & 0x3fffffc)))
+		{
+			c++;
+			break;
+		}
+	}
+
+	armirq = irq;
+#ifndef RELEASE_BUILD
+	if ((armregs[15] & 3) != mode)
+	{
+		dumpregs();
+		fatal("Mode mismatch\n");
+	}
+	ins += c;
+#endif
+	inscount += c;
+
+	if (TIMER_VAL_LESS_THAN_VAL(timer_target, tsc >> 32))
+		timer_process();
+
+	total_cycles -= (tsc - oldcyc);
+
+	return 1;
+}
+
+/*Event horizon batching for the interpreter.
+
+  While no interrupt is pending and no abort is outstanding, instructions are
+  run in a tight loop up to the earlier of the next timer and the end of the
+  current execarm() slice. The loop skips the per-instruction timer check,
+  cycle accounting and debug checks of the exact path, and drops back to it as
+  soon as an instruction raises an interrupt or prefetch abort. timer_enable()
+  pulls timer_horizon in if a timer is added that expires before it. DMA does
+  not limit the horizon, as the memory timing code already catches it up on
+  every N and I cycle.
+
+  Returns 0 if a timer is already due, in which case the caller should use the
+  exact path.*/
+static int arm_exec_batch(void)
+{
+	uint64_t start_tsc = tsc;
+	uint64_t timer_ts = (uint64_t)timer_target << 32;
+	uint32_t templ, templ2;
+	int nr_ins = 0;
+
+	timer_horizon = start_tsc + total_cycles;
+	if (TIMER_VAL_LESS_THAN_NE_VAL_64(timer_ts, timer_horizon))
+		timer_horizon = timer_ts;
+	if (!TIMER_VAL_LESS_THAN_NE_VAL_64(tsc, timer_horizon))
+		return 0;
+
+	do
+	{
+		opcode = opcode2;
+		opcode2 = opcode3;
+		readmemfff(PC, opcode3);
+		cache_read_timing(PC, ((PC & 0xc) && !promote_fetch_to_n) ? 0 : 1, promote_fetch_to_n);
+		promote_fetch_to_n = PROMOTE_NONE;
+
+		if (flaglookup[opcode >> 28][armregs[15] >> 28])
+			arm_exec_decoded(opcode);
+
+		if (databort | prefabort)
+			arm_handle_exceptions();
+		prefabort = prefabort_next;
+		armirq = irq;
+		armregs[15] += 4;
+		nr_ins++;
+	} while (!(armirq | prefabort | debugon) && TIMER_VAL_LESS_THAN_NE_VAL_64(tsc, timer_horizon));
+
+#ifndef RELEASE_BUILD
+	if ((armregs[15] & 3) != mode)
+	{
+		dumpregs();
+		fatal("Mode mismatch\n");
+	}
+	ins += nr_ins;
+#endif
+	inscount += nr_ins;
+
+	if (TIMER_VAL_LESS_THAN_VAL(timer_target, tsc >> 32))
+		timer_process();
+
+	total_cycles -= (tsc - start_tsc);
+
+	return nr_ins;
+}
+
+void arm_snapshot(snapshot_t *s)
+{
+	uint8_t tag_cached[4][64];
+	int set, slot;
+
+	SNAPSHOT_ARRAY(s, armregs);
+	SNAPSHOT_ARRAY(s, userregs);
+	SNAPSHOT_ARRAY(s, superregs);
+	SNAPSHOT_ARRAY(s, fiqregs);
+	SNAPSHOT_ARRAY(s, irqregs);
+	SNAPSHOT_VAR(s, mode);
+	SNAPSHOT_VAR(s, opcode);
+	SNAPSHOT_VAR(s, opcode2);
+	SNAPSHOT_VAR(s, opcode3);
+	SNAPSHOT_VAR(s, irq);
+	SNAPSHOT_VAR(s, armirq);
+	SNAPSHOT_VAR(s, databort);
+	SNAPSHOT_VAR(s, prefabort);
+	SNAPSHOT_VAR(s, prefabort_next);
+	SNAPSHOT_VAR(s, total_cycles);
+
+	SNAPSHOT_VAR(s, clock_domain);
+	SNAPSHOT_VAR(s, mem_available_ts);
+	SNAPSHOT_VAR(s, refresh_ts);
+	SNAPSHOT_VAR(s, pending_reads);
+	SNAPSHOT_VAR(s, cache_fill_addr);
+	SNAPSHOT_VAR(s, last_cycle_length);
+	SNAPSHOT_VAR(s, cache_was_on);
+	SNAPSHOT_VAR(s, promote_fetch_to_n);
+
+	/*Store whether each tag's line is present, for snapshots taken before
+	  cache_flush() invalidated every tag*/
+	for (set = 0; set < 4; set++)
+	{
+		for (slot = 0; slot < 64; slot++)
+			tag_cached[set][slot] = (arm3_cache_tag[set][slot] != TAG_INVALID);
+	}
+	SNAPSHOT_ARRAY(s, arm3_cache_tag);
+	SNAPSHOT_ARRAY(s, tag_cached);
+	SNAPSHOT_VAR(s, arm3_slot);
+
+	if (s->loading)
+	{
+		memset(arm3_cache_lines, 0, sizeof(arm3_cache_lines));
+		for (set = 0; set < 4; set++)
+		{
+			for (slot = 0; slot < 64; slot++)
+			{
+				uint32_t tag = arm3_cache_tag[set][slot] & 0x3fffff0;
+
+				if (arm3_cache_tag[set][slot] == TAG_INVALID || !tag_cached[set][slot] ||
+				    ((tag >> 4) & 3) != set || arm3_cache_lookup(tag))
+					arm3_cache_tag[set][slot] = TAG_INVALID;
+				else
+				{
+					arm3_cache_tag[set][slot] = tag;
+					arm3_cache_insert(tag);
+				}
+			}
+		}
+
+		/*Rebuild register bank pointers and memory mode for the loaded
+		  mode. MEMC has already been loaded, so osmode is valid*/
+		updatemode(mode);
+		recalc_min_timer();
+		arm_code_flush();
+		arm_code_remap();
+	}
+}
+
 /*Execute ARM instructions for `cycs` clock ticks, typically 10 ms
   (cycs=80k for an 8MHz ARM2).*/
 void execarm(int cycles_to_execute)
@@ -2638,6 +3428,13 @@ void execarm(int cycles_to_execute)
 //                        oldcyc, vidc_cycles_to_execute, 0, 0);
 		uint64_t oldcyc = tsc;
 
+		uint32_t exec_addr = PC - 8;
+
+		if (arm_cpu_core == ARM_CORE_THREADED && !debugon && !output && !profiler_enabled && arm_exec_block())
+			continue;
+		if (arm_cpu_core == ARM_CORE_INTERPRETER && !armirq && !prefabort && !debugon && !output && !profiler_enabled && arm_exec_batch())
+			continue;
+
 		opcode = opcode2;
 		opcode2 = opcode3;
 		if ((PC >> 12) == pccache)
@@ -2650,9 +3447,8 @@ void execarm(int cycles_to_execute)
 			{
 				pccache = templ2;
 				pccache2 = (uint32_t *)mempoint[templ2];
+				pcdecode = arm_decode_page(&pccache2[templ2 << 10]);
 				opcode3 = pccache2[PC >> 2];
-				cyc_s = mem_speed[templ2 & 0x3fff][0];
-				cyc_n = mem_speed[templ2 & 0x3fff][1];
 			}
 			else
 			{
@@ -2669,43 +3465,11 @@ void execarm(int cycles_to_execute)
 				debugger_do();
 
 			if (flaglookup[opcode >> 28][armregs[15] >> 28])
-				opcode_fns[(opcode >> 20) & 0xff](opcode);
+				arm_exec_decoded(opcode);
 		}
 
 		if (databort|armirq|prefabort)
-		{
-			if (prefabort)       /*Prefetch abort*/
-			{
-				if (debugon)
-					debug_trap(DEBUG_TRAP_PREF_ABORT, opcode);
-				prefabort = 0;
-				EXCEPTION_PREF_ABORT();
-			}
-			else if (databort == 1)     /*Data abort*/
-			{
-				if (debugon)
-					debug_trap(DEBUG_TRAP_DATA_ABORT, opcode);
-				databort = 0;
-				EXCEPTION_DATA_ABORT();
-			}
-			else if (databort == 2) /*Address Exception*/
-			{
-				if (debugon)
-					debug_trap(DEBUG_TRAP_ADDR_EXCEP, opcode);
-				databort = 0;
-				EXCEPTION_ADDRESS();
-			}
-			else if ((armirq&2) && !(armregs[15]&0x4000000)) /*FIQ*/
-			{
-//                                rpclog("FIQ %02X %i\n",ioc.fiq&ioc.mskf, 0);
-				EXCEPTION_FIQ();
-			}
-			else if ((armirq&1) && !(armregs[15]&0x8000000)) /*IRQ*/
-			{
-//                                rpclog("IRQ %02X %02X\n",ioc.irqa&ioc.mska,ioc.irqb&ioc.mskb);
-				EXCEPTION_IRQ();
-			}
-		}
+			arm_handle_exceptions();
 		prefabort = prefabort_next;
 		armirq = irq;
 		armregs[15] += 4;
@@ -2734,6 +3498,10 @@ void execarm(int cycles_to_execute)
 		}
 		ins++;
 #endif
+		inscount++;
+
+		if (profiler_enabled)
+			profiler_record(exec_addr, opcode, tsc - oldcyc);
 
 		if (TIMER_VAL_LESS_THAN_VAL(timer_target, tsc >> 32))
 			timer_process();
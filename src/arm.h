@@ -1,8 +1,35 @@
 extern int arm_cpu_type;
 
+enum
+{
+	ARM_CORE_INTERPRETER = 0,
+	ARM_CORE_THREADED
+};
+
+/*Selects between the plain interpreter and the threaded code core, which runs
+  cached blocks of predecoded instructions*/
+extern int arm_cpu_core;
+
+enum
+{
+	ARM_TIMING_CYCLE_EXACT = 0,
+	ARM_TIMING_FAST
+};
+
+/*Selects between the full MEMC/ARM3 cycle timing model and a fast tier, which
+  charges a fixed length for each memory and internal cycle and doesn't model
+  line fills, clock domain syncing or DMA contention. Applied by arc_set_cpu()*/
+extern int arm_cpu_timing;
+
+extern void arm_code_flush(void);
+extern void arm_code_remap(void);
+extern void arm_invalidate_code_page(uintptr_t page);
+extern void arm_timing_flush(void);
+
 extern int arm_cpu_speed, arm_mem_speed;
 extern int arm_has_swp;
 extern int arm_has_cp15;
+extern int arm_timing_fast;
 
 extern void cache_flush();
 
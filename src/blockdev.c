@@ -0,0 +1,441 @@
+/*Arculator 2.2 by Sarah Walker
+  Buffered block device for hard disc images*/
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "blockdev.h"
+
+#ifdef _WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define BLOCKDEV_HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define BLOCK_SHIFT 12
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define CACHE_BLOCKS 256 /*1MB per image*/
+#define HASH_SIZE 512
+/*Most blocks read ahead on a sequential miss, and written back in one go*/
+#define RUN_BLOCKS 16
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+typedef struct blockdev_block_t
+{
+	uint64_t block;
+	int valid, dirty;
+	uint32_t last_used;
+	int hash_next;
+	uint8_t data[BLOCK_SIZE];
+} blockdev_block_t;
+
+struct blockdev_t
+{
+	FILE *f;
+	uint64_t pos;
+	/*Size of the image, including data not yet written back*/
+	uint64_t size;
+	/*Block following the last one accessed, to spot sequential access*/
+	uint64_t next_block;
+	uint32_t clock;
+	/*Blocks to write back, or when mapped, whether there is anything to
+	  msync()*/
+	int nr_dirty;
+
+	/*Whole image when it is mapped, otherwise NULL*/
+	uint8_t *map;
+	uint64_t map_size;
+	int writable;
+
+	int hash[HASH_SIZE];
+	blockdev_block_t blocks[CACHE_BLOCKS];
+
+	uint8_t read_buf[RUN_BLOCKS * BLOCK_SIZE];
+	uint8_t write_buf[RUN_BLOCKS * BLOCK_SIZE];
+
+	blockdev_stats_t stats;
+
+	struct blockdev_t *next;
+};
+
+int blockdev_mmap = 0;
+
+/*All open images, for blockdev_flush_all()*/
+static blockdev_t *blockdev_list = NULL;
+
+#ifdef BLOCKDEV_HAVE_MMAP
+static void blockdev_map(blockdev_t *bd)
+{
+	void *map;
+
+	if (!bd->size || bd->size != (size_t)bd->size)
+		return;
+
+	map = mmap(NULL, bd->size, PROT_READ | (bd->writable ? PROT_WRITE : 0), MAP_SHARED, fileno(bd->f), 0);
+	if (map == MAP_FAILED)
+		return;
+
+	bd->map = map;
+	bd->map_size = bd->size;
+}
+
+/*Go back to using the cache, eg to write beyond the end of the mapped image*/
+static void blockdev_unmap(blockdev_t *bd)
+{
+	if (bd->writable)
+		msync(bd->map, bd->map_size, MS_SYNC);
+	munmap(bd->map, bd->map_size);
+	bd->map = NULL;
+	bd->nr_dirty = 0;
+}
+#endif
+
+static int blockdev_find(blockdev_t *bd, uint64_t block)
+{
+	int c = bd->hash[block & (HASH_SIZE-1)];
+
+	while (c != -1 && bd->blocks[c].block != block)
+		c = bd->blocks[c].hash_next;
+
+	return c;
+}
+
+static void blockdev_hash_remove(blockdev_t *bd, int c)
+{
+	int *p = &bd->hash[bd->blocks[c].block & (HASH_SIZE-1)];
+
+	while (*p != c)
+		p = &bd->blocks[*p].hash_next;
+	*p = bd->blocks[c].hash_next;
+}
+
+/*Take a cache slot for block, evicting the least recently used one. Evicting
+  a dirty block writes back everything dirty, so that it goes out in runs*/
+static int blockdev_alloc(blockdev_t *bd, uint64_t block)
+{
+	int victim = 0;
+	int c;
+
+	for (c = 0; c < CACHE_BLOCKS; c++)
+	{
+		if (!bd->blocks[c].valid)
+		{
+			victim = c;
+			break;
+		}
+		if (bd->blocks[c].last_used < bd->blocks[victim].last_used)
+			victim = c;
+	}
+
+	if (bd->blocks[victim].valid)
+	{
+		if (bd->blocks[victim].dirty)
+			blockdev_flush(bd);
+		blockdev_hash_remove(bd, victim);
+	}
+
+	bd->blocks[victim].block = block;
+	bd->blocks[victim].valid = 1;
+	bd->blocks[victim].dirty = 0;
+	bd->blocks[victim].last_used = ++bd->clock;
+	bd->blocks[victim].hash_next = bd->hash[block & (HASH_SIZE-1)];
+	bd->hash[block & (HASH_SIZE-1)] = victim;
+
+	return victim;
+}
+
+/*Read block into the cache. If it carries on from the last block accessed,
+  read ahead the following uncached blocks as well*/
+static int blockdev_fill(blockdev_t *bd, uint64_t block)
+{
+	int slots[RUN_BLOCKS];
+	int nr_blocks = 1;
+	size_t got;
+	int c;
+
+	if (block == bd->next_block)
+	{
+		while (nr_blocks < RUN_BLOCKS && ((block + nr_blocks) << BLOCK_SHIFT) < bd->size &&
+		       blockdev_find(bd, block + nr_blocks) == -1)
+			nr_blocks++;
+	}
+
+	/*Allocate first, as that can write back dirty blocks*/
+	for (c = 0; c < nr_blocks; c++)
+		slots[c] = blockdev_alloc(bd, block + c);
+
+	got = 0;
+	if (!fseeko(bd->f, (off_t)(block << BLOCK_SHIFT), SEEK_SET))
+		got = fread(bd->read_buf, 1, nr_blocks * BLOCK_SIZE, bd->f);
+	/*Anything past the end of the file reads as zero*/
+	memset(bd->read_buf + got, 0, nr_blocks * BLOCK_SIZE - got);
+
+	for (c = 0; c < nr_blocks; c++)
+		memcpy(bd->blocks[slots[c]].data, bd->read_buf + c * BLOCK_SIZE, BLOCK_SIZE);
+
+	bd->stats.reads++;
+	bd->stats.blocks_read += nr_blocks;
+
+	return slots[0];
+}
+
+/*Return the cache slot holding block. Its old contents need not be read if
+  they are about to be completely overwritten*/
+static int blockdev_get(blockdev_t *bd, uint64_t block, int overwrite)
+{
+	int c = blockdev_find(bd, block);
+
+	if (c != -1)
+		bd->stats.hits++;
+	else
+	{
+		bd->stats.misses++;
+		if (overwrite || (block << BLOCK_SHIFT) >= bd->size)
+		{
+			c = blockdev_alloc(bd, block);
+			memset(bd->blocks[c].data, 0, BLOCK_SIZE);
+		}
+		else
+			c = blockdev_fill(bd, block);
+	}
+
+	bd->blocks[c].last_used = ++bd->clock;
+	bd->next_block = block + 1;
+
+	return c;
+}
+
+blockdev_t *blockdev_open(const char *fn, const char *mode)
+{
+	blockdev_t *bd;
+	FILE *f;
+	int c;
+
+	f = fopen(fn, mode);
+	if (!f)
+		return NULL;
+
+	bd = malloc(sizeof(blockdev_t));
+	if (!bd)
+	{
+		fclose(f);
+		return NULL;
+	}
+	memset(bd, 0, sizeof(blockdev_t));
+
+	/*All buffering is done here, so have stdio pass requests straight
+	  through*/
+	setvbuf(f, NULL, _IONBF, 0);
+	bd->f = f;
+
+	fseeko(f, 0, SEEK_END);
+	bd->size = ftello(f);
+	bd->next_block = (uint64_t)-1;
+	for (c = 0; c < HASH_SIZE; c++)
+		bd->hash[c] = -1;
+
+	bd->writable = strchr(mode, '+') || strchr(mode, 'w') || strchr(mode, 'a');
+#ifdef BLOCKDEV_HAVE_MMAP
+	if (blockdev_mmap)
+		blockdev_map(bd);
+#endif
+
+	bd->next = blockdev_list;
+	blockdev_list = bd;
+
+	return bd;
+}
+
+void blockdev_close(blockdev_t *bd)
+{
+	blockdev_t **p = &blockdev_list;
+
+	while (*p != bd)
+		p = &(*p)->next;
+	*p = bd->next;
+
+	blockdev_flush(bd);
+#ifdef BLOCKDEV_HAVE_MMAP
+	if (bd->map)
+		munmap(bd->map, bd->map_size);
+#endif
+	fclose(bd->f);
+	free(bd);
+}
+
+static int blockdev_compare(const void *p1, const void *p2)
+{
+	const blockdev_block_t *b1 = *(const blockdev_block_t **)p1;
+	const blockdev_block_t *b2 = *(const blockdev_block_t **)p2;
+
+	if (b1->block < b2->block)
+		return -1;
+	return b1->block > b2->block;
+}
+
+int blockdev_flush(blockdev_t *bd)
+{
+	blockdev_block_t *dirty[CACHE_BLOCKS];
+	int nr_dirty = 0;
+	int ret = 0;
+	int c, d;
+
+#ifdef BLOCKDEV_HAVE_MMAP
+	if (bd->map)
+	{
+		if (!bd->nr_dirty)
+			return 0;
+		bd->nr_dirty = 0;
+		return msync(bd->map, bd->map_size, MS_SYNC) ? -1 : 0;
+	}
+#endif
+	if (!bd->nr_dirty)
+		return 0;
+
+	for (c = 0; c < CACHE_BLOCKS; c++)
+	{
+		if (bd->blocks[c].valid && bd->blocks[c].dirty)
+			dirty[nr_dirty++] = &bd->blocks[c];
+	}
+	qsort(dirty, nr_dirty, sizeof(dirty[0]), blockdev_compare);
+
+	/*Write back runs of consecutive blocks with one write each*/
+	for (c = 0; c < nr_dirty; c = d)
+	{
+		uint64_t start = dirty[c]->block << BLOCK_SHIFT;
+		uint64_t len;
+
+		for (d = c; d < nr_dirty && d - c < RUN_BLOCKS && dirty[d]->block == dirty[c]->block + (d - c); d++)
+		{
+			memcpy(bd->write_buf + (d - c) * BLOCK_SIZE, dirty[d]->data, BLOCK_SIZE);
+			dirty[d]->dirty = 0;
+		}
+
+		/*Don't extend the image beyond the data actually written to it*/
+		len = (uint64_t)(d - c) << BLOCK_SHIFT;
+		if (start + len > bd->size)
+			len = bd->size - start;
+
+		if (fseeko(bd->f, (off_t)start, SEEK_SET) ||
+		    fwrite(bd->write_buf, 1, len, bd->f) != len)
+			ret = -1;
+
+		bd->stats.writes++;
+		bd->stats.blocks_written += d - c;
+	}
+	bd->nr_dirty = 0;
+
+	if (fflush(bd->f))
+		ret = -1;
+
+	return ret;
+}
+
+int blockdev_flush_all(void)
+{
+	blockdev_t *bd;
+	int ret = 0;
+
+	for (bd = blockdev_list; bd; bd = bd->next)
+	{
+		if (blockdev_flush(bd))
+			ret = -1;
+	}
+
+	return ret;
+}
+
+void blockdev_seek(blockdev_t *bd, uint64_t offset)
+{
+	bd->pos = offset;
+}
+
+uint64_t blockdev_tell(blockdev_t *bd)
+{
+	return bd->pos;
+}
+
+size_t blockdev_read(blockdev_t *bd, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	size_t done = 0;
+
+	if (bd->pos >= bd->size)
+		return 0;
+	if (len > bd->size - bd->pos)
+		len = bd->size - bd->pos;
+
+	if (bd->map)
+	{
+		memcpy(buf, bd->map + bd->pos, len);
+		bd->stats.hits++;
+		bd->pos += len;
+		return len;
+	}
+
+	while (done < len)
+	{
+		uint32_t offset = bd->pos & (BLOCK_SIZE-1);
+		size_t chunk = MIN(BLOCK_SIZE - offset, len - done);
+		int c = blockdev_get(bd, bd->pos >> BLOCK_SHIFT, 0);
+
+		memcpy(p + done, bd->blocks[c].data + offset, chunk);
+		done += chunk;
+		bd->pos += chunk;
+	}
+
+	return done;
+}
+
+size_t blockdev_write(blockdev_t *bd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	size_t done = 0;
+
+#ifdef BLOCKDEV_HAVE_MMAP
+	if (bd->map)
+	{
+		if (bd->writable && bd->pos + len <= bd->map_size)
+		{
+			memcpy(bd->map + bd->pos, buf, len);
+			bd->nr_dirty = 1;
+			bd->stats.hits++;
+			bd->pos += len;
+			return len;
+		}
+		blockdev_unmap(bd);
+	}
+#endif
+
+	while (done < len)
+	{
+		uint32_t offset = bd->pos & (BLOCK_SIZE-1);
+		size_t chunk = MIN(BLOCK_SIZE - offset, len - done);
+		int c = blockdev_get(bd, bd->pos >> BLOCK_SHIFT, chunk == BLOCK_SIZE);
+
+		memcpy(bd->blocks[c].data + offset, p + done, chunk);
+		if (!bd->blocks[c].dirty)
+		{
+			bd->blocks[c].dirty = 1;
+			bd->nr_dirty++;
+		}
+		done += chunk;
+		bd->pos += chunk;
+		if (bd->pos > bd->size)
+			bd->size = bd->pos;
+	}
+
+	return done;
+}
+
+void blockdev_get_stats(blockdev_t *bd, blockdev_stats_t *stats)
+{
+	*stats = bd->stats;
+}
@@ -0,0 +1,55 @@
+#ifndef _BLOCKDEV_H_
+#define _BLOCKDEV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*Buffered access to hard disc image files, shared by the IDE, ST-506 and SCSI
+  emulations. This has no dependencies on the rest of the emulator, so that
+  podules can use it too.
+
+  Reads and writes go through an LRU cache of image blocks. A miss continuing a
+  sequential run reads ahead several blocks in one go. Writes are held in the
+  cache and written back in contiguous runs when dirty blocks are evicted, or
+  on blockdev_flush() / blockdev_flush_all() / blockdev_close(). updateins()
+  calls blockdev_flush_all() once a second, which bounds how much is lost
+  if the emulator is killed (or a browser tab closed) without arc_close(). Like a FILE, a blockdev_t has a
+  current position that reads and writes advance.
+
+  On native POSIX builds, setting blockdev_mmap maps images into memory
+  instead, so that sector transfers are plain copies and flushing is an
+  msync(). Images that can't be mapped, or that are written past their end,
+  use the cache*/
+typedef struct blockdev_t blockdev_t;
+
+/*Map images opened from now on into memory, where supported*/
+extern int blockdev_mmap;
+
+typedef struct blockdev_stats_t
+{
+	uint64_t hits, misses;
+	uint64_t blocks_read, blocks_written;
+	uint64_t reads, writes; /*Host read/write calls*/
+} blockdev_stats_t;
+
+/*Open image fn with fopen() mode mode. Returns NULL on failure, with errno
+  set*/
+blockdev_t *blockdev_open(const char *fn, const char *mode);
+/*Write back any dirty blocks and close the image*/
+void blockdev_close(blockdev_t *bd);
+/*Write back any dirty blocks. Returns non-zero on error*/
+int blockdev_flush(blockdev_t *bd);
+/*Write back dirty blocks of every open image. Returns non-zero on error*/
+int blockdev_flush_all(void);
+
+void blockdev_seek(blockdev_t *bd, uint64_t offset);
+uint64_t blockdev_tell(blockdev_t *bd);
+/*Returns the number of bytes read, which is short at the end of the image*/
+size_t blockdev_read(blockdev_t *bd, void *buf, size_t len);
+/*Returns the number of bytes written. Writing past the end of the image
+  extends it*/
+size_t blockdev_write(blockdev_t *bd, const void *buf, size_t len);
+
+void blockdev_get_stats(blockdev_t *bd, blockdev_stats_t *stats);
+
+#endif /*_BLOCKDEV_H_*/
@@ -11,6 +11,7 @@
 #include "bmu.h"
 #include "cmos.h"
 #include "config.h"
+#include "snapshot.h"
 #include "timer.h"
 
 int cmos_changed = 0;
@@ -263,6 +264,16 @@ void cmos_init()
 	timer_add(&cmos.timer, cmos_tick, NULL, 1);
 }
 
+void cmos_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, i2c);
+	SNAPSHOT_VAR(s, i2c_clock);
+	SNAPSHOT_VAR(s, i2c_data);
+	SNAPSHOT_STRUCT_TO(s, cmos, timer);
+	timer_snapshot(s, &cmos.timer);
+	SNAPSHOT_VAR(s, systemtime);
+}
+
 void cmos_write(uint8_t byte)
 {
 	LOG_CMOS("cmos_write()\n");
@@ -5,6 +5,7 @@
 #include <string.h>
 #include "arc.h"
 #include "arm.h"
+#include "blockdev.h"
 #include "config.h"
 #include "disc.h"
 #include "fpa.h"
@@ -13,6 +14,7 @@
 #include "plat_joystick.h"
 #include "plat_video.h"
 #include "podules.h"
+#include "rewind.h"
 #include "sound.h"
 #include "st506.h"
 #include "video.h"
@@ -706,6 +708,8 @@ void loadconfig()
 	soundena = config_get_int(CFG_GLOBAL, NULL, "sound_enable", 1);
     display_mode = config_get_int(CFG_MACHINE, NULL, "display_mode", DISPLAY_MODE_NATIVE_BORDERS);
 	arm_cpu_type = config_get_int(CFG_MACHINE, NULL, "cpu_type", 0);
+	arm_cpu_core = config_get_int(CFG_MACHINE, NULL, "cpu_core", ARM_CORE_INTERPRETER);
+	arm_cpu_timing = config_get_int(CFG_MACHINE, NULL, "cpu_timing", ARM_TIMING_CYCLE_EXACT);
 	memc_type = config_get_int(CFG_MACHINE, NULL, "memc_type", 0);
 	fpaena = config_get_int(CFG_MACHINE, NULL, "fpa", 0);
 	fpu_type = config_get_int(CFG_MACHINE, NULL, "fpu_type", 0);
@@ -714,6 +718,7 @@ void loadconfig()
 	video_scale = config_get_int(CFG_MACHINE, NULL, "video_scale", 1);
 	video_fullscreen_scale = config_get_int(CFG_MACHINE, NULL, "video_fullscreen_scale", FULLSCR_SCALE_FULL);
 	video_linear_filtering = config_get_int(CFG_MACHINE, NULL, "video_linear_filtering", 0);
+	video_frame_render = config_get_int(CFG_MACHINE, NULL, "video_frame_render", 1);
 	video_black_level = config_get_int(CFG_MACHINE, NULL, "video_black_level", BLACK_LEVEL_ACORN);
 	fdctype = config_get_int(CFG_MACHINE, NULL, "fdc_type", 1);
 	st506_present = config_get_int(CFG_MACHINE, NULL, "st506_present", 0);
@@ -721,6 +726,9 @@ void loadconfig()
 	sound_gain = config_get_int(CFG_GLOBAL, NULL, "sound_gain", 0);
 	sound_filter = config_get_int(CFG_GLOBAL, NULL, "sound_filter", 0);
 	disc_noise_gain = config_get_int(CFG_GLOBAL, NULL, "disc_noise_gain", 0);
+	rewind_memory_mb = config_get_int(CFG_GLOBAL, NULL, "rewind_memory", 0);
+	rewind_interval = config_get_int(CFG_GLOBAL, NULL, "rewind_interval", 10);
+	blockdev_mmap = config_get_int(CFG_GLOBAL, NULL, "hd_mmap", 0);
 	unique_id = config_get_int(CFG_MACHINE, NULL, "unique_id", 0);
 	memsize = config_get_int(CFG_MACHINE, NULL, "mem_size", 4096);
 	p = (char *)config_get_string(CFG_MACHINE, NULL, "rom_set", "riscos311");
@@ -843,6 +851,8 @@ void saveconfig()
 	config_set_int(CFG_GLOBAL, NULL, "sound_enable", soundena);
 	config_set_int(CFG_MACHINE, NULL, "mem_size", memsize);
 	config_set_int(CFG_MACHINE, NULL, "cpu_type", arm_cpu_type);
+	config_set_int(CFG_MACHINE, NULL, "cpu_core", arm_cpu_core);
+	config_set_int(CFG_MACHINE, NULL, "cpu_timing", arm_cpu_timing);
 	config_set_int(CFG_MACHINE, NULL, "memc_type", memc_type);
 	config_set_int(CFG_MACHINE, NULL, "fpa", fpaena);
 	config_set_int(CFG_MACHINE, NULL, "fpu_type", fpu_type);
@@ -852,6 +862,7 @@ void saveconfig()
 	config_set_int(CFG_MACHINE, NULL, "video_scale", video_scale);
 	config_set_int(CFG_MACHINE, NULL, "video_fullscreen_scale", video_fullscreen_scale);
 	config_set_int(CFG_MACHINE, NULL, "video_linear_filtering", video_linear_filtering);
+	config_set_int(CFG_MACHINE, NULL, "video_frame_render", video_frame_render);
 	config_set_int(CFG_MACHINE, NULL, "video_black_level", video_black_level);
 	config_set_int(CFG_MACHINE, NULL, "fdc_type", (fdctype == FDC_82C711) ? 1 : 0);
 	config_set_int(CFG_MACHINE, NULL, "st506_present", st506_present);
@@ -894,6 +905,9 @@ void saveconfig()
 	config_set_int(CFG_GLOBAL, NULL, "sound_gain", sound_gain);
 	config_set_int(CFG_GLOBAL, NULL, "sound_filter", sound_filter);
 	config_set_int(CFG_GLOBAL, NULL, "disc_noise_gain", disc_noise_gain);
+	config_set_int(CFG_GLOBAL, NULL, "rewind_memory", rewind_memory_mb);
+	config_set_int(CFG_GLOBAL, NULL, "rewind_interval", rewind_interval);
+	config_set_int(CFG_GLOBAL, NULL, "hd_mmap", blockdev_mmap);
 	config_set_int(CFG_MACHINE, NULL, "unique_id", unique_id);
 	config_set_string(CFG_MACHINE, NULL, "hd4_fn", hd_fn[0]);
 	config_set_int(CFG_MACHINE, NULL, "hd4_sectors", hd_spt[0]);
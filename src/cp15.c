@@ -4,6 +4,7 @@
 #include "arm.h"
 #include "cp15.h"
 #include "mem.h"
+#include "snapshot.h"
 #include "vidc.h"
 
 arm3cp_t arm3cp;
@@ -15,6 +16,12 @@ void resetcp15()
 	cp15_cacheon = 0;
 }
 
+void cp15_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, arm3cp);
+	SNAPSHOT_VAR(s, cp15_cacheon);
+}
+
 uint32_t readcp15(int reg)
 {
 	switch (reg)
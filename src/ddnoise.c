@@ -8,6 +8,7 @@
 #include "disc.h"
 #include "ddnoise.h"
 #include "plat_sound.h"
+#include "snapshot.h"
 #include "timer.h"
 
 int ddnoise_vol=3;
@@ -240,6 +241,17 @@ void ddnoise_init()
 	motorsmp[2] = load_wav(path, "motoroff.wav");
 }	
 
+void ddnoise_snapshot(snapshot_t *s)
+{
+	timer_snapshot(s, &ddnoise_timer);
+	SNAPSHOT_VAR(s, oldmotoron);
+	SNAPSHOT_VAR(s, ddnoise_mstat);
+	SNAPSHOT_VAR(s, ddnoise_mpos);
+	SNAPSHOT_VAR(s, ddnoise_sstat);
+	SNAPSHOT_VAR(s, ddnoise_spos);
+	SNAPSHOT_VAR(s, ddnoise_sdir);
+}
+
 void ddnoise_close()
 {
 	int c;
@@ -351,7 +363,7 @@ void ddnoise_mix(void *p)
 		}
 	}
 
-	if (soundena)
+	if (soundena && !turbo_mode)
 		sound_givebufferdd(ddbuffer);
 
 	oldmotoron=motoron;
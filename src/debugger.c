@@ -6,6 +6,7 @@
 #include "ioc.h"
 #include "mem.h"
 #include "memc.h"
+#include "profiler.h"
 #include "vidc.h"
 
 void debug_start(void)
@@ -632,6 +633,34 @@ void debugger_do()
 				debug_out("\n");
 			}
 			break;
+			case 'p': case 'P':
+			if (!strncasecmp(command, "profile", 7))
+			{
+				if (!params)
+					profiler_print(debug_out, 20);
+				else if (!strncasecmp(param1, "start", 5))
+				{
+					if (profiler_start())
+						debug_out("    Could not start profiler\n");
+					else
+						debug_out("    Profiler started\n");
+				}
+				else if (!strncasecmp(param1, "stop", 4))
+				{
+					profiler_stop();
+					debug_out("    Profiler stopped\n");
+				}
+				else if (!strncasecmp(param1, "clear", 5))
+					profiler_clear();
+				else if (!strncasecmp(param1, "save", 4) && params == 2)
+				{
+					if (profiler_save(param2))
+						debug_out("    Could not save profile\n");
+				}
+				else
+					debug_out("Syntax: profile [start|stop|clear|save <fn>]\n");
+			}
+			break;
 			case 'r': case 'R':
 			if (params)
 			{
@@ -920,6 +949,10 @@ void debugger_do()
 			debug_out("    d [addr]                - disassemble from address addr\n");
 			debug_out("    m [addr]                - memory dump from address addr, in words\n");
 			debug_out("    mb [addr]               - memory dump from address addr, in bytes\n");
+			debug_out("    profile                 - print busiest instruction classes and code pages\n");
+			debug_out("    profile start/stop      - start or stop execution profiling\n");
+			debug_out("    profile clear           - clear profile counts\n");
+			debug_out("    profile save <fn>       - save all profile counts to a text file\n");
 			debug_out("    r                       - print ARM registers\n");
 			debug_out("    r ioc                   - print IOC registers\n");
 			debug_out("    r memc                  - print MEMC registers\n");
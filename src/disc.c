@@ -17,6 +17,7 @@
 #include "ddnoise.h"
 
 #include "ioc.h"
+#include "snapshot.h"
 #include "timer.h"
 
 char discname[4][512];
@@ -239,6 +240,52 @@ void disc_reset()
 	timer_add(&disc_timer, disc_poll, NULL, 0);
 }
 
+void disc_snapshot(snapshot_t *s)
+{
+	char names[4][512];
+	int c;
+
+	/*Only the image names are stored. Reload any image that differs from
+	  the one currently inserted, before restoring drive state*/
+	memcpy(names, discname, sizeof(names));
+	SNAPSHOT_ARRAY(s, names);
+	if (s->loading)
+	{
+		for (c = 0; c < 4; c++)
+		{
+			names[c][511] = 0;
+			if (strcmp(names[c], discname[c]))
+			{
+				disc_close(c);
+				strcpy(discname[c], names[c]);
+				if (discname[c][0])
+					disc_load(c, discname[c]);
+			}
+		}
+	}
+
+	SNAPSHOT_VAR(s, curdrive);
+	SNAPSHOT_VAR(s, disc_drivesel);
+	SNAPSHOT_ARRAY(s, discchange);
+	SNAPSHOT_ARRAY(s, readflash);
+	SNAPSHOT_ARRAY(s, writeprot);
+	SNAPSHOT_VAR(s, motoron);
+	SNAPSHOT_VAR(s, fdc_ready);
+	SNAPSHOT_ARRAY(s, disc_current_track);
+	SNAPSHOT_VAR(s, disc_poll_time);
+	SNAPSHOT_VAR(s, disc_notfound);
+	timer_snapshot(s, &disc_timer);
+
+	if (s->loading)
+	{
+		for (c = 0; c < 4; c++)
+		{
+			if (drive_funcs[c] && drive_funcs[c]->seek)
+				drive_funcs[c]->seek(c, disc_current_track[c]);
+		}
+	}
+}
+
 void disc_poll(void *p)
 {
 	if (drive_funcs[disc_drivesel] && drive_funcs[disc_drivesel]->high_res_poll)
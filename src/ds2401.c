@@ -4,6 +4,7 @@
 #include "arc.h"
 #include "config.h"
 #include "ds2401.h"
+#include "snapshot.h"
 #include "timer.h"
 
 #define RESET_PULSE_LENGTH 480 /*Reset pulse line low for >= 480 us = reset*/
@@ -86,6 +87,12 @@ void ds2401_init(void)
 
 }
 
+void ds2401_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_STRUCT_TO(s, ds2401, timer);
+	timer_snapshot(s, &ds2401.timer);
+}
+
 void ds2401_write(int val)
 {
 	if (!val && ds2401.old_val)
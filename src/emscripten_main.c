@@ -18,6 +18,8 @@
 #include "plat_input.h"
 #include "plat_video.h"
 #include "podules.h"
+#include "rewind.h"
+#include "snapshot.h"
 #include "vidc.h"
 #include "video.h"
 #include "video_sdl2.h"
@@ -32,9 +34,16 @@ static int win_dosetresize = 0;
 static int win_renderer_reset = 0;
 
 #define MAX_TICKS_PER_FRAME 500
+/*In turbo mode, emulate in slices of this many ms until the host frame budget
+  is used up*/
+#define TURBO_SLICE_MS 10
+#define TURBO_FRAME_BUDGET_MS 15
 
 static int fixed_fps = 0;
 
+/*Renderer frame pacing counters for the last second*/
+static video_stats_t video_stats;
+
 void updatewindowsize(int x, int y)
 {
         winsizex = x; winsizey = y;
@@ -110,6 +119,23 @@ void arcloop()
 
                 if (!video_renderer_reinit(NULL))
                         fatal("Video renderer init failed");
+                /*New renderer has no screen contents yet*/
+                setredrawall();
+        }
+
+        struct timeval tp;
+        if (gettimeofday(&tp, NULL) == 0 && last_seconds != tp.tv_sec)
+        {
+                if (last_seconds)
+                {
+                        updateins();
+                        video_renderer_get_stats(&video_stats, 1);
+                        LOG_VIDEO_FRAMES("video: %u frames, %u late, max interval %uus, %u uploads, %llu bytes, upload %lluus, present %lluus\n",
+                                video_stats.frames, video_stats.late_frames, video_stats.present_interval_max_us,
+                                video_stats.uploads, (unsigned long long)video_stats.upload_bytes,
+                                (unsigned long long)video_stats.upload_us, (unsigned long long)video_stats.present_us);
+                }
+                last_seconds = tp.tv_sec;
         }
 
         static Uint32 last_timer_ticks = 0;
@@ -118,24 +144,30 @@ void arcloop()
         last_timer_ticks = current_timer_ticks;
 
         int run_ms = 0;
-        if (fast_forward_to_time_ms != 0 && total_emulation_millis < fast_forward_to_time_ms) {
-                run_ms = MAX_TICKS_PER_FRAME;
-                soundena = 0;
-                //rpclog("fast forward to %d %d\n", fast_forward_to_time_ms, total_emulation_millis);
-        } else {
-                if (fast_forward_to_time_ms != 0) {
-                        rpclog("finished fast forward - re-enabling sound and video\n");
-                        fast_forward_to_time_ms = 0;
-                        soundena = 1;
-                        skip_video_render = 0;
-                }
-                run_ms = ticks_since_last < MAX_TICKS_PER_FRAME ? ticks_since_last : MAX_TICKS_PER_FRAME;
+        if (fast_forward_to_time_ms != 0 && total_emulation_millis >= fast_forward_to_time_ms) {
+                rpclog("finished fast forward - re-enabling sound and video\n");
+                fast_forward_to_time_ms = 0;
+                turbo_mode = 0;
         }
+        run_ms = ticks_since_last < MAX_TICKS_PER_FRAME ? ticks_since_last : MAX_TICKS_PER_FRAME;
 
         SDL_LockMutex(main_thread_mutex);
 
         if (!pause_main_thread)
-                arc_run(run_ms);
+        {
+                if (turbo_mode)
+                {
+                        /*Run as much as the host allows this frame, stopping
+                          at the fast forward target if there is one*/
+                        do
+                        {
+                                arc_run(TURBO_SLICE_MS);
+                        } while (turbo_mode && (SDL_GetTicks() - current_timer_ticks) < TURBO_FRAME_BUDGET_MS &&
+                                 (!fast_forward_to_time_ms || total_emulation_millis < fast_forward_to_time_ms));
+                }
+                else
+                        arc_run(run_ms);
+        }
 
         SDL_UnlockMutex(main_thread_mutex);
         process_event();
@@ -184,6 +216,37 @@ long long EMSCRIPTEN_KEEPALIVE arc_get_emulation_ms()
         return total_emulation_millis;
 }
 
+int EMSCRIPTEN_KEEPALIVE arc_get_timer_callbacks_per_sec()
+{
+        return timer_callbacks_sec;
+}
+
+int EMSCRIPTEN_KEEPALIVE arc_get_video_frames_per_sec()
+{
+        return video_stats.frames;
+}
+
+int EMSCRIPTEN_KEEPALIVE arc_get_video_late_frames_per_sec()
+{
+        return video_stats.late_frames;
+}
+
+int EMSCRIPTEN_KEEPALIVE arc_get_video_max_frame_interval_us()
+{
+        return video_stats.present_interval_max_us;
+}
+
+/*Host time spent uploading and presenting frames, in microseconds per second*/
+int EMSCRIPTEN_KEEPALIVE arc_get_video_upload_us_per_sec()
+{
+        return video_stats.upload_us;
+}
+
+int EMSCRIPTEN_KEEPALIVE arc_get_video_present_us_per_sec()
+{
+        return video_stats.present_us;
+}
+
 void EMSCRIPTEN_KEEPALIVE arc_resume_main_thread()
 {
         SDL_LockMutex(main_thread_mutex);
@@ -211,6 +274,28 @@ void EMSCRIPTEN_KEEPALIVE arc_load_config_and_reset(char *config_name)
         SDL_UnlockMutex(main_thread_mutex);
 }
 
+int EMSCRIPTEN_KEEPALIVE arc_save_snapshot(char *fn)
+{
+        int ret;
+
+        SDL_LockMutex(main_thread_mutex);
+        ret = snapshot_save_file(fn);
+        SDL_UnlockMutex(main_thread_mutex);
+
+        return ret;
+}
+
+int EMSCRIPTEN_KEEPALIVE arc_load_snapshot(char *fn)
+{
+        int ret;
+
+        SDL_LockMutex(main_thread_mutex);
+        ret = snapshot_load_file(fn);
+        SDL_UnlockMutex(main_thread_mutex);
+
+        return ret;
+}
+
 void EMSCRIPTEN_KEEPALIVE arc_disc_change(int drive, char *fn)
 {
         rpclog("arc_disc_change: drive=%i fn=%s\n", drive, fn);
@@ -240,12 +325,30 @@ void EMSCRIPTEN_KEEPALIVE arc_disc_eject(int drive)
 
 void EMSCRIPTEN_KEEPALIVE arc_fast_forward(int time_ms)
 {
-        soundena = 0;
-        skip_video_render = 1;
+        turbo_mode = 1;
         fast_forward_to_time_ms = time_ms;
         rpclog("arc_fast_forward: %d\n", time_ms);
 }
 
+void EMSCRIPTEN_KEEPALIVE arc_set_turbo(int enable)
+{
+        turbo_mode = enable;
+        if (!enable)
+                fast_forward_to_time_ms = 0;
+        rpclog("arc_set_turbo: %d\n", enable);
+}
+
+int EMSCRIPTEN_KEEPALIVE arc_rewind(int time_ms)
+{
+        int ret;
+
+        SDL_LockMutex(main_thread_mutex);
+        ret = rewind_by(time_ms);
+        SDL_UnlockMutex(main_thread_mutex);
+
+        return ret;
+}
+
 void arc_stop_main_thread()
 {
         quited = 1;
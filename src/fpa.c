@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include "arc.h"
 #include "arm.h"
+#include "snapshot.h"
 
 //#define UNDEFINED  11
 //#define undefined() exception(UNDEFINED,8,4)
@@ -39,6 +40,13 @@ void resetfpa()
 	rpclog("fpsr=%08x fpu_type=%i\n", fpsr, fpu_type);
 }
 
+void fpa_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_ARRAY(s, fparegs);
+	SNAPSHOT_VAR(s, fpsr);
+	SNAPSHOT_VAR(s, fpcr);
+}
+
 #define FD ((opcode>>12)&7)
 #define FN ((opcode>>16)&7)
 #define RD ((opcode>>12)&0xF)
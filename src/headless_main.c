@@ -0,0 +1,225 @@
+/*Arculator 2.2 by Sarah Walker
+  Headless benchmark front end
+
+  Boots the configured machine with no window, input or sound device, runs it
+  for a fixed amount of emulated time as fast as the host allows, then reports
+  emulation speed. Emulated counts (instructions, VIDC lines, timer callbacks)
+  are deterministic for a given config, ROM set and disc image; only the host
+  time varies between runs.
+
+  A snapshot can be loaded before the run (-l) and saved after it (-w), so that
+  a benchmark can start from an already booted machine.
+
+  -t runs in turbo mode, with no pixel conversion or audio generation. -P runs
+  with the execution profiler enabled and saves its counts to the given file.
+  -T selects the CPU timing tier (0 = cycle-exact, 1 = fast), to compare the
+  cost of the full memory timing model.
+
+  Usage : arculator-headless [-c config] [-s seconds] [-p cpu] [-T timing] [-t] [-l snapshot] [-w snapshot] [-P profile]*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "arc.h"
+#include "arm.h"
+#include "config.h"
+#include "ide.h"
+#include "joystick.h"
+#include "plat_input.h"
+#include "plat_joystick.h"
+#include "plat_sound.h"
+#include "plat_video.h"
+#include "podules.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "st506.h"
+#include "timer.h"
+#include "vidc.h"
+#include "video.h"
+
+/*Null platform layer*/
+int key[512];
+
+int joysticks_present;
+joystick_t joystick_state[MAX_JOYSTICKS];
+plat_joystick_t plat_joystick_state[MAX_PLAT_JOYSTICKS];
+
+int selected_video_renderer;
+int skip_video_render = 0;
+int take_screenshot = 0;
+int record_video = 0;
+
+void joystick_init() {}
+void joystick_close() {}
+void joystick_poll_host() {}
+
+void input_init() {}
+void input_close() {}
+void mouse_poll_host() {}
+void mouse_get_rel(int *x, int *y) { *x = *y = 0; }
+void mouse_get_abs(int *x, int *y, int *b) { *x = *y = *b = 0; }
+int mouse_get_buttons() { return 0; }
+int mouse_capture_enable() { return -1; }
+void mouse_capture_disable() {}
+void keyboard_poll_host() {}
+
+void sound_dev_init(void) {}
+void sound_dev_close(void) {}
+void sound_givebuffer(int16_t *buf) {}
+void sound_givebufferdd(int16_t *buf) {}
+
+int video_renderer_init(void *main_window) { return 1; }
+int video_renderer_reinit(void *main_window) { return 1; }
+void video_renderer_close() {}
+int video_renderer_get_id(char *name) { return 0; }
+char *video_renderer_get_name(int id) { return "None"; }
+void video_renderer_update(BITMAP *src, int x1, int y1, int x2, int y2, int dest_x, int dest_y) {}
+void video_renderer_present(int src_x, int src_y, int src_w, int src_h, int dblscan) {}
+void video_renderer_update_indexed(BITMAP *src, int src_x, int src_y, int dest_x, int dest_y, int w, int h,
+				   const uint32_t *palette, int nr_rows, const uint16_t *line_rows) {}
+void video_renderer_get_stats(video_stats_t *stats, int reset) { memset(stats, 0, sizeof(video_stats_t)); }
+
+video_window_info_t video_window_info()
+{
+	video_window_info_t info;
+
+	memset(&info, 0, sizeof(info));
+	return info;
+}
+
+void updatewindowsize(int x, int y) {}
+void arc_set_resizeable() {}
+
+void arc_print_error(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+static double host_time(void)
+{
+	struct timeval tp;
+
+	gettimeofday(&tp, NULL);
+	return tp.tv_sec + tp.tv_usec / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t total_ins = 0, total_lines = 0, total_callbacks = 0;
+	int seconds = 10;
+	int cpu = -1, timing = -1;
+	char *load_fn = NULL, *save_fn = NULL, *profile_fn = NULL;
+	int start_framecount;
+	double start_time, elapsed;
+	int c, sec;
+
+	for (c = 1; c < argc; c++)
+	{
+		if (!strcmp(argv[c], "-c") && c + 1 < argc)
+		{
+			c++;
+			snprintf(machine_config_file, 256, "configs/%s.cfg", argv[c]);
+			strncpy(machine_config_name, argv[c], 255);
+		}
+		else if (!strcmp(argv[c], "-s") && c + 1 < argc)
+			seconds = atoi(argv[++c]);
+		else if (!strcmp(argv[c], "-p") && c + 1 < argc)
+			cpu = atoi(argv[++c]);
+		else if (!strcmp(argv[c], "-T") && c + 1 < argc)
+			timing = atoi(argv[++c]);
+		else if (!strcmp(argv[c], "-t"))
+			turbo_mode = 1;
+		else if (!strcmp(argv[c], "-l") && c + 1 < argc)
+			load_fn = argv[++c];
+		else if (!strcmp(argv[c], "-w") && c + 1 < argc)
+			save_fn = argv[++c];
+		else if (!strcmp(argv[c], "-P") && c + 1 < argc)
+			profile_fn = argv[++c];
+		else
+		{
+			fprintf(stderr, "Usage : %s [-c config] [-s seconds] [-p cpu] [-T timing] [-t] [-l snapshot] [-w snapshot] [-P profile]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (seconds < 1)
+		seconds = 1;
+
+	opendlls();
+	if (arc_init())
+	{
+		fprintf(stderr, "Failed to initialise emulator - are the ROMs present?\n");
+		return 1;
+	}
+	if (cpu >= 0 || timing >= 0)
+	{
+		if (cpu >= 0)
+			arm_cpu_type = cpu;
+		if (timing >= 0)
+			arm_cpu_timing = timing;
+		arc_reset();
+	}
+	if (load_fn && snapshot_load_file(load_fn))
+	{
+		fprintf(stderr, "Failed to load snapshot %s\n", load_fn);
+		return 1;
+	}
+
+	/*Discard anything counted during startup*/
+	inscount = 0;
+	vidc_linecount = 0;
+	timer_callbacks_sample();
+	start_framecount = vidc_framecount;
+	if (profile_fn && profiler_start())
+	{
+		fprintf(stderr, "Failed to start profiler\n");
+		return 1;
+	}
+
+	start_time = host_time();
+	for (sec = 0; sec < seconds; sec++)
+	{
+		/*Sample every emulated second so the 32-bit counters can't wrap*/
+		for (c = 0; c < 100; c++)
+			arc_run(10);
+
+		total_ins += (uint32_t)inscount;
+		inscount = 0;
+		total_lines += vidc_linecount;
+		vidc_linecount = 0;
+		total_callbacks += timer_callbacks_sample();
+	}
+	elapsed = host_time() - start_time;
+	if (elapsed <= 0.0)
+		elapsed = 0.000001;
+
+	if (save_fn && snapshot_save_file(save_fn))
+		fprintf(stderr, "Failed to save snapshot %s\n", save_fn);
+	if (profile_fn && profiler_save(profile_fn))
+		fprintf(stderr, "Failed to save profile %s\n", profile_fn);
+
+	printf("Config            : %s\n", machine_config_name[0] ? machine_config_name : "(default)");
+	printf("CPU type          : %i%s\n", arm_cpu_type, turbo_mode ? " (turbo)" : "");
+	printf("CPU timing        : %s\n", arm_timing_fast ? "fast" : "cycle-exact");
+	printf("Emulated time     : %i s\n", seconds);
+	printf("Host time         : %.3f s (%.2fx realtime)\n", elapsed, seconds / elapsed);
+	printf("Instructions      : %llu (%.2f emulated MIPS, %.2f host MIPS)\n",
+		(unsigned long long)total_ins, total_ins / (seconds * 1000000.0), total_ins / (elapsed * 1000000.0));
+	printf("VIDC lines        : %llu (%.0f per host second)\n",
+		(unsigned long long)total_lines, total_lines / elapsed);
+	printf("VIDC frames       : %i\n", vidc_framecount - start_framecount);
+	printf("Timer callbacks   : %llu (%.0f per host second)\n",
+		(unsigned long long)total_callbacks, total_callbacks / elapsed);
+
+	/*Write back anything still held in the hard disc caches*/
+	podules_close();
+	st506_internal_close();
+	closeide(&ide_internal);
+
+	return 0;
+}
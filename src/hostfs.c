@@ -44,6 +44,13 @@
 #include "hostfs_emscripten.h"
 #endif
 
+/* On native Linux builds the directory cache is told about changes made
+   behind our back by inotify; elsewhere it compares directory mtimes */
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define HOSTFS_INOTIFY
+#include <sys/inotify.h>
+#endif
+
 #define HOSTFS_PROTOCOL_VERSION	3
 
 /* Windows mkdir() function only takes one argument name, and
@@ -93,6 +100,13 @@ enum FILECORE_ERROR {
   FILECORE_ERROR_NOTFOUND	= 0xd6,
 };
 
+/** When hostfs_cache_dir_lookup() should re-read a cached directory */
+enum CACHE_REFRESH {
+  CACHE_REFRESH_IF_CHANGED, /* If it may have changed since it was read */
+  CACHE_REFRESH_LISTING,    /* Also if not watched, at the start of a listing */
+  CACHE_REFRESH_NEVER,      /* Only if not cached, part-way through a listing */
+};
+
 enum RISC_OS_FILE_TYPE {
   RISC_OS_FILE_TYPE_OBEY = 0xfeb,
   RISC_OS_FILE_TYPE_DATA = 0xffd,
@@ -101,13 +115,32 @@ enum RISC_OS_FILE_TYPE {
 
 /**
  * Type used to cache information about a directory entry.
- * Contains name and RISC OS object info
+ * Contains RISC OS and Host names and RISC OS object info
  */
 typedef struct {
-  unsigned name_offset; /**< Offset within cache_names[] */
+  unsigned name_offset;      /**< Offset of RISC OS leaf within names[] */
+  unsigned host_name_offset; /**< Offset of Host leaf within names[] */
   risc_os_object_info object_info;
 } cache_directory_entry;
 
+/**
+ * Type used to cache a scanned Host directory. Entries are sorted in
+ * case-insensitive order of RISC OS name.
+ */
+typedef struct {
+  char *path;                      /**< Full Host path, NULL if slot unused */
+  bool valid;                      /**< Cleared when contents may have changed */
+  cache_directory_entry *entries;
+  unsigned count;                  /**< Number of valid entries in \a entries */
+  unsigned entries_capacity;
+  char *names;
+  unsigned names_capacity;
+  time_t mtime;                    /**< Directory mtime when it was scanned */
+  long mtime_nsec;
+  int watch;                       /**< inotify watch descriptor, or -1 */
+  unsigned last_used;              /**< For least-recently-used replacement */
+} cache_directory;
+
 /* TODO Avoid duplicate macro with extnrom.c */
 #define ROUND_UP_TO_4(x) (((x) + 3) & (~3))
 
@@ -116,6 +149,8 @@ typedef struct {
 
 #define MAX_OPEN_FILES 255
 
+#define CACHE_DIRECTORIES 16
+
 #define NOT_IMPLEMENTED 255
 
 #define DEFAULT_ATTRIBUTES  0x03
@@ -128,13 +163,17 @@ static const char *disc_name_default = "HostFS";
 static char HOSTFS_ROOT[512];
 
 static FILE *open_file[MAX_OPEN_FILES + 1]; /* array subscript 0 is never used */
+static char *open_file_path[MAX_OPEN_FILES + 1]; /* Host path of files open for update */
 
 static unsigned char *buffer = NULL;
 static size_t buffer_size = 0;
 
-static cache_directory_entry *cache_entries = NULL;
-static unsigned cache_entries_count = 0; /**< Number of valid entries in \a cache_entries */
-static char *cache_names = NULL;
+static cache_directory cache_dirs[CACHE_DIRECTORIES];
+static unsigned cache_dirs_clock = 0; /**< Incremented on each directory lookup */
+static const char *cache_sort_names = NULL; /**< names[] of directory being sorted */
+#ifdef HOSTFS_INOTIFY
+static int cache_inotify_fd = -1;
+#endif
 
 /** Current registration state of HostFS module with backend code */
 static HostFSState hostfs_state = HOSTFS_STATE_UNREGISTERED;
@@ -187,6 +226,102 @@ hostfs_ensure_buffer_size(size_t buffer_size_needed)
   }
 }
 
+/**
+ * Read from a host file into emulated memory. Pages that are directly
+ * accessible are read into in place; others are staged through the buffer
+ * and stored a byte at a time.
+ *
+ * @param state   Emulator state
+ * @param f       File to read from
+ * @param address Address in emulated memory
+ * @param length  Number of bytes to read
+ * @return Number of bytes read
+ */
+static size_t
+hostfs_read_to_memory(ARMul_State *state, FILE *f, ARMword address,
+		      size_t length)
+{
+  size_t total = 0;
+
+  hostfs_ensure_buffer_size(MINIMUM_BUFFER_SIZE);
+
+  while (length > 0) {
+    uint32_t span;
+    uint8_t *p = mem_direct_ptr(address, 1, &span);
+    size_t amount = MIN(length, span);
+    size_t bytes_read;
+
+    if (p) {
+      bytes_read = fread(p, 1, amount, f);
+      if (bytes_read > 0) {
+	mem_ram_write_check(p);
+      }
+    } else {
+      size_t i;
+
+      bytes_read = fread(buffer, 1, amount, f);
+      for (i = 0; i < bytes_read; i++) {
+	ARMul_StoreByte(state, address + i, buffer[i]);
+      }
+    }
+
+    total += bytes_read;
+    if (bytes_read < amount) {
+      break;
+    }
+    address += amount;
+    length -= amount;
+  }
+
+  return total;
+}
+
+/**
+ * Write from emulated memory to a host file. Pages that are directly
+ * accessible are written from in place; others are staged through the
+ * buffer a byte at a time.
+ *
+ * @param state   Emulator state
+ * @param f       File to write to
+ * @param address Address in emulated memory
+ * @param length  Number of bytes to write
+ * @return Number of bytes written
+ */
+static size_t
+hostfs_write_from_memory(ARMul_State *state, FILE *f, ARMword address,
+			 size_t length)
+{
+  size_t total = 0;
+
+  hostfs_ensure_buffer_size(MINIMUM_BUFFER_SIZE);
+
+  while (length > 0) {
+    uint32_t span;
+    const uint8_t *p = mem_direct_ptr(address, 0, &span);
+    size_t amount = MIN(length, span);
+    size_t bytes_written;
+
+    if (!p) {
+      size_t i;
+
+      for (i = 0; i < amount; i++) {
+	buffer[i] = ARMul_LoadByte(state, address + i);
+      }
+      p = buffer;
+    }
+
+    bytes_written = fwrite(p, 1, amount, f);
+    total += bytes_written;
+    if (bytes_written < amount) {
+      break;
+    }
+    address += amount;
+    length -= amount;
+  }
+
+  return total;
+}
+
 /**
  * @param state   Emulator state
  * @param address Address in emulated memory
@@ -506,40 +641,151 @@ hostfs_read_object_info(const char *host_pathname,
 }
 
 /**
- * @param host_dir_path Full Host path to directory to scan
- * @param object        Object name to search for
- * @param host_name     Return Host name of object (filled-in if object found)
- * @param object_info   Return object info (filled-in)
+ * Compare two elements of type \a cache_directory_entry by comparing their
+ * names in a case-insensitive manner.
+ *
+ * @param e1 Pointer to first \a cache_directory_entry
+ * @param e2 Pointer to second \a cache_directory_entry
+ * @return Returns an integer less than, equal to, or greater than zero if
+ *         e1's name is found, respectively, to be earlier than, to match, or
+ *         be later than e2's name.
  */
-static void
-hostfs_path_scan(const char *host_dir_path,
-		 const char *object,
-		 char *host_name,
-		 risc_os_object_info *object_info)
+static int
+hostfs_directory_entry_compare(const void *e1, const void *e2)
+{
+  const cache_directory_entry *entry1 = e1;
+  const cache_directory_entry *entry2 = e2;
+  const char *name1 = cache_sort_names + entry1->name_offset;
+  const char *name2 = cache_sort_names + entry2->name_offset;
+
+  return strcasecmp(name1, name2);
+}
+
+/**
+ * Read the modification time of a Host directory.
+ *
+ * @param directory_name Full path to Host directory
+ * @param mtime          Return modification time in seconds
+ * @param mtime_nsec     Return sub-second part of modification time, if the
+ *                       Host provides it
+ * @return Non-zero if the directory could not be examined
+ */
+static int
+hostfs_dir_mtime(const char *directory_name, time_t *mtime, long *mtime_nsec)
+{
+  struct stat info;
+
+  if (stat(directory_name, &info) != 0) {
+    return -1;
+  }
+
+  *mtime = info.st_mtime;
+#if defined(__linux__) || defined(__EMSCRIPTEN__)
+  *mtime_nsec = info.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+  *mtime_nsec = info.st_mtimespec.tv_nsec;
+#else
+  *mtime_nsec = 0;
+#endif
+  return 0;
+}
+
+/**
+ * Store a name in a cached directory's names[], growing it if required.
+ *
+ * @param dir      Cached directory
+ * @param name_ptr Offset within names[] of next free byte, advanced past the
+ *                 stored name
+ * @param name     Name to store
+ * @return Offset within names[] of the stored name
+ */
+static unsigned
+hostfs_cache_dir_add_name(cache_directory *dir, unsigned *name_ptr,
+			  const char *name)
+{
+  /* Calculate space required to store name (+ terminator) */
+  unsigned string_space = strlen(name) + 1;
+  unsigned offset = *name_ptr;
+
+  /* Check whether names[] is large enough; increase if required */
+  while (string_space > (dir->names_capacity - offset)) {
+    dir->names_capacity *= 2;
+    dir->names = realloc(dir->names, dir->names_capacity);
+    if (!dir->names) {
+      fprintf(stderr, "hostfs_cache_dir(): Out of memory\n");
+      exit(1);
+    }
+  }
+
+  strcpy(dir->names + offset, name);
+  *name_ptr += string_space;
+  return offset;
+}
+
+/**
+ * Reads the entries in the directory \a directory_name. Stores them in
+ * \a dir, sorted in case-insensitive order of name.
+ *
+ * @param dir            Cache slot to fill in
+ * @param directory_name Full path to host directory to be read and cached
+ * @return Non-zero if the directory could not be read
+ */
+static int
+hostfs_cache_dir(cache_directory *dir, const char *directory_name)
 {
+  unsigned entry_ptr = 0;
+  unsigned name_ptr = 0;
   DIR *d;
-  struct dirent *entry;
-  size_t c;
+  const struct dirent *entry;
 
-  assert(host_dir_path && object);
-  assert(host_name);
-  assert(object_info);
+  assert(dir);
+  assert(directory_name);
+
+  /* Allocate memory initially */
+  if (!dir->entries) {
+    dir->entries_capacity = 128;
+    dir->entries = malloc(dir->entries_capacity * sizeof(cache_directory_entry));
+  }
+  if (!dir->names) {
+    dir->names_capacity = 2048;
+    dir->names = malloc(dir->names_capacity);
+  }
+  if ((!dir->entries) || (!dir->names)) {
+    fprintf(stderr, "hostfs_cache_dir(): Out of memory\n");
+    exit(1);
+  }
+
+  /* Note the directory's state before reading it, so that a change made
+     while it is being read is seen by the next lookup */
+#ifdef HOSTFS_INOTIFY
+  if (dir->watch == -1 && cache_inotify_fd >= 0) {
+    dir->watch = inotify_add_watch(cache_inotify_fd, directory_name,
+				   IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+				   IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |
+				   IN_CLOSE_WRITE | IN_DELETE_SELF |
+				   IN_MOVE_SELF | IN_ONLYDIR);
+  }
+#endif
+  if (hostfs_dir_mtime(directory_name, &dir->mtime, &dir->mtime_nsec)) {
+    return -1;
+  }
 
-  d = opendir(host_dir_path);
+  /* Read each of the directory entries one at a time.
+   * Fill in the entries[] and names[] arrays,
+   *    resizing these dynamically if required.
+   */
+  d = opendir(directory_name);
   if (!d) {
     switch (errno) {
     case ENOENT: /* Object not found */
     case ENOTDIR: /* Object not a directory */
-      object_info->type = OBJECT_TYPE_NOT_FOUND;
       break;
 
     default:
-      fprintf(stderr, "hostfs_path_scan() could not opendir() \'%s\': %s %d\n",
-	      host_dir_path, strerror(errno), errno);
-      object_info->type = OBJECT_TYPE_NOT_FOUND;
+      fprintf(stderr, "hostfs_cache_dir() could not opendir() \'%s\': %s %d\n",
+	      directory_name, strerror(errno), errno);
     }
-
-    return;
+    return -1;
   }
 
   while ((entry = readdir(d)) != NULL) {
@@ -550,38 +796,316 @@ hostfs_path_scan(const char *host_dir_path,
       continue;
     }
 
-    strcpy(entry_path, host_dir_path);
+    strcpy(entry_path, directory_name);
     strcat(entry_path, "/");
     strcat(entry_path, entry->d_name);
 
-    hostfs_read_object_info(entry_path, ro_leaf, object_info);
-
-	for (c=0;c<strlen(ro_leaf);c++)
-	{
-		if (ro_leaf[c]=='/')
-		   ro_leaf[c]='.';
-	}
+    hostfs_read_object_info(entry_path, ro_leaf,
+			    &dir->entries[entry_ptr].object_info);
 
     /* Ignore entries we can not read information about,
        or which are neither regular files or directories */
-    if (object_info->type == OBJECT_TYPE_NOT_FOUND) {
+    if (dir->entries[entry_ptr].object_info.type == OBJECT_TYPE_NOT_FOUND) {
+      continue;
+    }
+
+    dir->entries[entry_ptr].name_offset =
+      hostfs_cache_dir_add_name(dir, &name_ptr, ro_leaf);
+    dir->entries[entry_ptr].host_name_offset =
+      hostfs_cache_dir_add_name(dir, &name_ptr, entry->d_name);
+
+    /* Advance entry_ptr, increasing space of entries[] if required */
+    entry_ptr++;
+    if (entry_ptr == dir->entries_capacity) {
+      dir->entries_capacity *= 2;
+      dir->entries = realloc(dir->entries, dir->entries_capacity * sizeof(cache_directory_entry));
+      if (!dir->entries) {
+	fprintf(stderr, "hostfs_cache_dir(): Out of memory\n");
+	exit(1);
+      }
+    }
+  }
+
+  closedir(d);
+
+  /* Sort the directory entries, case-insensitive */
+  cache_sort_names = dir->names;
+  qsort(dir->entries, entry_ptr, sizeof(cache_directory_entry),
+	hostfs_directory_entry_compare);
+
+  /* Store the number of directory entries found */
+  dir->count = entry_ptr;
+  dir->valid = true;
+  return 0;
+}
+
+/**
+ * Remove a directory from the cache, keeping its memory for reuse.
+ *
+ * @param dir Cache slot to release
+ */
+static void
+hostfs_cache_dir_release(cache_directory *dir)
+{
+#ifdef HOSTFS_INOTIFY
+  if (dir->watch != -1) {
+    unsigned i;
+
+    /* Two paths to the same directory share one watch */
+    for (i = 0; i < CACHE_DIRECTORIES; i++) {
+      if (&cache_dirs[i] != dir && cache_dirs[i].watch == dir->watch) {
+	break;
+      }
+    }
+    if (i == CACHE_DIRECTORIES) {
+      inotify_rm_watch(cache_inotify_fd, dir->watch);
+    }
+  }
+#endif
+  dir->watch = -1;
+  free(dir->path);
+  dir->path = NULL;
+  dir->valid = false;
+  dir->count = 0;
+}
+
+/**
+ * Mark cached directories stale for any changes reported by inotify since
+ * the last call.
+ */
+static void
+hostfs_cache_dir_poll(void)
+{
+#ifdef HOSTFS_INOTIFY
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  if (cache_inotify_fd < 0) {
+    return;
+  }
+
+  while ((len = read(cache_inotify_fd, events, sizeof(events))) > 0) {
+    const char *p = events;
+
+    while (p < events + len) {
+      const struct inotify_event *event = (const struct inotify_event *) p;
+      unsigned i;
+
+      for (i = 0; i < CACHE_DIRECTORIES; i++) {
+	/* A queue overflow loses events, so everything must be re-read */
+	if ((event->mask & IN_Q_OVERFLOW) ||
+	    (cache_dirs[i].path && cache_dirs[i].watch == event->wd)) {
+	  cache_dirs[i].valid = false;
+	  if (event->mask & IN_IGNORED) {
+	    /* The watch has gone with the directory */
+	    cache_dirs[i].watch = -1;
+	  }
+	}
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+#endif
+}
+
+/**
+ * Find a Host directory's entries, reading the directory only if it is not
+ * cached or has changed since it was read.
+ *
+ * A directory listing is made by a series of calls, each carrying on from
+ * an offset into the entries, so it must not be re-read once a listing has
+ * started or entries would be skipped or repeated. Without inotify, writing
+ * to a file in place does not change its directory's mtime, so the cached
+ * information is refreshed at the start of each listing instead.
+ *
+ * @param directory_name Full path to Host directory
+ * @param refresh        When to re-read a cached directory
+ * @return Cached directory, or NULL if the directory could not be read
+ */
+static const cache_directory *
+hostfs_cache_dir_lookup(const char *directory_name,
+			enum CACHE_REFRESH refresh)
+{
+  cache_directory *dir = NULL;
+  cache_directory *victim = &cache_dirs[0];
+  unsigned i;
+
+  assert(directory_name);
+
+  hostfs_cache_dir_poll();
+
+  for (i = 0; i < CACHE_DIRECTORIES; i++) {
+    if (cache_dirs[i].path && STREQ(cache_dirs[i].path, directory_name)) {
+      dir = &cache_dirs[i];
+      break;
+    }
+    /* Prefer an unused slot, then the least recently used */
+    if (victim->path &&
+	(!cache_dirs[i].path || cache_dirs[i].last_used < victim->last_used)) {
+      victim = &cache_dirs[i];
+    }
+  }
+
+  if (dir && refresh == CACHE_REFRESH_NEVER) {
+    /* Keep the entries the listing started with, even if now stale */
+    dir->last_used = ++cache_dirs_clock;
+    return dir;
+  }
+
+  if (dir && dir->valid && dir->watch == -1) {
+    /* Without inotify, a change of mtime shows the directory has changed */
+    time_t mtime;
+    long mtime_nsec;
+
+    if (refresh == CACHE_REFRESH_LISTING ||
+	hostfs_dir_mtime(directory_name, &mtime, &mtime_nsec) ||
+	mtime != dir->mtime || mtime_nsec != dir->mtime_nsec) {
+      dir->valid = false;
+    }
+  }
+
+  if (!dir) {
+    dir = victim;
+    hostfs_cache_dir_release(dir);
+    dir->path = strdup(directory_name);
+    if (!dir->path) {
+      fprintf(stderr, "hostfs_cache_dir_lookup(): Out of memory\n");
+      exit(1);
+    }
+  }
+
+  if (!dir->valid && hostfs_cache_dir(dir, directory_name)) {
+    hostfs_cache_dir_release(dir);
+    return NULL;
+  }
+
+  dir->last_used = ++cache_dirs_clock;
+  return dir;
+}
+
+/**
+ * Mark stale any cached directory whose contents are affected by a change
+ * to a Host object: the directory holding it, and the object itself and
+ * anything below it if it is a directory.
+ *
+ * @param host_pathname Full Host path to the object that has changed
+ */
+static void
+hostfs_cache_dir_invalidate(const char *host_pathname)
+{
+  const char *slash = strrchr(host_pathname, '/');
+  size_t parent_len = slash ? (size_t) (slash - host_pathname) : 0;
+  size_t len = strlen(host_pathname);
+  unsigned i;
+
+  for (i = 0; i < CACHE_DIRECTORIES; i++) {
+    const char *path = cache_dirs[i].path;
+
+    if (!path) {
       continue;
     }
+    if ((strlen(path) == parent_len &&
+	 strncmp(path, host_pathname, parent_len) == 0) ||
+	(strncmp(path, host_pathname, len) == 0 &&
+	 (path[len] == '\0' || path[len] == '/'))) {
+      cache_dirs[i].valid = false;
+    }
+  }
+}
+
+/**
+ * Mark every cached directory stale.
+ */
+static void
+hostfs_cache_dir_flush(void)
+{
+  unsigned i;
+
+  for (i = 0; i < CACHE_DIRECTORIES; i++) {
+    cache_dirs[i].valid = false;
+  }
+}
+
+/**
+ * Compare a RISC OS leaf name from the cache with an object name, in a
+ * case-insensitive manner. '/' in the leaf matches '.' in the object name.
+ *
+ * @param ro_leaf Cached RISC OS leaf name
+ * @param object  Object name to search for
+ * @return Non-zero if the names match
+ */
+static int
+hostfs_leaf_match(const char *ro_leaf, const char *object)
+{
+  for (;;) {
+    int c1 = (unsigned char) *ro_leaf++;
+    int c2 = (unsigned char) *object++;
+
+    if (c1 == '/') {
+      c1 = '.';
+    }
+    if (tolower(c1) != tolower(c2)) {
+      return 0;
+    }
+    if (c1 == '\0') {
+      return 1;
+    }
+  }
+}
+
+/**
+ * @param host_dir_path Full Host path to directory to scan
+ * @param object        Object name to search for
+ * @param host_name     Return Host name of object (filled-in if object found)
+ * @param object_info   Return object info (filled-in)
+ */
+static void
+hostfs_path_scan(const char *host_dir_path,
+		 const char *object,
+		 char *host_name,
+		 risc_os_object_info *object_info)
+{
+  const cache_directory *dir;
+  unsigned i;
+
+  assert(host_dir_path && object);
+  assert(host_name);
+  assert(object_info);
+
+  dir = hostfs_cache_dir_lookup(host_dir_path, CACHE_REFRESH_IF_CHANGED);
+  if (!dir) {
+    object_info->type = OBJECT_TYPE_NOT_FOUND;
+    return;
+  }
+
+  for (i = 0; i < dir->count; i++) {
+    const cache_directory_entry *entry = &dir->entries[i];
 
     /* Compare leaf and object names in case-insensitive manner */
-    if (!STRCASEEQ(ro_leaf, object)) {
+    if (!hostfs_leaf_match(dir->names + entry->name_offset, object)) {
       /* Names do not match */
       continue;
     }
 
-    /* A match has been found - exit the function early */
-    strcpy(host_name, entry->d_name);
-    closedir(d);
+    /* A match has been found */
+    strcpy(host_name, dir->names + entry->host_name_offset);
+
+    if (dir->watch != -1) {
+      /* inotify keeps the cached information up to date */
+      *object_info = entry->object_info;
+    } else {
+      /* A file can change without its directory's mtime changing */
+      char entry_path[PATH_MAX];
+
+      strcpy(entry_path, host_dir_path);
+      strcat(entry_path, "/");
+      strcat(entry_path, host_name);
+
+      hostfs_read_object_info(entry_path, NULL, object_info);
+    }
     return;
   }
 
-  closedir(d);
-
   object_info->type = OBJECT_TYPE_NOT_FOUND;
 }
 
@@ -801,6 +1325,10 @@ hostfs_open(ARMul_State *state)
     dbug_hostfs("\tOpen for update\n");
     open_file[idx] = fopen(host_pathname, "rb+");
     state->Reg[0] = (uint32_t) (FILE_INFO_WORD_READ_OK | FILE_INFO_WORD_WRITE_OK);
+    if (open_file[idx] != NULL) {
+      /* Remembered so that writes can invalidate the directory cache */
+      open_file_path[idx] = strdup(host_pathname);
+    }
     break;
   }
 
@@ -836,12 +1364,24 @@ hostfs_open(ARMul_State *state)
   state->Reg[4] = 0; /* Space allocated to file */
 }
 
+/**
+ * Invalidate the cached information about a file open for update, after it
+ * has been written to.
+ *
+ * @param idx Our file handle
+ */
+static void
+hostfs_open_file_changed(unsigned idx)
+{
+  if (open_file_path[idx]) {
+    hostfs_cache_dir_invalidate(open_file_path[idx]);
+  }
+}
+
 static void
 hostfs_getbytes(ARMul_State *state)
 {
   FILE *f = open_file[state->Reg[1]];
-  ARMword ptr = state->Reg[2];
-  ARMword i;
 
   assert(state);
 
@@ -852,23 +1392,15 @@ hostfs_getbytes(ARMul_State *state)
   dbug_hostfs("\tr4 = %u (file offset from which to get data)\n",
 	      state->Reg[4]);
 
-  hostfs_ensure_buffer_size(state->Reg[3]);
-
   fseek(f, (long) state->Reg[4], SEEK_SET);
 
-  ignore_result(fread(buffer, 1, state->Reg[3], f));
-
-  for (i = 0; i < state->Reg[3]; i++) {
-    ARMul_StoreByte(state, ptr++, buffer[i]);
-  }
+  hostfs_read_to_memory(state, f, state->Reg[2], state->Reg[3]);
 }
 
 static void
 hostfs_putbytes(ARMul_State *state)
 {
   FILE *f = open_file[state->Reg[1]];
-  ARMword ptr = state->Reg[2];
-  ARMword i;
 
   assert(state);
 
@@ -879,16 +1411,11 @@ hostfs_putbytes(ARMul_State *state)
   dbug_hostfs("\tr4 = %u (file offset at which to put data)\n",
 	      state->Reg[4]);
 
-  hostfs_ensure_buffer_size(state->Reg[3]);
-
   fseek(f, (long) state->Reg[4], SEEK_SET);
 
-  for (i = 0; i < state->Reg[3]; i++) {
-    buffer[i] = ARMul_LoadByte(state, ptr);
-    ptr++;
-  }
+  hostfs_write_from_memory(state, f, state->Reg[2], state->Reg[3]);
 
-  fwrite(buffer, 1, state->Reg[3], f);
+  hostfs_open_file_changed(state->Reg[1]);
 }
 
 static void
@@ -927,6 +1454,8 @@ hostfs_args_3_write_file_extent(ARMul_State *state)
 	    strerror(errno), errno);
     return;
   }
+
+  hostfs_open_file_changed(state->Reg[1]);
 }
 
 static void
@@ -968,6 +1497,8 @@ hostfs_args_8_write_zeros(ARMul_State *state)
   hostfs_ensure_buffer_size(BUFSIZE);
   memset(buffer, 0, BUFSIZE);
 
+  hostfs_open_file_changed(state->Reg[1]);
+
   length = state->Reg[3];
   while (length > 0) {
     size_t buffer_amount = MIN(length, BUFSIZE);
@@ -1037,6 +1568,9 @@ hostfs_close(ARMul_State *state)
 
   /* Free up the open_file[] entry */
   open_file[state->Reg[1]] = NULL;
+  hostfs_open_file_changed(state->Reg[1]);
+  free(open_file_path[state->Reg[1]]);
+  open_file_path[state->Reg[1]] = NULL;
 
   /* If load and exec addresses are both 0, then nothing to do */
   if (load == 0 && exec == 0) {
@@ -1102,6 +1636,7 @@ hostfs_write_file(ARMul_State *state, bool with_data)
     path_construct(host_pathname, ro_path,
 		   new_pathname, sizeof(new_pathname),
 		   state->Reg[2], state->Reg[3]);
+    hostfs_cache_dir_invalidate(host_pathname);
     if (rename(host_pathname, new_pathname)) {
       fprintf(stderr, "hostfs_file_7_create_file(): could not rename \'%s\'"
 	      " to \'%s\': %s %d\n", host_pathname, new_pathname,
@@ -1125,29 +1660,24 @@ hostfs_write_file(ARMul_State *state, bool with_data)
     return;
   }
 
-  /* Fill the data buffer with 0's if we are not saving supplied data */
-  if (!with_data) {
+  if (with_data) {
+    /* TODO check for errors */
+    hostfs_write_from_memory(state, f, ptr, length);
+  } else {
+    /* Fill the file with 0's, in blocks of up to BUFSIZE */
     memset(buffer, 0, BUFSIZE);
-  }
 
-  /* Save file in blocks of up to BUFSIZE */
-  while (length > 0) {
-    size_t buffer_amount = MIN(length, BUFSIZE);
-    size_t bytes_written;
+    while (length > 0) {
+      size_t buffer_amount = MIN(length, BUFSIZE);
+      size_t bytes_written;
 
-    if (with_data) {
-      unsigned i;
-
-      /* Copy the correct amount of data into the buffer */
-      for (i = 0; i < buffer_amount; i++) {
-	buffer[i] = ARMul_LoadByte(state, ptr);
-	ptr++;
+      /* TODO check for errors */
+      bytes_written = fwrite(buffer, 1, buffer_amount, f);
+      if (bytes_written == 0) {
+	break;
       }
+      length -= bytes_written;
     }
-
-    /* TODO check for errors */
-    bytes_written = fwrite(buffer, 1, buffer_amount, f);
-    length -= bytes_written;
   }
 
 
@@ -1156,6 +1686,8 @@ hostfs_write_file(ARMul_State *state, bool with_data)
   state->Reg[6] = 0; /* TODO */
 
   hostfs_object_set_timestamp(new_pathname, state->Reg[2], state->Reg[3]);
+
+  hostfs_cache_dir_invalidate(new_pathname);
 }
 
 static void
@@ -1212,6 +1744,8 @@ hostfs_file_1_write_cat_info(ARMul_State *state)
 
       /* Update timestamp if necessary */
       hostfs_object_set_timestamp(new_pathname, state->Reg[2], state->Reg[3]);
+
+      hostfs_cache_dir_invalidate(new_pathname);
     }
 
     /* TODO handle new attribs */
@@ -1286,6 +1820,8 @@ hostfs_file_6_delete(ARMul_State *state)
   state->Reg[4] = object_info.length;
   state->Reg[5] = object_info.attribs;
 
+  hostfs_cache_dir_invalidate(host_pathname);
+
   switch (object_info.type) {
   case OBJECT_TYPE_FILE:
     if (unlink(host_pathname)) {
@@ -1388,6 +1924,8 @@ hostfs_file_8_create_dir(ARMul_State *state)
 
   dbug_hostfs("\tHOST_PATHNAME = %s\n", host_pathname);
 
+  hostfs_cache_dir_invalidate(host_pathname);
+
   /* Create directory */
   if (mkdir(host_pathname, 0777)) {
     /* An error occurred whilst creating the directory */
@@ -1412,11 +1950,9 @@ hostfs_file_8_create_dir(ARMul_State *state)
 static void
 hostfs_file_255_load_file(ARMul_State *state)
 {
-  const unsigned BUFSIZE = MINIMUM_BUFFER_SIZE;
   char ro_path[PATH_MAX], host_pathname[PATH_MAX];
   risc_os_object_info object_info;
   FILE *f;
-  size_t bytes_read;
   ARMword ptr;
 
   assert(state);
@@ -1447,17 +1983,7 @@ hostfs_file_255_load_file(ARMul_State *state)
     return;
   }
 
-  hostfs_ensure_buffer_size(BUFSIZE);
-
-  do {
-    unsigned i;
-
-    bytes_read = fread(buffer, 1, BUFSIZE, f);
-
-    for (i = 0; i < bytes_read; i++) {
-      ARMul_StoreByte(state, ptr++, buffer[i]);
-    }
-  } while (bytes_read == BUFSIZE);
+  hostfs_read_to_memory(state, f, ptr, object_info.length);
 
   fclose(f);
 }
@@ -1581,6 +2107,9 @@ hostfs_func_8_rename(ARMul_State *state)
 
   dbug_hostfs("\tNEW_PATHNAME = %s\n", new_pathname);
 
+  hostfs_cache_dir_invalidate(host_pathname1);
+  hostfs_cache_dir_invalidate(new_pathname);
+
   if (rename(host_pathname1, new_pathname)) {
     /* An error occurred */
 
@@ -1593,129 +2122,6 @@ hostfs_func_8_rename(ARMul_State *state)
   state->Reg[1] = 0; /* zero indicates successful rename */
 }
 
-/**
- * Compare two elements of type \a cache_directory_entry by comparing their
- * names in a case-insensitive manner.
- *
- * @param e1 Pointer to first \a cache_directory_entry
- * @param e2 Pointer to second \a cache_directory_entry
- * @return Returns an integer less than, equal to, or greater than zero if
- *         e1's name is found, respectively, to be earlier than, to match, or
- *         be later than e2's name.
- */
-static int
-hostfs_directory_entry_compare(const void *e1, const void *e2)
-{
-  const cache_directory_entry *entry1 = e1;
-  const cache_directory_entry *entry2 = e2;
-  const char *name1 = cache_names + entry1->name_offset;
-  const char *name2 = cache_names + entry2->name_offset;
-
-  return strcasecmp(name1, name2);
-}
-
-/**
- * Reads the entries in the directory \a directory_name. Stores them in the
- * cache, sorted in case-insensitive order of name.
- *
- * @param directory_name Full path to host directory to be read and cached
- */
-static void
-hostfs_cache_dir(const char *directory_name)
-{
-  static unsigned cache_entries_capacity = 128; /* Initial capacity of cache_entries[] */
-  static unsigned cache_names_capacity = 2048; /* Initial capacity of cache_names[] */
-
-  unsigned entry_ptr = 0;
-  unsigned name_ptr = 0;
-  DIR *d;
-  const struct dirent *entry;
-
-  assert(directory_name);
-
-  /* Allocate memory initially */
-  if (!cache_entries) {
-    cache_entries = malloc(cache_entries_capacity * sizeof(cache_directory_entry));
-  }
-  if (!cache_names) {
-    cache_names = malloc(cache_names_capacity);
-  }
-  if ((!cache_entries) || (!cache_names)) {
-    fprintf(stderr, "hostfs_cache_dir(): Out of memory\n");
-    exit(1);
-  }
-
-  /* Read each of the directory entries one at a time.
-   * Fill in the cache_entries[] and cache_names[] arrays,
-   *    resizing these dynamically if required.
-   */
-  d = opendir(directory_name);
-  assert(d); /* FIXME */
-
-  while ((entry = readdir(d)) != NULL) {
-    char entry_path[PATH_MAX], ro_leaf[PATH_MAX];
-    unsigned string_space;
-
-    /* Ignore the current directory and it's parent */
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
-    }
-
-    strcpy(entry_path, directory_name);
-    strcat(entry_path, "/");
-    strcat(entry_path, entry->d_name);
-
-    hostfs_read_object_info(entry_path, ro_leaf,
-			    &cache_entries[entry_ptr].object_info);
-
-    /* Ignore entries we can not read information about,
-       or which are neither regular files or directories */
-    if (cache_entries[entry_ptr].object_info.type == OBJECT_TYPE_NOT_FOUND) {
-      continue;
-    }
-
-    /* Calculate space required to store name (+ terminator) */
-    string_space = strlen(ro_leaf) + 1;
-
-    /* Check whether cache_names[] is large enough; increase if required */
-    if (string_space > (cache_names_capacity - name_ptr)) {
-      cache_names_capacity *= 2;
-      cache_names = realloc(cache_names, cache_names_capacity);
-      if (!cache_names) {
-	fprintf(stderr, "hostfs_cache_dir(): Out of memory\n");
-	exit(1);
-      }
-    }
-
-    /* Copy string into cache_names[]. Put offset ptr into local_entries[] */
-    strcpy(cache_names + name_ptr, ro_leaf);
-    cache_entries[entry_ptr].name_offset = name_ptr;
-
-    /* Advance name_ptr */
-    name_ptr += string_space;
-
-    /* Advance entry_ptr, increasing space of cache_entries[] if required */
-    entry_ptr++;
-    if (entry_ptr == cache_entries_capacity) {
-      cache_entries_capacity *= 2;
-      cache_entries = realloc(cache_entries, cache_entries_capacity * sizeof(cache_directory_entry));
-      if (!cache_entries) {
-	fprintf(stderr, "hostfs_cache_dir(): Out of memory\n");
-	exit(1);
-      }
-    }
-  }
-
-  closedir(d);
-
-  /* Sort the directory entries, case-insensitive */
-  qsort(cache_entries, entry_ptr, sizeof(cache_directory_entry),
-	hostfs_directory_entry_compare);
-
-  /* Store the number of directory entries found */
-  cache_entries_count = entry_ptr;
-}
-
 /**
  * Return directory information for FSEntry_Func 14, 15 and 19.
  * Uses and updates the cached directory information.
@@ -1729,9 +2135,9 @@ hostfs_cache_dir(const char *directory_name)
 static void
 hostfs_read_dir(ARMul_State *state, bool with_info, bool with_timestamp)
 {
-  static char cached_directory[PATH_MAX] = { '\0' }; /* Directory stored in the cache */
   char ro_path[PATH_MAX], host_pathname[PATH_MAX];
   risc_os_object_info object_info;
+  const cache_directory *dir;
 
   assert(state);
 
@@ -1757,9 +2163,15 @@ hostfs_read_dir(ARMul_State *state, bool with_info, bool with_timestamp)
     return;
   }
 
-  /* Determine if we should use the cached directory contents or should re-read */
-  if (!STREQ(host_pathname, cached_directory) || (state->Reg[4] == 0)) {
-    hostfs_cache_dir(host_pathname);
+  /* Use the cached directory contents, re-reading them if they have changed
+     but only before the listing has started */
+  dir = hostfs_cache_dir_lookup(host_pathname,
+				state->Reg[4] == 0 ? CACHE_REFRESH_LISTING :
+						     CACHE_REFRESH_NEVER);
+  if (!dir) {
+    state->Reg[3] = 0;
+    state->Reg[4] = (uint32_t) -1;
+    return;
   }
 
   {
@@ -1769,11 +2181,11 @@ hostfs_read_dir(ARMul_State *state, bool with_info, bool with_timestamp)
     ARMword offset = state->Reg[4]; /* Offset of item to read */
     ARMword ptr = state->Reg[2]; /* Pointer to return buffer */
 
-    while ((count < num_objects_to_read) && (offset < cache_entries_count)) {
+    while ((count < num_objects_to_read) && (offset < dir->count)) {
       unsigned string_space, entry_space;
 
       /* Calculate space required to return name and (optionally) info */
-      string_space = (unsigned) strlen(cache_names + cache_entries[offset].name_offset) + 1;
+      string_space = (unsigned) strlen(dir->names + dir->entries[offset].name_offset) + 1;
       if (with_info) {
 	if (with_timestamp) {
 	  /* Space required for info with timestamp:
@@ -1795,21 +2207,21 @@ hostfs_read_dir(ARMul_State *state, bool with_info, bool with_timestamp)
 
       /* Fill in this entry */
       if (with_info) {
-	ARMul_StoreWordS(state, ptr + 0,  cache_entries[offset].object_info.load);
-	ARMul_StoreWordS(state, ptr + 4,  cache_entries[offset].object_info.exec);
-	ARMul_StoreWordS(state, ptr + 8,  cache_entries[offset].object_info.length);
-	ARMul_StoreWordS(state, ptr + 12, cache_entries[offset].object_info.attribs);
-	ARMul_StoreWordS(state, ptr + 16, cache_entries[offset].object_info.type);
+	ARMul_StoreWordS(state, ptr + 0,  dir->entries[offset].object_info.load);
+	ARMul_StoreWordS(state, ptr + 4,  dir->entries[offset].object_info.exec);
+	ARMul_StoreWordS(state, ptr + 8,  dir->entries[offset].object_info.length);
+	ARMul_StoreWordS(state, ptr + 12, dir->entries[offset].object_info.attribs);
+	ARMul_StoreWordS(state, ptr + 16, dir->entries[offset].object_info.type);
 
 	if (with_timestamp) {
 	  ARMul_StoreWordS(state, ptr + 20, 0); /* Always 0 */
 	  /* Test if Load and Exec contain timestamp */
-	  if ((cache_entries[offset].object_info.load & 0xfff00000u) == 0xfff00000u) {
+	  if ((dir->entries[offset].object_info.load & 0xfff00000u) == 0xfff00000u) {
 	    ARMul_StoreWordS(state, ptr + 24,
-			     (cache_entries[offset].object_info.load << 24) |
-			     (cache_entries[offset].object_info.exec >> 8));
+			     (dir->entries[offset].object_info.load << 24) |
+			     (dir->entries[offset].object_info.exec >> 8));
 	    ARMul_StoreByte(state, ptr + 28,
-			    cache_entries[offset].object_info.exec & 0xff);
+			    dir->entries[offset].object_info.exec & 0xff);
 	  } else {
 	    ARMul_StoreWordS(state, ptr + 24, 0);
 	    ARMul_StoreByte(state, ptr + 28, 0);
@@ -1819,7 +2231,7 @@ hostfs_read_dir(ARMul_State *state, bool with_info, bool with_timestamp)
 	  ptr += 20;
 	}
       }
-      put_string(state, ptr, cache_names + cache_entries[offset].name_offset);
+      put_string(state, ptr, dir->names + dir->entries[offset].name_offset);
 
       ptr += string_space;
       if (with_info) {
@@ -1831,7 +2243,7 @@ hostfs_read_dir(ARMul_State *state, bool with_info, bool with_timestamp)
     }
 
     /* Find out whether we have now completed the directory */
-    if (offset >= cache_entries_count && count == 0) {
+    if (offset >= dir->count && count == 0) {
       /* We have completed the directory - return this fact */
       dbug_hostfs("HostFS completed directory\n");
       state->Reg[4] = (uint32_t) -1;
@@ -2105,6 +2517,16 @@ hostfs_init(void)
       HOSTFS_ROOT[c] = '/';
     }
   }
+
+#ifdef HOSTFS_INOTIFY
+  if (cache_inotify_fd < 0) {
+    cache_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache_inotify_fd < 0) {
+      fprintf(stderr, "HostFS: inotify unavailable, directory cache will check mtimes: %s\n",
+	      strerror(errno));
+    }
+  }
+#endif
 }
 
 /**
@@ -2123,7 +2545,12 @@ hostfs_reset(void)
       fclose(open_file[i]);
       open_file[i] = NULL;
     }
+    free(open_file_path[i]);
+    open_file_path[i] = NULL;
   }
+
+  /* Anything may have changed on the Host while the machine was off */
+  hostfs_cache_dir_flush();
 }
 
 /**
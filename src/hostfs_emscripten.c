@@ -1,4 +1,6 @@
+#include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -18,9 +20,15 @@
  * 
  * The RISC OS character encoding is a variant of ISO-8859-1. However, instead of doing 
  * a proper conversion, the hostfs_ros_to_utf8 and hostfs_utf8_to_ros functions below
- * cheat by using String.fromCharCode / charCodeAt to map RISC OS strings directly to
- * UTF-16. This isn't perfect, but it round-trips from RISC OS to HostFS/MemFS without
- * getting mangled.
+ * cheat by mapping each RISC OS byte straight to the Unicode code point of the same
+ * value, as ISO-8859-1 would. This isn't perfect, but it round-trips from RISC OS to
+ * HostFS/MemFS without getting mangled. Going the other way, each UTF-16 code unit of
+ * a name keeps its low byte, which is what the original Javascript helpers did, so
+ * names created with those helpers are still found.
+ * 
+ * The conversion is done here in C rather than in Javascript, so that a HostFS call
+ * never has to leave wasm just to re-encode a path. Paths that are plain ASCII need
+ * no conversion at all and are passed through unchanged.
  * 
  * Arculator running natively doesn't have this problem (on Linux, at least) because
  * there, the filesystem just treats paths as a sequence of bytes - you get out what 
@@ -28,41 +36,141 @@
  * filenames can look mangled when viewed natively.
  */ 
 
-EM_JS(void, hostfs_ros_to_utf8, (const char *unicode_str_ptr, const char *ros_str_ptr), {
-    let str = "";
-    for (let i=ros_str_ptr; HEAPU8[i]!=0; i++) {
-        str += String.fromCharCode(HEAPU8[i]);
+/* UTF-8 encoding of each RISC OS character, and its length in bytes */
+static char ros_utf8[256][2];
+static unsigned char ros_utf8_len[256];
+
+/* Length of the UTF-8 sequence started by each byte, 0 if it can't start one */
+static unsigned char utf8_seq_len[256];
+
+static void hostfs_utf8_init(void) {
+    static int done = 0;
+    int c;
+
+    if (done)
+        return;
+
+    for (c = 0; c < 256; c++) {
+        if (c < 0x80) {
+            ros_utf8[c][0] = c;
+            ros_utf8_len[c] = 1;
+            utf8_seq_len[c] = 1;
+        } else {
+            ros_utf8[c][0] = 0xc0 | (c >> 6);
+            ros_utf8[c][1] = 0x80 | (c & 0x3f);
+            ros_utf8_len[c] = 2;
+            if (c >= 0xc2 && c < 0xe0)
+                utf8_seq_len[c] = 2;
+            else if (c >= 0xe0 && c < 0xf0)
+                utf8_seq_len[c] = 3;
+            else if (c >= 0xf0 && c < 0xf5)
+                utf8_seq_len[c] = 4;
+        }
+    }
+    done = 1;
+}
+
+/**
+ * Converts a RISC OS path to UTF-8. Returns ros_str itself if it is plain ASCII,
+ * otherwise unicode_str (of PATH_MAX bytes) holding the converted path, or NULL
+ * with errno set if the converted path is too long.
+ */
+static const char *hostfs_ros_to_utf8(char *unicode_str, const char *ros_str) {
+    const unsigned char *p;
+    char *out = unicode_str;
+
+    for (p = (const unsigned char *)ros_str; *p; p++) {
+        if (*p & 0x80)
+            break;
+    }
+    if (!*p)
+        return ros_str;
+
+    hostfs_utf8_init();
+    for (p = (const unsigned char *)ros_str; *p; p++) {
+        int len = ros_utf8_len[*p];
+
+        if (out + len >= unicode_str + PATH_MAX) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        out[0] = ros_utf8[*p][0];
+        if (len == 2)
+            out[1] = ros_utf8[*p][1];
+        out += len;
     }
-    let utf8_bytes = new TextEncoder().encode(str);
-    let i = 0;
-    for (;i<utf8_bytes.byteLength;i++) {
-        HEAPU8[unicode_str_ptr+i] = utf8_bytes[i];
+    *out = 0;
+
+    return unicode_str;
+}
+
+/**
+ * Converts a UTF-8 name to RISC OS. The result is never longer than the input,
+ * so ros_str may be the same as unicode_str. Malformed sequences become U+FFFD
+ * as they would in Javascript.
+ */
+static void hostfs_utf8_to_ros(char *ros_str, const char *unicode_str) {
+    const unsigned char *p = (const unsigned char *)unicode_str;
+    char *out = ros_str;
+
+    hostfs_utf8_init();
+    while (*p) {
+        uint32_t code = *p;
+        int len = utf8_seq_len[*p];
+        int i;
+
+        if (len == 1) {
+            *out++ = *p++;
+            continue;
+        }
+
+        if (len) {
+            code &= 0x7f >> len;
+            for (i = 1; i < len; i++) {
+                if ((p[i] & 0xc0) != 0x80)
+                    break;
+                code = (code << 6) | (p[i] & 0x3f);
+            }
+            /* Reject truncated, overlong and surrogate sequences */
+            if (i < len || (len == 3 && code < 0x800) || (len == 4 && (code < 0x10000 || code > 0x10ffff)) ||
+                (code >= 0xd800 && code < 0xe000)) {
+                code = 0xfffd;
+                len = i;
+            }
+        } else {
+            code = 0xfffd;
+            len = 1;
+        }
+        p += len;
+
+        if (code >= 0x10000) {
+            /* Surrogate pair, one character per code unit */
+            code -= 0x10000;
+            *out++ = (0xd800 | (code >> 10)) & 0xff;
+            *out++ = (0xdc00 | (code & 0x3ff)) & 0xff;
+        } else
+            *out++ = code & 0xff;
     }
-    HEAPU8[unicode_str_ptr+i] = 0;
-});
-
-EM_JS(void, hostfs_utf8_to_ros, (const char *ros_pathname, const char *unicode_pathname), {
-  let str = UTF8ToString(unicode_pathname);
-  let i=0;
-  for (;i<str.length; i++) {
-    HEAPU8[ros_pathname+i] = str.charCodeAt(i);
-  }
-  HEAPU8[ros_pathname+i] = 0;
-});
+    *out = 0;
+}
 
 FILE *fopen_hostfs_emscripten(const char *pathname, const char *mode) {
-    char unicode_path[PATH_MAX];
-    hostfs_ros_to_utf8(unicode_path, pathname);
+    char unicode_buf[PATH_MAX];
+    const char *unicode_path = hostfs_ros_to_utf8(unicode_buf, pathname);
+    if (!unicode_path)
+        return NULL;
     //rpclog("fopen_hostfs_emscripten %s %s\n", unicode_path, mode);
     return fopen(unicode_path, mode);
 }
 
 int rename_hostfs_emscripten(const char *oldpath, const char *newpath) {
-    char unicode_oldpath[PATH_MAX];
-    char unicode_newpath[PATH_MAX];
+    char unicode_oldbuf[PATH_MAX];
+    char unicode_newbuf[PATH_MAX];
+    const char *unicode_oldpath = hostfs_ros_to_utf8(unicode_oldbuf, oldpath);
+    const char *unicode_newpath = hostfs_ros_to_utf8(unicode_newbuf, newpath);
 
-    hostfs_ros_to_utf8(unicode_oldpath, oldpath);
-    hostfs_ros_to_utf8(unicode_newpath, newpath);
+    if (!unicode_oldpath || !unicode_newpath)
+        return -1;
     
     //rpclog("rename_hostfs_emscripten %s -> %s\n", unicode_oldpath, unicode_newpath);
     return rename(unicode_oldpath, unicode_newpath);
@@ -70,8 +178,10 @@ int rename_hostfs_emscripten(const char *oldpath, const char *newpath) {
 
 
 DIR *opendir_hostfs_emscripten(const char *name) {
-    char unicode_name[PATH_MAX];
-    hostfs_ros_to_utf8(unicode_name, name);
+    char unicode_buf[PATH_MAX];
+    const char *unicode_name = hostfs_ros_to_utf8(unicode_buf, name);
+    if (!unicode_name)
+        return NULL;
     //rpclog("opendir_hostfs_emscripten %s\n", unicode_name);
     return opendir(unicode_name);
 }
@@ -88,21 +198,27 @@ struct dirent *readdir_hostfs_emscripten(DIR *dirp) {
 }
 
 int stat_hostfs_emscripten(const char *pathname, struct stat *statbuf) {
-    char unicode_pathname[PATH_MAX];
-    hostfs_ros_to_utf8(unicode_pathname, pathname);
+    char unicode_buf[PATH_MAX];
+    const char *unicode_pathname = hostfs_ros_to_utf8(unicode_buf, pathname);
+    if (!unicode_pathname)
+        return -1;
     //rpclog("stat_hostfs_emscripten %s\n", unicode_pathname);
     return stat(unicode_pathname, statbuf);
 }
 
 int utime_hostfs_emscripten(const char *filename, const struct utimbuf *times) {
-    char unicode_filename[PATH_MAX];
-    hostfs_ros_to_utf8(unicode_filename, filename);
+    char unicode_buf[PATH_MAX];
+    const char *unicode_filename = hostfs_ros_to_utf8(unicode_buf, filename);
+    if (!unicode_filename)
+        return -1;
     return utime(unicode_filename, times);
 }
 
 int mkdir_hostfs_emscripten(const char *pathname, mode_t mode) {
-    char unicode_pathname[PATH_MAX];
-    hostfs_ros_to_utf8(unicode_pathname, pathname);
+    char unicode_buf[PATH_MAX];
+    const char *unicode_pathname = hostfs_ros_to_utf8(unicode_buf, pathname);
+    if (!unicode_pathname)
+        return -1;
     //rpclog("mkdir_hostfs_emscripten %s\n", unicode_pathname);
     return mkdir(unicode_pathname, mode);
 }
@@ -7,6 +7,7 @@
 #include "config.h"
 #include "ide.h"
 #include "ioc.h"
+#include "snapshot.h"
 #include "timer.h"
 
 /* Bits of 'atastat' */
@@ -50,10 +51,22 @@ static void ide_clear_irq(ide_t *ide)
 
 void closeide(ide_t *ide)
 {
-	if (ide->hdfile[0])
-		fclose(ide->hdfile[0]);
-	if (ide->hdfile[1])
-		fclose(ide->hdfile[1]);
+	int c;
+
+	for (c = 0; c < 2; c++)
+	{
+		if (ide->hdfile[c])
+		{
+			blockdev_stats_t stats;
+
+			blockdev_get_stats(ide->hdfile[c], &stats);
+			rpclog("IDE drive %i: %llu cache hits, %llu misses, %llu reads, %llu writes\n", c,
+				(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+				(unsigned long long)stats.reads, (unsigned long long)stats.writes);
+			blockdev_close(ide->hdfile[c]);
+			ide->hdfile[c] = NULL;
+		}
+	}
 }
 
 void resetide(ide_t *ide,
@@ -75,21 +88,24 @@ void resetide(ide_t *ide,
 	for (c = 0; c < 2; c++)
 	{
 		if (!c)
-			ide->hdfile[c] = fopen(fn_pri, "rb+");
+			ide->hdfile[c] = blockdev_open(fn_pri, "rb+");
 		else
-			ide->hdfile[c] = fopen(fn_sec, "rb+");
+			ide->hdfile[c] = blockdev_open(fn_sec, "rb+");
 
 		if (ide->hdfile[c])
 		{
 			uint8_t log2secsize, sectors, heads, density;
+			uint8_t disc_record[4];
+			size_t len;
 
-			fseek(ide->hdfile[c], 0xFC0, SEEK_SET);
-			log2secsize = getc(ide->hdfile[c]);
-			sectors = getc(ide->hdfile[c]);
-			heads = getc(ide->hdfile[c]);
-			density = getc(ide->hdfile[c]);
+			blockdev_seek(ide->hdfile[c], 0xFC0);
+			len = blockdev_read(ide->hdfile[c], disc_record, 4);
+			log2secsize = disc_record[0];
+			sectors = disc_record[1];
+			heads = disc_record[2];
+			density = disc_record[3];
 
-			if ((log2secsize != 8 && log2secsize != 9) || !sectors || !heads || sectors > 63 || heads > 16 || density != 0)
+			if (len != 4 || (log2secsize != 8 && log2secsize != 9) || !sectors || !heads || sectors > 63 || heads > 16 || density != 0)
 				ide->skip512[c] = 0;
 			else
 				ide->skip512[c] = 1;
@@ -112,6 +128,30 @@ void resetide(ide_t *ide,
 	timer_add(&ide->timer, callbackide, ide, 0);
 }
 
+void ide_snapshot(snapshot_t *s, ide_t *ide)
+{
+	SNAPSHOT_VAR(s, ide->atastat);
+	SNAPSHOT_VAR(s, ide->error);
+	SNAPSHOT_VAR(s, ide->status);
+	SNAPSHOT_VAR(s, ide->secount);
+	SNAPSHOT_VAR(s, ide->sector);
+	SNAPSHOT_VAR(s, ide->cylinder);
+	SNAPSHOT_VAR(s, ide->head);
+	SNAPSHOT_VAR(s, ide->drive);
+	SNAPSHOT_VAR(s, ide->cylprecomp);
+	SNAPSHOT_VAR(s, ide->command);
+	SNAPSHOT_VAR(s, ide->fdisk);
+	SNAPSHOT_VAR(s, ide->pos);
+	SNAPSHOT_ARRAY(s, ide->spt);
+	SNAPSHOT_ARRAY(s, ide->hpc);
+	SNAPSHOT_ARRAY(s, ide->cyl);
+	SNAPSHOT_VAR(s, ide->reset);
+	SNAPSHOT_ARRAY(s, ide->idebuffer);
+	SNAPSHOT_ARRAY(s, ide->irq_active);
+	SNAPSHOT_VAR(s, ide->irq_enabled);
+	timer_snapshot(s, &ide->timer);
+}
+
 void writeidew(ide_t *ide, uint16_t val)
 {
 //        if (ide->sector==7) rpclog("Write data %08X %04X\n",ide->pos,val);
@@ -402,8 +442,8 @@ void callbackide(void *p)
 			exit(-1);
 		}*/
 		rpclog("Seek to %08X\n",addr);
-		fseek(ide->hdfile[ide->drive],addr,SEEK_SET);
-		ignore_result(fread(ide->idebuffer,512,1,ide->hdfile[ide->drive]));
+		blockdev_seek(ide->hdfile[ide->drive],addr);
+		blockdev_read(ide->hdfile[ide->drive],ide->idebuffer,512);
 		ide->pos=0;
 		ide->atastat = READY_STAT | DRQ_STAT | DSC_STAT;
 //                rpclog("Read sector callback %i %i %i offset %08X %i left %i\n",ide->sector,ide->cylinder,ide->head,addr,ide->secount,ide->spt[ide->drive]);
@@ -417,8 +457,8 @@ void callbackide(void *p)
 		addr=((((ide->cylinder*ide->hpc[ide->drive])+ide->head)*ide->spt[ide->drive])+(ide->sector))*512;
 		if (!ide->skip512[ide->drive]) addr-=512;
 //                rpclog("Write sector callback %i %i %i offset %08X %i left %i %i %i\n",ide->sector,ide->cylinder,ide->head,addr,ide->secount,ide->spt[ide->drive],ide->hpc[ide->drive],ide->drive);
-		fseek(ide->hdfile[ide->drive],addr,SEEK_SET);
-		fwrite(ide->idebuffer,512,1,ide->hdfile[ide->drive]);
+		blockdev_seek(ide->hdfile[ide->drive],addr);
+		blockdev_write(ide->hdfile[ide->drive],ide->idebuffer,512);
 		ide_raise_irq(ide);
 		ide->secount--;
 		if (ide->secount)
@@ -455,11 +495,11 @@ void callbackide(void *p)
 		addr=(((ide->cylinder*ide->hpc[ide->drive])+ide->head)*ide->spt[ide->drive])*512;
 		if (!ide->skip512[ide->drive]) addr-=512;
 //                rpclog("Format cyl %i head %i offset %08X secount %I\n",ide->cylinder,ide->head,addr,ide->secount);
-		fseek(ide->hdfile[ide->drive],addr,SEEK_SET);
+		blockdev_seek(ide->hdfile[ide->drive],addr);
 		memset(ide->idebufferb,0,512);
 		for (c=0;c<ide->secount;c++)
 		{
-			fwrite(ide->idebuffer,512,1,ide->hdfile[ide->drive]);
+			blockdev_write(ide->hdfile[ide->drive],ide->idebuffer,512);
 		}
 		ide->atastat = READY_STAT | DSC_STAT;
 		ide_raise_irq(ide);
@@ -1,3 +1,4 @@
+#include "blockdev.h"
 #include "timer.h"
 
 typedef struct ide_t
@@ -14,7 +15,7 @@ typedef struct ide_t
 	int spt[2], hpc[2], cyl[2];
 	unsigned int max_sector[2];
 	int reset;
-	FILE *hdfile[2];
+	blockdev_t *hdfile[2];
 	uint16_t idebuffer[256];
 	uint8_t *idebufferb;
 	int skip512[2];
@@ -9,6 +9,7 @@
 #include "ioc.h"
 #include "keyboard.h"
 #include "printer.h"
+#include "snapshot.h"
 #include "timer.h"
 
 IOC_t ioc;
@@ -291,6 +292,21 @@ void ioc_reset()
 	timer_add(&ioc.timers[3], ioc_timer_callback, (void *)3, 1);
 }
 
+void ioc_snapshot(snapshot_t *s)
+{
+	int c;
+
+	SNAPSHOT_STRUCT_TO(s, ioc, timers);
+	for (c = 0; c < 4; c++)
+		timer_snapshot(s, &ioc.timers[c]);
+	SNAPSHOT_VAR(s, keyway);
+	SNAPSHOT_VAR(s, tempkey);
+	SNAPSHOT_VAR(s, iockey);
+	SNAPSHOT_VAR(s, iockey2);
+	SNAPSHOT_VAR(s, keydelay);
+	SNAPSHOT_VAR(s, keydelay2);
+}
+
 void ioc_discchange(int drive)
 {
 	discchange[drive] = 1;
@@ -7,6 +7,7 @@
 #include "ioeb.h"
 #include "joystick.h"
 #include "plat_joystick.h"
+#include "snapshot.h"
 #include "vidc.h"
 
 static const struct
@@ -90,6 +91,12 @@ void ioeb_write(uint32_t addr, uint8_t val)
 	}
 }
 
+void ioeb_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, ioeb_clock_select);
+	SNAPSHOT_VAR(s, hs_invert);
+}
+
 void ioeb_init()
 {
 	has_joystick_ports = !strcmp(machine, "a3010");
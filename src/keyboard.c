@@ -7,6 +7,7 @@
 #include "keyboard.h"
 #include "plat_input.h"
 #include "keytable.h"
+#include "snapshot.h"
 #include "timer.h"
 #include "video.h"
 #include "vidc.h"
@@ -364,6 +365,29 @@ void keyboard_init()
 	keyena = 0;
 }
 
+void keyboard_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, keystat);
+	SNAPSHOT_ARRAY(s, key_data);
+	SNAPSHOT_VAR(s, keyena);
+	SNAPSHOT_VAR(s, mouseena);
+	SNAPSHOT_ARRAY(s, keydat);
+	SNAPSHOT_ARRAY(s, mousedown);
+	SNAPSHOT_VAR(s, keyrow);
+	SNAPSHOT_VAR(s, keycol);
+	SNAPSHOT_VAR(s, ledcaps);
+	SNAPSHOT_VAR(s, lednum);
+	SNAPSHOT_VAR(s, ledscr);
+	SNAPSHOT_VAR(s, ml);
+	SNAPSHOT_VAR(s, mr);
+	SNAPSHOT_VAR(s, mt);
+	SNAPSHOT_VAR(s, mb);
+	SNAPSHOT_VAR(s, mouse_pointer_linked);
+	timer_snapshot(s, &keyboard_timer);
+	timer_snapshot(s, &keyboard_rx_timer);
+	timer_snapshot(s, &keyboard_tx_timer);
+}
+
 FILE *klog;
 void keyboard_poll(void *p)
 {
@@ -5,6 +5,7 @@
 #include "config.h"
 #include "ioeb.h"
 #include "lc.h"
+#include "snapshot.h"
 #include "timer.h"
 #include "vidc.h"
 #include "plat_video.h"
@@ -115,6 +116,24 @@ void lc_init(void)
 	}
 }
 
+void lc_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_ARRAY(s, lc.ram);
+	SNAPSHOT_VAR(s, lc.wp);
+	SNAPSHOT_VAR(s, lc.vdsr);
+	SNAPSHOT_VAR(s, lc.vdlr);
+	SNAPSHOT_VAR(s, lc.hdsr);
+	SNAPSHOT_VAR(s, lc.hdlr);
+	SNAPSHOT_VAR(s, lc.licr);
+	SNAPSHOT_VAR(s, lc.v_delay);
+	SNAPSHOT_VAR(s, lc.v_display);
+	SNAPSHOT_VAR(s, lc.vc);
+	SNAPSHOT_ARRAY(s, lc.pal);
+	SNAPSHOT_VAR(s, lc.has_updated);
+	if (monitor_type == MONITOR_LCD)
+		timer_snapshot(s, &lc.blank_timer);
+}
+
 static void lc_vidc_data(uint8_t *data, int pixels, int hsync_length, int resolution, void *p)
 {
 	int c;
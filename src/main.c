@@ -11,6 +11,7 @@
 #include "82c711_fdc.h"
 #include "arc.h"
 #include "arm.h"
+#include "blockdev.h"
 #include "cmos.h"
 #include "config.h"
 #include "ddnoise.h"
@@ -36,6 +37,7 @@
 #include "plat_sound.h"
 #include "plat_video.h"
 #include "podules.h"
+#include "rewind.h"
 #include "romload.h"
 #include "sound.h"
 #include "st506.h"
@@ -65,6 +67,7 @@ float inssecf;  /*Millions of instructions executed in the last second*/
 int inssec;            /*Speed ratio percentage (100% = realtime emulation), updated by updateins()*/
 int update_status_text;        /*1 window status text has not been updated since last updateins() call*/
 static int frameco=0;  /*Number of 1/100 second executions (arm_run() calls) since last updateins()*/
+uint32_t timer_callbacks_sec; /*Timer callbacks run in the last second, updated by updateins()*/
 char exname[512];
 
 int jint,jtotal;
@@ -77,7 +80,11 @@ void updateins()
 	frameco=0;
 	jtotal=jint;
 	jint=0;
+	timer_callbacks_sec=timer_callbacks_sample();
 	update_status_text=1;
+	/*Don't leave hard disc writes cached for long, in case we never get to
+	  arc_close()*/
+	blockdev_flush_all();
 }
 
 FILE *rlog = NULL;
@@ -145,7 +152,7 @@ void error(const char *format, ...)
    exit(-1);
 }
 
-void arc_set_cpu(int cpu, int memc);
+void arc_set_cpu(int cpu, int memc, int timing);
 
 int arc_init()
 {
@@ -156,7 +163,7 @@ int arc_init()
 	loadconfig();
 
 	initvid();
-	arc_set_cpu(arm_cpu_type, memc_type);
+	arc_set_cpu(arm_cpu_type, memc_type, arm_cpu_timing);
 	timer_reset();
 	total_emulation_millis=0;
 #if 0
@@ -229,6 +236,7 @@ int arc_init()
 	ioeb_init();
 	if (machine_type == MACHINE_TYPE_A4)
 		lc_init();
+	rewind_reset();
 
 	return 0;
 }
@@ -237,7 +245,7 @@ int speed_mhz;
 
 void arc_reset()
 {
-	arc_set_cpu(arm_cpu_type, memc_type);
+	arc_set_cpu(arm_cpu_type, memc_type, arm_cpu_timing);
 	timer_reset();
 	total_emulation_millis=0;
 	st506_internal_close();
@@ -274,6 +282,7 @@ void arc_reset()
 	ioeb_init();
 	if (machine_type == MACHINE_TYPE_A4)
 		lc_init();
+	rewind_reset();
 }
 
 static struct
@@ -312,7 +321,7 @@ static struct
 	{"ARM3 (40 MHz)", 40, 1, 1},
 };
 
-void arc_set_cpu(int cpu, int memc)
+void arc_set_cpu(int cpu, int memc, int timing)
 {
 	rpclog("arc_setcpu : setting CPU to %s\n", arc_cpus[cpu].name);
 	arm_mem_speed = arc_memcs[memc].mem_speed;
@@ -324,6 +333,8 @@ void arc_set_cpu(int cpu, int memc)
 		arm_cpu_speed = arm_mem_speed;
 	arm_has_swp   = arc_cpus[cpu].has_swp;
 	arm_has_cp15  = arc_cpus[cpu].has_cp15;
+	arm_timing_fast = (timing == ARM_TIMING_FAST);
+	rpclog("CPU timing : %s\n", arm_timing_fast ? "fast" : "cycle-exact");
 	ref8m_period = (arm_cpu_speed * 1024) / 8;
 	speed_mhz = arm_cpu_speed;
 	mem_updatetimings();
@@ -331,6 +342,7 @@ void arc_set_cpu(int cpu, int memc)
 
 long long total_emulation_millis = 0;
 int fast_forward_to_time_ms = 0;
+int turbo_mode = 0;
 
 void arc_run(int millisecs)
 {
@@ -338,12 +350,13 @@ void arc_run(int millisecs)
 	joystick_poll_host();
 	mouse_poll_host();
 	keyboard_poll_host();
-	//total_emulation_millis += millisecs;
+	total_emulation_millis += millisecs;
 
 	if (mouse_mode == MOUSE_MODE_ABSOLUTE) 
 		doosmouse();
     execarm(speed_mhz * 1000 * millisecs);
     frameco++;
+	rewind_poll(millisecs);
 	
 	if (cmos_changed)
 	{
@@ -365,6 +378,10 @@ void arc_close()
 	saveconfig();
 #endif
 	podules_close();
+	/*Write back anything still held in the hard disc caches*/
+	st506_internal_close();
+	closeide(&ide_internal);
+	rewind_close();
 	disc_close(0);
 	disc_close(1);
 	disc_close(2);
@@ -15,9 +15,11 @@
 #include "ioeb.h"
 #include "joystick.h"
 #include "lc.h"
+#include "mem.h"
 #include "memc.h"
 #include "podules.h"
 #include "printer.h"
+#include "snapshot.h"
 #include "st506.h"
 #include "vidc.h"
 #include "wd1770.h"
@@ -49,6 +51,66 @@ uint8_t *mempoint[0x4000];
 uint8_t memstat[0x4000];
 int memmode;
 
+uint8_t *ram_page_flags;
+uintptr_t ram_nr_pages;
+uint32_t *ram_dirty;
+
+static void mem_alloc_page_flags(int memsize)
+{
+	free(ram_page_flags);
+	free(ram_dirty);
+	ram_nr_pages = (memsize * 1024) >> 12;
+	ram_page_flags = calloc(ram_nr_pages, 1);
+	ram_dirty = malloc(RAM_DIRTY_WORDS * sizeof(uint32_t));
+	/*Newly allocated RAM has no checkpoint to be compared against*/
+	mem_dirty_set_all();
+}
+
+void mem_ram_page_written(uintptr_t page)
+{
+	if (ram_page_flags[page] & RAM_PAGE_CLEAN)
+	{
+		/*First write since the checkpoint. Later writes to this page skip
+		  the call entirely*/
+		ram_page_flags[page] &= ~RAM_PAGE_CLEAN;
+		ram_dirty[page >> 5] |= 1u << (page & 31);
+	}
+	if (ram_page_flags[page] & RAM_PAGE_CODE)
+		arm_invalidate_code_page(page);
+}
+
+void mem_dirty_clear(void)
+{
+	uintptr_t c;
+
+	memset(ram_dirty, 0, RAM_DIRTY_WORDS * sizeof(uint32_t));
+	for (c = 0; c < ram_nr_pages; c++)
+		ram_page_flags[c] |= RAM_PAGE_CLEAN;
+}
+
+void mem_dirty_set_all(void)
+{
+	uintptr_t c;
+
+	memset(ram_dirty, 0xff, RAM_DIRTY_WORDS * sizeof(uint32_t));
+	for (c = 0; c < ram_nr_pages; c++)
+		ram_page_flags[c] &= ~RAM_PAGE_CLEAN;
+}
+
+int mem_dirty_count(void)
+{
+	int count = 0;
+	uintptr_t c;
+
+	for (c = 0; c < ram_nr_pages; c++)
+	{
+		if (ram_dirty[c >> 5] & (1u << (c & 31)))
+			count++;
+	}
+
+	return count;
+}
+
 static void mem_recalc_mem_spd_multi(void)
 {
 	mem_spd_multi = arm_has_cp15 ? (((uint64_t)speed_mhz << 32) / arm_mem_speed) : (1ull << 32);
@@ -65,6 +127,7 @@ void initmem(int memsize)
 	rpclog("initmem %i\n", memsize);
 	realmemsize=memsize;
 	ram=(uint32_t *)malloc(memsize*1024);
+	mem_alloc_page_flags(memsize);
 	rom=(uint32_t *)malloc(0x200000);
 	rom_arcrom = malloc(0x10000);
 	rom_5th_column = (uint8_t *)malloc(0x20000);
@@ -94,6 +157,7 @@ void initmem(int memsize)
 	for (c = 0x3800; c < 0x4000; c++)
 		mem_speed[c][0] = mem_speed[c][1] = 4 * mem_spd_multi;
 	mem_romspeed_n = mem_romspeed_s = 4;
+	arm_timing_flush();
 	rpclog("Update2: mem=%i,%i\n", mem_speed[0x1800][0], mem_speed[0x1800][1]);
 }
 
@@ -117,10 +181,97 @@ void mem_setromspeed(int n, int s)
 		mem_speed[c][0] = s * mem_spd_multi;
 		mem_speed[c][1] = n * mem_spd_multi;
 	}
+	arm_timing_flush();
 
 	rpclog("mem_setromspeed %i %i\n", n, s);
 }
 
+/*mempoint[] entries are stored as an offset into RAM or ROM, as host addresses
+  won't match between sessions*/
+#define MEMPOINT_NULL 0
+#define MEMPOINT_RAM  (1u << 30)
+#define MEMPOINT_ROM  (2u << 30)
+#define MEMPOINT_TYPE (3u << 30)
+
+/*RAM is stored as a page bitmap followed by the contents of each page in it.
+  Full snapshots store every page, incremental snapshots only those written
+  since the last checkpoint*/
+static void mem_snapshot_ram(snapshot_t *s)
+{
+	uint32_t *pages = malloc(RAM_DIRTY_WORDS * sizeof(uint32_t));
+	uintptr_t c;
+
+	if (!s->loading)
+	{
+		if (s->incremental)
+			memcpy(pages, ram_dirty, RAM_DIRTY_WORDS * sizeof(uint32_t));
+		else
+			memset(pages, 0xff, RAM_DIRTY_WORDS * sizeof(uint32_t));
+	}
+	snapshot_data(s, pages, RAM_DIRTY_WORDS * sizeof(uint32_t));
+
+	for (c = 0; c < ram_nr_pages; c++)
+	{
+		if (!(c & 31) && !pages[c >> 5])
+		{
+			c += 31;
+			continue;
+		}
+		if (pages[c >> 5] & (1u << (c & 31)))
+			snapshot_data(s, (uint8_t *)ram + (c << 12), 0x1000);
+	}
+
+	free(pages);
+}
+
+void mem_snapshot(snapshot_t *s)
+{
+	int c;
+
+	mem_snapshot_ram(s);
+	SNAPSHOT_ARRAY(s, memstat);
+	SNAPSHOT_VAR(s, memmode);
+	SNAPSHOT_VAR(s, mem_dorefresh);
+	SNAPSHOT_VAR(s, mem_romspeed_n);
+	SNAPSHOT_VAR(s, mem_romspeed_s);
+
+	for (c = 0; c < 0x4000; c++)
+	{
+		uint32_t v = MEMPOINT_NULL;
+
+		if (!s->loading && mempoint[c])
+		{
+			uint8_t *host = mempoint[c] + (c << 12);
+
+			if (host >= (uint8_t *)ram && host < (uint8_t *)ram + memsize * 1024)
+				v = MEMPOINT_RAM | (host - (uint8_t *)ram);
+			else if (host >= (uint8_t *)rom && host < (uint8_t *)rom + 0x200000)
+				v = MEMPOINT_ROM | (host - (uint8_t *)rom);
+			else
+			{
+				rpclog("mem_snapshot: page %04x mapped outside RAM/ROM\n", c);
+				s->error = 1;
+			}
+		}
+		SNAPSHOT_VAR(s, v);
+		if (s->loading)
+		{
+			uint32_t offset = v & ~MEMPOINT_TYPE;
+
+			mempoint[c] = NULL;
+			if ((v & MEMPOINT_TYPE) == MEMPOINT_RAM && offset < memsize * 1024)
+				mempoint[c] = (uint8_t *)ram + offset - (c << 12);
+			else if ((v & MEMPOINT_TYPE) == MEMPOINT_ROM && offset < 0x200000)
+				mempoint[c] = (uint8_t *)rom + offset - (c << 12);
+			else if (v != MEMPOINT_NULL)
+				s->error = 1;
+		}
+	}
+
+	if (s->loading)
+		mem_setromspeed(mem_romspeed_n, mem_romspeed_s);
+}
+
 void mem_updatetimings()
 {
 	int c;
@@ -143,6 +294,7 @@ void resizemem(int memsize) /*memsize is 4096,8192,16384*/
 	rpclog("resizemem %i\n", memsize);
 	free(ram);
 	ram=(uint32_t *)malloc(memsize*1024);
+	mem_alloc_page_flags(memsize);
 
 	memset(ram,0,memsize*1024);
 	realmemsize=memsize;
@@ -205,6 +357,7 @@ void resetpagesize(int pagesize)
 			}
 		}
 	}
+	arm_code_remap();
 }
 
 uint32_t readmemf(uint32_t a)
@@ -528,19 +681,40 @@ uint32_t readmemf_debug(uint32_t a)
 	return 0xffffffff;
 }
 
+uint8_t *mem_direct_ptr(uint32_t a, int write, uint32_t *span)
+{
+	uint32_t page = (a >> 12) & 0x3fff;
+
+	a &= 0x3ffffff;
+	*span = 0x1000 - (a & 0xfff);
+
+	if (write ? (debugon || !modepritablew[memmode][memstat[page]]) : !modepritabler[memmode][memstat[page]])
+		return NULL;
+
+	return &mempoint[page][a];
+}
+
 void writememfb_debug(uint32_t a, uint8_t v)
 {
 	a &= 0x3FFFFFF;
 
 	if (mempoint[a >> 12])
+	{
 		mempoint[a >> 12][a] = v;
+		mem_ram_write_check(&mempoint[a >> 12][a]);
+		arm_code_flush(); /*Debugger may patch ROM as well as RAM*/
+	}
 }
 void writememfl_debug(uint32_t a, uint32_t v)
 {
 	a &= 0x3FFFFFC;
 
 	if (mempoint[a >> 12])
+	{
 		*(uint32_t *)&mempoint[a >> 12][a] = v;
+		mem_ram_write_check(&mempoint[a >> 12][a]);
+		arm_code_flush();
+	}
 }
 
 int f42count=0;
@@ -3,6 +3,16 @@ extern uint64_t mem_speed[16384][2];
 void mem_setromspeed(int n, int s);
 void mem_updatetimings();
 
+/*Dirty page tracking for incremental snapshots. ram_dirty holds one bit per
+  physical RAM page, set when the page has been written since the last call to
+  mem_dirty_clear()*/
+extern uint32_t *ram_dirty;
+#define RAM_DIRTY_WORDS ((ram_nr_pages + 31) >> 5)
+
+void mem_dirty_clear(void);
+void mem_dirty_set_all(void);
+int mem_dirty_count(void);
+
 uint32_t readmemf_debug(uint32_t a);
 void writememfb_debug(uint32_t a, uint8_t v);
 void writememfl_debug(uint32_t a, uint32_t v);
@@ -5,10 +5,12 @@ int flybacklines;
 #include <stdio.h>
 #include <string.h>
 #include "arc.h"
+#include "arm.h"
 #include "debugger.h"
 #include "ioc.h"
 #include "mem.h"
 #include "memc.h"
+#include "snapshot.h"
 #include "timer.h"
 #include "vidc.h"
 
@@ -212,6 +214,7 @@ void writecam(uint32_t a)
 //        memcpermissions[logical]=access;
 	memc_cam[page].logical_addr = logical << 12;
 	memc_cam[page].ppl = access;
+	arm_code_remap();
 }
 
 void initmemc()
@@ -225,6 +228,45 @@ void initmemc()
 	}
 }
 
+void memc_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_ARRAY(s, memc_cam);
+	SNAPSHOT_ARRAY(s, memcpages);
+	SNAPSHOT_VAR(s, memctrl);
+	SNAPSHOT_VAR(s, vinit);
+	SNAPSHOT_VAR(s, vstart);
+	SNAPSHOT_VAR(s, vend);
+	SNAPSHOT_VAR(s, cinit);
+	SNAPSHOT_VAR(s, sstart);
+	SNAPSHOT_VAR(s, ssend);
+	SNAPSHOT_VAR(s, sptr);
+	SNAPSHOT_VAR(s, spos);
+	SNAPSHOT_VAR(s, sendN);
+	SNAPSHOT_VAR(s, sstart2);
+	SNAPSHOT_VAR(s, nextvalid);
+
+	SNAPSHOT_VAR(s, memc_dma_sound_req);
+	SNAPSHOT_VAR(s, memc_dma_sound_req_ts);
+	SNAPSHOT_VAR(s, memc_dma_video_req);
+	SNAPSHOT_VAR(s, memc_dma_video_req_ts);
+	SNAPSHOT_VAR(s, memc_dma_video_req_start_ts);
+	SNAPSHOT_VAR(s, memc_dma_video_req_period);
+	SNAPSHOT_VAR(s, memc_dma_cursor_req);
+	SNAPSHOT_VAR(s, memc_dma_cursor_req_ts);
+
+	if (s->loading)
+	{
+		/*Control register state. The memory map itself is restored by
+		  mem_snapshot(), so don't go through resetpagesize()*/
+		osmode = (memctrl & 0x1000) ? 1 : 0;
+		sdmaena = (memctrl & 0x800) ? 1 : 0;
+		pagesize = (memctrl & 0xc) >> 2;
+		memc_videodma_enable = memctrl & 0x400;
+		memc_refreshon = (((memctrl >> 8) & 3) == 1);
+		memc_refresh_always = (((memctrl >> 8) & 3) == 3);
+	}
+}
+
 static const char *page_sizes[4] =
 {
 	"4k", "8k", "16k", "32k"
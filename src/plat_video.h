@@ -6,6 +6,26 @@ void video_renderer_close();
 
 void video_renderer_update(BITMAP *src, int x1, int y1, int x2, int y2, int dest_x, int dest_y);
 void video_renderer_present(int src_x, int src_y, int src_w, int src_h, int dblscan);
+/*Update display texture from indexed bitmap src (see vidc_set_indexed()). Only
+  called by VIDC once the renderer has enabled indexed output. palette holds
+  nr_rows rows of VIDC_PAL_ENTRIES colours, and line_rows the row used by each
+  line of src. h may be 0 if only the palettes have changed*/
+void video_renderer_update_indexed(BITMAP *src, int src_x, int src_y, int dest_x, int dest_y, int w, int h,
+				   const uint32_t *palette, int nr_rows, const uint16_t *line_rows);
+
+/*Frame pacing counters, accumulated since they were last reset*/
+typedef struct video_stats_t
+{
+	uint32_t frames;                  /*Frames presented*/
+	uint32_t late_frames;             /*Frames presented late, see renderer*/
+	uint32_t present_interval_max_us; /*Longest gap between two presents*/
+	uint32_t uploads;                 /*Texture uploads*/
+	uint64_t upload_bytes;            /*Bytes uploaded to textures*/
+	uint64_t upload_us;               /*Host time spent uploading*/
+	uint64_t present_us;              /*Host time spent presenting, including swap*/
+} video_stats_t;
+
+void video_renderer_get_stats(video_stats_t *stats, int reset);
 
 #define RENDERER_AUTO 0
 #define RENDERER_DIRECT3D 1
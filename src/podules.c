@@ -260,6 +260,18 @@ void podules_close(void)
 	}
 }
 
+int podules_in_use(void)
+{
+	int c;
+
+	for (c = 0; c < 4; c++)
+	{
+		if (podules[c].podule.header)
+			return 1;
+	}
+	return 0;
+}
+
 void rethinkpoduleints(void)
 {
 	int c;
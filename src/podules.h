@@ -9,6 +9,8 @@ void podules_init(void);
 void podules_reset(void);
 void podules_close(void);
 void podule_add(const podule_header_t *header);
+/*Non-zero if any podule slot is in use*/
+int podules_in_use(void);
 
 void podule_write_b(int num, uint32_t addr, uint8_t val);
 void podule_write_w(int num, uint32_t addr, uint32_t val);
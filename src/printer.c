@@ -6,6 +6,7 @@
 #include "joystick.h"
 #include "plat_joystick.h"
 #include "printer.h"
+#include "snapshot.h"
 
 void printer_set_busy(int busy);
 void printer_set_ack(int ack);
@@ -152,6 +153,13 @@ static void serial_port_write(uint8_t val)
 static int printer_busy, printer_ack;
 static int printer_irq_pending;
 
+void printer_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, printer_busy);
+	SNAPSHOT_VAR(s, printer_ack);
+	SNAPSHOT_VAR(s, printer_irq_pending);
+}
+
 void printer_set_busy(int busy)
 {
 	if (fdctype != FDC_82C711)
@@ -0,0 +1,202 @@
+/*Arculator 2.2 by Sarah Walker
+  Execution profiler*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arc.h"
+#include "profiler.h"
+
+int profiler_enabled = 0;
+profiler_count_t *profiler_slots = NULL;
+profiler_count_t *profiler_pages = NULL;
+
+static const char *dp_names[16] =
+{
+	"AND", "EOR", "SUB", "RSB", "ADD", "ADC", "SBC", "RSC",
+	"TST", "TEQ", "CMP", "CMN", "ORR", "MOV", "BIC", "MVN"
+};
+
+/*Name of the instruction class handled by an opcode_fns slot*/
+static void profiler_slot_name(int slot, char *s)
+{
+	if (slot < 0x40)
+	{
+		int op = (slot >> 1) & 0xf;
+
+		if (!(slot & 0x20) && (slot & ~1) == 0x00)
+			sprintf(s, "AND%s/MUL%s reg", (slot & 1) ? "S" : "", (slot & 1) ? "S" : "");
+		else if (!(slot & 0x20) && (slot & ~1) == 0x02)
+			sprintf(s, "EOR%s/MLA%s reg", (slot & 1) ? "S" : "", (slot & 1) ? "S" : "");
+		else if (slot == 0x10 || slot == 0x14)
+			strcpy(s, (slot == 0x14) ? "SWPB" : "SWP");
+		else if (op >= 8 && op <= 11 && !(slot & 1))
+			strcpy(s, "undefined");
+		else
+			sprintf(s, "%s%s %s", dp_names[op], (slot & 1) ? "S" : "", (slot & 0x20) ? "imm" : "reg");
+	}
+	else if (slot < 0x80)
+		sprintf(s, "%s%s%s %s", (slot & 1) ? "LDR" : "STR", (slot & 4) ? "B" : "",
+			!(slot & 2) ? "" : (slot & 0x10) ? "!" : "T", (slot & 0x20) ? "reg" : "imm");
+	else if (slot < 0xa0)
+		sprintf(s, "%s%s", (slot & 1) ? "LDM" : "STM", (slot & 4) ? "^" : "");
+	else if (slot < 0xb0)
+		strcpy(s, "B");
+	else if (slot < 0xc0)
+		strcpy(s, "BL");
+	else if (slot < 0xe0)
+		strcpy(s, (slot & 1) ? "LDC" : "STC");
+	else if (slot < 0xf0)
+		strcpy(s, "CDP/MRC/MCR");
+	else
+		strcpy(s, "SWI");
+}
+
+void profiler_clear(void)
+{
+	if (profiler_slots)
+		memset(profiler_slots, 0, PROFILER_SLOTS * sizeof(profiler_count_t));
+	if (profiler_pages)
+		memset(profiler_pages, 0, PROFILER_PAGES * sizeof(profiler_count_t));
+}
+
+int profiler_start(void)
+{
+	if (!profiler_slots)
+	{
+		profiler_slots = calloc(PROFILER_SLOTS, sizeof(profiler_count_t));
+		profiler_pages = calloc(PROFILER_PAGES, sizeof(profiler_count_t));
+		if (!profiler_slots || !profiler_pages)
+		{
+			rpclog("profiler_start: out of memory\n");
+			free(profiler_slots);
+			free(profiler_pages);
+			profiler_slots = profiler_pages = NULL;
+			return -1;
+		}
+	}
+	profiler_enabled = 1;
+	return 0;
+}
+
+void profiler_stop(void)
+{
+	profiler_enabled = 0;
+}
+
+static profiler_count_t *sort_table;
+
+static int profiler_compare(const void *a, const void *b)
+{
+	uint64_t cycles_a = sort_table[*(const int *)a].cycles;
+	uint64_t cycles_b = sort_table[*(const int *)b].cycles;
+
+	if (cycles_a != cycles_b)
+		return (cycles_a < cycles_b) ? 1 : -1;
+	return *(const int *)a - *(const int *)b;
+}
+
+/*Sort table indices by cycles, busiest first*/
+static void profiler_sort(profiler_count_t *table, int *order, int size)
+{
+	int c;
+
+	for (c = 0; c < size; c++)
+		order[c] = c;
+	sort_table = table;
+	qsort(order, size, sizeof(int), profiler_compare);
+}
+
+static uint64_t profiler_total(profiler_count_t *table, int size, uint64_t *count)
+{
+	uint64_t cycles = 0;
+	int c;
+
+	*count = 0;
+	for (c = 0; c < size; c++)
+	{
+		*count += table[c].count;
+		cycles += table[c].cycles;
+	}
+
+	return cycles;
+}
+
+void profiler_print(void (*out)(char *s), int nr_entries)
+{
+	static int order[PROFILER_PAGES];
+	uint64_t total_count, total_cycles;
+	char s[256], name[32];
+	int c;
+
+	if (!profiler_slots)
+	{
+		out("    Profiler has not been started\n");
+		return;
+	}
+
+	total_cycles = profiler_total(profiler_slots, PROFILER_SLOTS, &total_count);
+	sprintf(s, "    Profiler %s : %llu instructions, %llu cycles\n", profiler_enabled ? "running" : "stopped",
+		(unsigned long long)total_count, (unsigned long long)(total_cycles >> 16));
+	out(s);
+	if (!total_cycles)
+		return;
+
+	out("\n    Slot  Class               Count       Cycles  %Cyc  Cyc/ins\n");
+	profiler_sort(profiler_slots, order, PROFILER_SLOTS);
+	for (c = 0; c < nr_entries && c < PROFILER_SLOTS && profiler_slots[order[c]].count; c++)
+	{
+		profiler_count_t *p = &profiler_slots[order[c]];
+
+		profiler_slot_name(order[c], name);
+		sprintf(s, "    %02X    %-16s %10llu %12llu %5.1f %8.2f\n", order[c], name,
+			(unsigned long long)p->count, (unsigned long long)(p->cycles >> 16),
+			(p->cycles * 100.0) / total_cycles, (p->cycles / 65536.0) / p->count);
+		out(s);
+	}
+
+	out("\n    Page                       Count       Cycles  %Cyc  Cyc/ins\n");
+	profiler_sort(profiler_pages, order, PROFILER_PAGES);
+	for (c = 0; c < nr_entries && profiler_pages[order[c]].count; c++)
+	{
+		profiler_count_t *p = &profiler_pages[order[c]];
+
+		sprintf(s, "    %07X                 %10llu %12llu %5.1f %8.2f\n", order[c] << 12,
+			(unsigned long long)p->count, (unsigned long long)(p->cycles >> 16),
+			(p->cycles * 100.0) / total_cycles, (p->cycles / 65536.0) / p->count);
+		out(s);
+	}
+}
+
+int profiler_save(const char *fn)
+{
+	char name[32];
+	FILE *f;
+	int c;
+
+	if (!profiler_slots)
+		return -1;
+
+	f = fopen(fn, "wt");
+	if (!f)
+		return -1;
+
+	fprintf(f, "# type,index,name,count,cycles\n");
+	for (c = 0; c < PROFILER_SLOTS; c++)
+	{
+		if (profiler_slots[c].count)
+		{
+			profiler_slot_name(c, name);
+			fprintf(f, "slot,%02X,%s,%llu,%llu\n", c, name,
+				(unsigned long long)profiler_slots[c].count, (unsigned long long)(profiler_slots[c].cycles >> 16));
+		}
+	}
+	for (c = 0; c < PROFILER_PAGES; c++)
+	{
+		if (profiler_pages[c].count)
+			fprintf(f, "page,%07X,,%llu,%llu\n", c << 12,
+				(unsigned long long)profiler_pages[c].count, (unsigned long long)(profiler_pages[c].cycles >> 16));
+	}
+
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+/*Execution profiler.
+
+  While enabled, every instruction issued on the exact interpreter path is
+  counted against its opcode_fns slot (bits 20-27 of the opcode) and against
+  the 4kb page of the 26-bit address space it was fetched from, along with the
+  TSC time it took including memory and DMA stalls. execarm() only takes the
+  exact path while profiling, so the batch and threaded cores carry no
+  profiling code at all.*/
+typedef struct profiler_count_t
+{
+	uint64_t count;
+	uint64_t cycles; /*CPU cycles, 16.16 fixed point*/
+} profiler_count_t;
+
+#define PROFILER_SLOTS 256
+#define PROFILER_PAGES 0x4000
+
+extern int profiler_enabled;
+extern profiler_count_t *profiler_slots;
+extern profiler_count_t *profiler_pages;
+
+/*Start counting. Returns non-zero, leaving the profiler disabled, if the
+  tables can't be allocated*/
+int profiler_start(void);
+void profiler_stop(void);
+void profiler_clear(void);
+/*Print the busiest slots and pages through out()*/
+void profiler_print(void (*out)(char *s), int nr_entries);
+/*Write every non-zero slot and page to a text file. Returns 0 on success*/
+int profiler_save(const char *fn);
+
+static inline void profiler_record(uint32_t addr, uint32_t opcode, uint64_t tsc_delta)
+{
+	profiler_count_t *slot = &profiler_slots[(opcode >> 20) & 0xff];
+	profiler_count_t *page = &profiler_pages[(addr >> 12) & (PROFILER_PAGES-1)];
+
+	slot->count++;
+	slot->cycles += tsc_delta >> 16;
+	page->count++;
+	page->cycles += tsc_delta >> 16;
+}
+
+#endif /*_PROFILER_H_*/
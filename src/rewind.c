@@ -0,0 +1,265 @@
+/*Arculator 2.2 by Sarah Walker
+  Rewind history*/
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "arc.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "vidc.h"
+
+/*History is a ring of snapshot checkpoints, each held zlib compressed. Most
+  are incremental, holding only the RAM pages written since the previous one,
+  with a full checkpoint (keyframe) starting each group. A new group is started
+  once the increments in the current group take up as much space as its
+  keyframe, which bounds both the memory overhead of keyframes and the number of
+  increments that have to be replayed on a rewind.
+
+  When the history exceeds the memory budget, the oldest group is discarded as
+  a whole, so the oldest checkpoint held is always a keyframe.
+
+  Checkpoints are taken between arc_run() slices rather than from inside the
+  VIDC flyback callback, as the machine state is only consistent outside of
+  timer callbacks.*/
+#define REWIND_MAX_CHECKPOINTS 4096
+
+typedef struct rewind_checkpoint_t
+{
+	uint8_t *data;
+	uint32_t size;
+	uint32_t uncompressed_size;
+	uint32_t id;
+	uint64_t time_ms;
+	int full;
+} rewind_checkpoint_t;
+
+int rewind_memory_mb;
+int rewind_interval;
+
+static rewind_checkpoint_t checkpoints[REWIND_MAX_CHECKPOINTS];
+static int first, count;
+static size_t total_size;
+/*Compressed size of the newest keyframe, and of the increments after it*/
+static uint32_t keyframe_size, group_size;
+
+static uint64_t time_ms;
+static int last_framecount;
+static int checkpoint_failed;
+
+static snapshot_t work;
+static uint8_t *compress_buffer;
+static uLongf compress_buffer_size;
+
+#define CHECKPOINT(i) (&checkpoints[(first + (i)) % REWIND_MAX_CHECKPOINTS])
+
+static void rewind_free_checkpoint(rewind_checkpoint_t *cp)
+{
+	total_size -= cp->size;
+	free(cp->data);
+	cp->data = NULL;
+}
+
+/*Discard the oldest group of checkpoints*/
+static void rewind_drop_oldest(void)
+{
+	do
+	{
+		rewind_free_checkpoint(CHECKPOINT(0));
+		first = (first + 1) % REWIND_MAX_CHECKPOINTS;
+		count--;
+	} while (count && !CHECKPOINT(0)->full);
+}
+
+/*Discard every checkpoint after the given one*/
+static void rewind_truncate(int newest)
+{
+	while (count > newest + 1)
+	{
+		rewind_free_checkpoint(CHECKPOINT(count - 1));
+		count--;
+	}
+}
+
+void rewind_reset(void)
+{
+	rewind_truncate(-1);
+	first = 0;
+	keyframe_size = group_size = 0;
+	time_ms = 0;
+	last_framecount = vidc_framecount;
+	checkpoint_failed = 0;
+}
+
+void rewind_close(void)
+{
+	rewind_reset();
+	snapshot_free(&work);
+	free(compress_buffer);
+	compress_buffer = NULL;
+	compress_buffer_size = 0;
+}
+
+/*Take a checkpoint into work and compress it into compress_buffer. Returns the
+  compressed size, or 0 on failure*/
+static uLongf rewind_take(int full)
+{
+	uLongf size;
+
+	if (snapshot_checkpoint(&work, full))
+	{
+		/*Most likely podules in use - don't keep trying every frame*/
+		rpclog("rewind_checkpoint: failed, rewind disabled until reset\n");
+		checkpoint_failed = 1;
+		return 0;
+	}
+
+	size = compressBound(work.size);
+	if (size > compress_buffer_size)
+	{
+		free(compress_buffer);
+		compress_buffer = malloc(size);
+		compress_buffer_size = size;
+	}
+	if (compress2(compress_buffer, &size, work.data, work.size, Z_BEST_SPEED) != Z_OK)
+	{
+		rpclog("rewind_checkpoint: compress failed\n");
+		return 0;
+	}
+
+	return size;
+}
+
+static void rewind_checkpoint(void)
+{
+	rewind_checkpoint_t *cp;
+	uLongf size;
+	int full;
+
+	/*Make room first, as that can discard the group this checkpoint would
+	  otherwise have been an increment to*/
+	if (count == REWIND_MAX_CHECKPOINTS)
+		rewind_drop_oldest();
+
+	/*Start a new group if the current one has grown too large, or if RAM is
+	  no longer being tracked against the newest checkpoint held (eg after a
+	  snapshot has been loaded)*/
+	full = !count || group_size >= keyframe_size ||
+		CHECKPOINT(count - 1)->id != snapshot_checkpoint_id();
+
+	size = rewind_take(full);
+	if (!size)
+		return;
+
+	while (count && total_size + size > (size_t)rewind_memory_mb * 1024 * 1024)
+		rewind_drop_oldest();
+
+	/*The oldest checkpoint held must be a keyframe, so if the budget meant
+	  discarding everything, take this one again in full*/
+	if (!count && !full)
+	{
+		full = 1;
+		size = rewind_take(full);
+		if (!size)
+			return;
+	}
+
+	cp = CHECKPOINT(count);
+	cp->data = malloc(size);
+	memcpy(cp->data, compress_buffer, size);
+	cp->size = size;
+	cp->uncompressed_size = work.size;
+	cp->id = work.id;
+	cp->time_ms = time_ms;
+	cp->full = full;
+	count++;
+	total_size += size;
+
+	if (full)
+	{
+		keyframe_size = size;
+		group_size = 0;
+	}
+	else
+		group_size += size;
+}
+
+void rewind_poll(int millisecs)
+{
+	time_ms += millisecs;
+
+	if (!rewind_memory_mb || checkpoint_failed)
+		return;
+
+	if (vidc_framecount - last_framecount >= rewind_interval)
+	{
+		last_framecount = vidc_framecount;
+		rewind_checkpoint();
+	}
+}
+
+static int rewind_load(rewind_checkpoint_t *cp)
+{
+	uLongf size = cp->uncompressed_size;
+
+	if (work.alloc < size)
+	{
+		free(work.data);
+		work.data = malloc(size);
+		work.alloc = size;
+	}
+	if (uncompress(work.data, &size, cp->data, cp->size) != Z_OK || size != cp->uncompressed_size)
+		return -1;
+	work.size = size;
+
+	return snapshot_load(&work);
+}
+
+int rewind_by(int time_ms_back)
+{
+	uint64_t target = (time_ms_back < time_ms) ? time_ms - time_ms_back : 0;
+	int newest, keyframe, c;
+	int old_soundena = soundena;
+
+	if (!count || time_ms_back < 0)
+		return -1;
+
+	/*Find the newest checkpoint at or before the target, and the keyframe
+	  that starts its group*/
+	for (newest = count - 1; newest > 0; newest--)
+	{
+		if (CHECKPOINT(newest)->time_ms <= target)
+			break;
+	}
+	for (keyframe = newest; keyframe > 0 && !CHECKPOINT(keyframe)->full; keyframe--)
+		;
+
+	for (c = keyframe; c <= newest; c++)
+	{
+		if (rewind_load(CHECKPOINT(c)))
+		{
+			rpclog("rewind_by: failed to load checkpoint %i\n", c);
+			rewind_reset();
+			return -1;
+		}
+	}
+	rewind_truncate(newest);
+	group_size = 0;
+	for (c = newest; c > 0 && !CHECKPOINT(c)->full; c--)
+		group_size += CHECKPOINT(c)->size;
+	keyframe_size = CHECKPOINT(c)->size;
+
+	/*Run forward silently from the checkpoint to the requested time*/
+	time_ms = CHECKPOINT(newest)->time_ms;
+	if (target > time_ms)
+	{
+		soundena = 0;
+		execarm(speed_mhz * 1000 * (int)(target - time_ms));
+		soundena = old_soundena;
+		time_ms = target;
+	}
+	last_framecount = vidc_framecount;
+
+	rpclog("rewind_by: %i ms, restored checkpoint at %llu ms (%i checkpoints, %u kB held)\n",
+		time_ms_back, (unsigned long long)CHECKPOINT(newest)->time_ms, count, (unsigned)(total_size >> 10));
+	return 0;
+}
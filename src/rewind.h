@@ -0,0 +1,19 @@
+#ifndef _REWIND_H_
+#define _REWIND_H_
+
+/*Memory budget for rewind history, in megabytes. 0 disables rewind*/
+extern int rewind_memory_mb;
+/*Number of frames between rewind checkpoints*/
+extern int rewind_interval;
+
+/*Discard all rewind history*/
+void rewind_reset(void);
+void rewind_close(void);
+/*Called after every arc_run() slice, with the emulated time just run. Takes a
+  checkpoint if rewind_interval frames have passed since the last one*/
+void rewind_poll(int millisecs);
+/*Return the machine to its state time_ms ago (or the oldest state held if
+  that is further back than the history). Returns 0 on success*/
+int rewind_by(int time_ms);
+
+#endif /*_REWIND_H_*/
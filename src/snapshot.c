@@ -0,0 +1,390 @@
+/*Arculator 2.2 by Sarah Walker
+  Machine snapshot save/restore*/
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "arc.h"
+#include "arm.h"
+#include "config.h"
+#include "ide.h"
+#include "mem.h"
+#include "memc.h"
+#include "podules.h"
+#include "snapshot.h"
+#include "st506.h"
+
+#define SNAPSHOT_MAGIC 0x53435241 /*'ARCS'*/
+
+/*Snapshot layout :
+	uint32 magic
+	uint32 version
+	uint32 config[8] - must match the running machine
+	uint32 id        - checkpoint ID, or 0
+	uint32 base_id   - checkpoint an incremental snapshot applies to, or 0
+  followed by sections of
+	uint32 tag
+	uint32 length
+	uint8  data[length]
+  All values are stored little endian, in host layout.*/
+enum
+{
+	CONFIG_MEMSIZE = 0,
+	CONFIG_MACHINE_TYPE,
+	CONFIG_CPU,
+	CONFIG_MEMC,
+	CONFIG_FDC,
+	CONFIG_ST506,
+	CONFIG_FPA,
+	CONFIG_ROM_CRC,
+
+	CONFIG_MAX
+};
+
+/*Checkpoint that RAM writes are currently being tracked against, or 0*/
+static uint32_t checkpoint_id;
+static uint32_t checkpoint_next_id = 1;
+
+static int snapshot_reserve(snapshot_t *s, uint32_t len)
+{
+	if (len > s->alloc - s->size)
+	{
+		uint32_t new_alloc = s->alloc ? s->alloc : 0x10000;
+		uint8_t *new_data;
+
+		while (len > new_alloc - s->size)
+			new_alloc *= 2;
+		new_data = realloc(s->data, new_alloc);
+		if (!new_data)
+		{
+			s->error = 1;
+			return -1;
+		}
+		s->data = new_data;
+		s->alloc = new_alloc;
+	}
+	return 0;
+}
+
+void snapshot_data(snapshot_t *s, void *p, uint32_t len)
+{
+	if (s->loading)
+	{
+		if (s->error || len > s->size - s->pos)
+		{
+			s->error = 1;
+			memset(p, 0, len);
+			return;
+		}
+		memcpy(p, &s->data[s->pos], len);
+	}
+	else
+	{
+		if (s->error || snapshot_reserve(s, len))
+			return;
+		memcpy(&s->data[s->pos], p, len);
+		s->size += len;
+	}
+	s->pos += len;
+}
+
+void snapshot_section_begin(snapshot_t *s, const char *tag)
+{
+	uint32_t expected_tag = tag[0] | (tag[1] << 8) | (tag[2] << 16) | (tag[3] << 24);
+	uint32_t saved_tag = expected_tag;
+	uint32_t len = 0;
+
+	SNAPSHOT_VAR(s, saved_tag);
+	s->section_start = s->pos;
+	SNAPSHOT_VAR(s, len);
+
+	if (s->loading && !s->error)
+	{
+		if (saved_tag != expected_tag || len > s->size - s->pos)
+		{
+			rpclog("snapshot: bad section, expected %.4s\n", tag);
+			s->error = 1;
+		}
+		s->section_end = s->pos + len;
+	}
+}
+
+void snapshot_section_end(snapshot_t *s)
+{
+	if (s->error)
+		return;
+
+	if (s->loading)
+	{
+		if (s->pos != s->section_end)
+		{
+			rpclog("snapshot: section length mismatch (%u read, %u stored)\n",
+				s->pos - s->section_start - 4, s->section_end - s->section_start - 4);
+			s->error = 1;
+		}
+	}
+	else
+	{
+		uint32_t len = s->pos - s->section_start - 4;
+
+		memcpy(&s->data[s->section_start], &len, 4);
+	}
+}
+
+void snapshot_free(snapshot_t *s)
+{
+	free(s->data);
+	memset(s, 0, sizeof(snapshot_t));
+}
+
+static void snapshot_section(snapshot_t *s, const char *tag, void (*snapshot)(snapshot_t *s))
+{
+	if (s->error)
+		return;
+	snapshot_section_begin(s, tag);
+	if (s->error)
+		return;
+	snapshot(s);
+	snapshot_section_end(s);
+}
+
+static void snapshot_header(snapshot_t *s)
+{
+	uint32_t magic = SNAPSHOT_MAGIC;
+	uint32_t version = SNAPSHOT_VERSION;
+	uint32_t config[CONFIG_MAX], saved_config[CONFIG_MAX];
+
+	config[CONFIG_MEMSIZE] = memsize;
+	config[CONFIG_MACHINE_TYPE] = machine_type;
+	config[CONFIG_CPU] = arm_cpu_type;
+	config[CONFIG_MEMC] = memc_type;
+	config[CONFIG_FDC] = fdctype;
+	config[CONFIG_ST506] = st506_present;
+	config[CONFIG_FPA] = fpaena;
+	config[CONFIG_ROM_CRC] = crc32(0, (const Bytef *)rom, 0x200000);
+	memcpy(saved_config, config, sizeof(config));
+
+	SNAPSHOT_VAR(s, magic);
+	SNAPSHOT_VAR(s, version);
+	if (s->loading && (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION))
+	{
+		rpclog("snapshot: not a snapshot, or unsupported version %u\n", version);
+		s->error = 1;
+		return;
+	}
+	SNAPSHOT_ARRAY(s, saved_config);
+	if (s->loading && memcmp(config, saved_config, sizeof(config)))
+	{
+		rpclog("snapshot: machine configuration does not match\n");
+		s->error = 1;
+		return;
+	}
+	SNAPSHOT_VAR(s, s->id);
+	SNAPSHOT_VAR(s, s->base_id);
+	/*An incremental snapshot is only valid if RAM still holds exactly the
+	  checkpoint it was taken against*/
+	if (s->loading && s->base_id && (s->base_id != checkpoint_id || mem_dirty_count()))
+	{
+		rpclog("snapshot: incremental snapshot does not apply to current state (base %u, current %u, %i dirty pages)\n",
+			s->base_id, checkpoint_id, mem_dirty_count());
+		s->error = 1;
+	}
+}
+
+/*Check section framing, so that truncated or corrupt snapshots are rejected
+  before any machine state is modified*/
+static int snapshot_check_sections(snapshot_t *s)
+{
+	uint32_t pos = s->pos;
+
+	while (pos < s->size)
+	{
+		uint32_t len;
+
+		if (s->size - pos < 8)
+			return -1;
+		memcpy(&len, &s->data[pos + 4], 4);
+		pos += 8;
+		if (len > s->size - pos)
+			return -1;
+		pos += len;
+	}
+
+	return 0;
+}
+
+static void snapshot_ide(snapshot_t *s)
+{
+	ide_snapshot(s, &ide_internal);
+}
+
+static void snapshot_machine(snapshot_t *s)
+{
+	/*Timer state must come first. Memory must be loaded before MEMC, and
+	  MEMC before the CPU*/
+	snapshot_section(s, "TIMR", timer_snapshot_state);
+	snapshot_section(s, "MEM ", mem_snapshot);
+	snapshot_section(s, "MEMC", memc_snapshot);
+	snapshot_section(s, "ARM ", arm_snapshot);
+	snapshot_section(s, "CP15", cp15_snapshot);
+	snapshot_section(s, "FPA ", fpa_snapshot);
+	snapshot_section(s, "IOC ", ioc_snapshot);
+	snapshot_section(s, "VIDC", vidc_snapshot);
+	snapshot_section(s, "SND ", sound_snapshot);
+	snapshot_section(s, "KBD ", keyboard_snapshot);
+	snapshot_section(s, "CMOS", cmos_snapshot);
+	snapshot_section(s, "DS24", ds2401_snapshot);
+	snapshot_section(s, "IOEB", ioeb_snapshot);
+	snapshot_section(s, "PRN ", printer_snapshot);
+	if (machine_type == MACHINE_TYPE_A4)
+		snapshot_section(s, "LC  ", lc_snapshot);
+	snapshot_section(s, "DISC", disc_snapshot);
+	snapshot_section(s, "DDN ", ddnoise_snapshot);
+	if (fdctype == FDC_82C711)
+		snapshot_section(s, "FDC ", c82c711_fdc_snapshot);
+	else
+		snapshot_section(s, "FDC ", wd1770_snapshot);
+	snapshot_section(s, "SIO ", c82c711_snapshot);
+	snapshot_section(s, "IDE ", snapshot_ide);
+	if ((fdctype != FDC_82C711) && st506_present)
+		snapshot_section(s, "HDC ", st506_internal_snapshot);
+}
+
+int snapshot_save(snapshot_t *s)
+{
+	if (podules_in_use())
+	{
+		rpclog("snapshot_save: podule state can not be saved\n");
+		return -1;
+	}
+
+	s->loading = 0;
+	s->error = 0;
+	s->incremental = 0;
+	s->id = s->base_id = 0;
+	s->pos = s->size = 0;
+
+	snapshot_header(s);
+	snapshot_machine(s);
+
+	return s->error ? -1 : 0;
+}
+
+int snapshot_checkpoint(snapshot_t *s, int full)
+{
+	if (podules_in_use())
+	{
+		rpclog("snapshot_checkpoint: podule state can not be saved\n");
+		return -1;
+	}
+
+	s->loading = 0;
+	s->error = 0;
+	s->incremental = !full && checkpoint_id;
+	s->id = checkpoint_next_id++;
+	s->base_id = s->incremental ? checkpoint_id : 0;
+	s->pos = s->size = 0;
+
+	snapshot_header(s);
+	snapshot_machine(s);
+	if (s->error)
+		return -1;
+
+	checkpoint_id = s->id;
+	mem_dirty_clear();
+	return 0;
+}
+
+uint32_t snapshot_checkpoint_id(void)
+{
+	return checkpoint_id;
+}
+
+int snapshot_load(snapshot_t *s)
+{
+	if (podules_in_use())
+	{
+		rpclog("snapshot_load: podule state can not be loaded\n");
+		return -1;
+	}
+
+	s->loading = 1;
+	s->error = 0;
+	s->pos = 0;
+
+	snapshot_header(s);
+	if (s->error || snapshot_check_sections(s))
+	{
+		rpclog("snapshot_load: snapshot rejected\n");
+		return -1;
+	}
+
+	snapshot_machine(s);
+	if (s->error || s->pos != s->size)
+	{
+		rpclog("snapshot_load: load failed at %u/%u, resetting\n", s->pos, s->size);
+		arc_reset();
+		return -1;
+	}
+
+	/*RAM now matches the loaded snapshot, so track writes from here. A plain
+	  snapshot gets a fresh ID so later checkpoints can be based on it*/
+	checkpoint_id = s->id ? s->id : checkpoint_next_id++;
+	mem_dirty_clear();
+	return 0;
+}
+
+int snapshot_save_file(const char *fn)
+{
+	snapshot_t s;
+	gzFile f;
+	int ret = -1;
+
+	memset(&s, 0, sizeof(s));
+	if (!snapshot_save(&s))
+	{
+		f = gzopen(fn, "wb");
+		if (f)
+		{
+			if (gzwrite(f, s.data, s.size) == (int)s.size)
+				ret = 0;
+			if (gzclose(f) != Z_OK)
+				ret = -1;
+		}
+	}
+	rpclog("snapshot_save_file: %s, %u bytes - %s\n", fn, s.size, ret ? "failed" : "ok");
+	snapshot_free(&s);
+
+	return ret;
+}
+
+int snapshot_load_file(const char *fn)
+{
+	snapshot_t s;
+	gzFile f;
+	int ret = -1;
+	int len;
+
+	memset(&s, 0, sizeof(s));
+	f = gzopen(fn, "rb");
+	if (!f)
+	{
+		rpclog("snapshot_load_file: can't open %s\n", fn);
+		return -1;
+	}
+	do
+	{
+		if (snapshot_reserve(&s, 0x10000))
+			break;
+		len = gzread(f, &s.data[s.size], s.alloc - s.size);
+		if (len > 0)
+			s.size += len;
+	} while (len > 0);
+	gzclose(f);
+
+	if (!s.error && !len)
+		ret = snapshot_load(&s);
+	rpclog("snapshot_load_file: %s, %u bytes - %s\n", fn, s.size, ret ? "failed" : "ok");
+	snapshot_free(&s);
+
+	return ret;
+}
@@ -0,0 +1,112 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+/*Machine snapshots.
+
+  A snapshot is a series of tagged sections, one per emulated device, held in a
+  memory buffer. Each device provides a single xxx_snapshot() function that is
+  used for both saving and loading - every field is passed through
+  snapshot_data() (or one of the wrappers below), which either appends it to
+  the buffer or fills it in from the buffer depending on s->loading. Any
+  fix-ups needed after loading (remapping memory, rebuilding lookup tables
+  etc) are done in the same function under `if (s->loading)`.
+
+  Snapshots only capture machine state. The configuration (machine type, CPU,
+  memory size, ROM set) must match between saving and loading, and is checked
+  against the snapshot header. Disc and hard disc image contents are not
+  stored.
+
+  Checkpoints support incremental snapshots. Each checkpoint has an ID, and
+  RAM writes are tracked from the most recent one (see mem_dirty_clear()). An
+  incremental checkpoint stores only the RAM pages written since the previous
+  checkpoint, and can only be loaded on top of that checkpoint - ie straight
+  after loading it (or the chain of checkpoints leading to it), before the
+  machine has run. Everything other than RAM is always stored in full.*/
+
+/*Increment whenever the layout of any section changes*/
+#define SNAPSHOT_VERSION 3
+
+struct emu_timer_t;
+struct ide_t;
+struct st506_t;
+
+typedef struct snapshot_t
+{
+	uint8_t *data;
+	uint32_t size;
+	uint32_t alloc;
+	uint32_t pos;
+
+	int loading;
+	int error;
+	/*Only store RAM pages written since the last checkpoint*/
+	int incremental;
+	/*Checkpoint ID of this snapshot (0 if not a checkpoint), and the
+	  checkpoint an incremental snapshot is relative to*/
+	uint32_t id;
+	uint32_t base_id;
+
+	uint32_t section_start;
+	uint32_t section_end;
+} snapshot_t;
+
+void snapshot_data(snapshot_t *s, void *p, uint32_t len);
+void snapshot_section_begin(snapshot_t *s, const char *tag);
+void snapshot_section_end(snapshot_t *s);
+void snapshot_free(snapshot_t *s);
+
+#define SNAPSHOT_VAR(s, v)          snapshot_data(s, &(v), sizeof(v))
+#define SNAPSHOT_ARRAY(s, a)        snapshot_data(s, (a), sizeof(a))
+/*Structure members from the start of the structure up to (but not including)
+  member m - used for device structures that end in timers and host pointers*/
+#define SNAPSHOT_STRUCT_TO(s, st, m) snapshot_data(s, &(st), (uint32_t)((uint8_t *)&(st).m - (uint8_t *)&(st)))
+
+/*Save the whole machine state to s. Returns 0 on success*/
+int snapshot_save(snapshot_t *s);
+/*Restore the whole machine state from s. Returns 0 on success. On failure the
+  machine state is undefined and should be reset*/
+int snapshot_load(snapshot_t *s);
+
+/*Save the machine state to s as a new checkpoint, and start tracking RAM
+  writes from it. If full is 0 only RAM pages written since the previous
+  checkpoint are stored. Returns 0 on success*/
+int snapshot_checkpoint(snapshot_t *s, int full);
+/*ID of the checkpoint RAM writes are currently tracked against, or 0*/
+uint32_t snapshot_checkpoint_id(void);
+
+/*Save/load a compressed snapshot file. Returns 0 on success*/
+int snapshot_save_file(const char *fn);
+int snapshot_load_file(const char *fn);
+
+/*Global timer state (TSC and enable order). Must be the first section loaded,
+  as it empties the timer queue*/
+void timer_snapshot_state(snapshot_t *s);
+/*Individual timer. Every timer that is present in the running machine must be
+  passed through here, or it will be left disabled after a load*/
+void timer_snapshot(snapshot_t *s, struct emu_timer_t *timer);
+
+/*Device sections*/
+void arm_snapshot(snapshot_t *s);
+void cp15_snapshot(snapshot_t *s);
+void fpa_snapshot(snapshot_t *s);
+void mem_snapshot(snapshot_t *s);
+void memc_snapshot(snapshot_t *s);
+void ioc_snapshot(snapshot_t *s);
+void vidc_snapshot(snapshot_t *s);
+void sound_snapshot(snapshot_t *s);
+void keyboard_snapshot(snapshot_t *s);
+void cmos_snapshot(snapshot_t *s);
+void ds2401_snapshot(snapshot_t *s);
+void ioeb_snapshot(snapshot_t *s);
+void lc_snapshot(snapshot_t *s);
+void printer_snapshot(snapshot_t *s);
+void disc_snapshot(snapshot_t *s);
+void ddnoise_snapshot(snapshot_t *s);
+void wd1770_snapshot(snapshot_t *s);
+void c82c711_snapshot(snapshot_t *s);
+void c82c711_fdc_snapshot(snapshot_t *s);
+void ide_snapshot(snapshot_t *s, struct ide_t *ide);
+void st506_snapshot(snapshot_t *s, struct st506_t *st506);
+void st506_internal_snapshot(snapshot_t *s);
+
+#endif /*_SNAPSHOT_H_*/
@@ -8,6 +8,7 @@
 #include "ioc.h"
 #include "memc.h"
 #include "plat_sound.h"
+#include "snapshot.h"
 #include "sound.h"
 #include "timer.h"
 
@@ -119,7 +120,7 @@ static void update_sound(int end_sample)
 
 	if (sound_first_poll)
 		return;
-	if (!soundena)
+	if (!soundena || turbo_mode)
 		return;
 
 //        rpclog("mixsound: samp_fp=%i samp_wp=%i samp_rp=%i %08x %08x\n", samp_fp, samp_wp, (samp_rp >> 15) * 2, samp_rp, SAMP_INC);
@@ -150,7 +151,7 @@ static void pollsound_100ms(void *p)
 		sound_first_poll = 0;
 
 	sound_write_ptr = 0;
-	if (soundena)
+	if (soundena && !turbo_mode)
 		sound_givebuffer(sound_out_buffer);
 //        rpclog("          samp_fp=%i samp_wp=%i samp_rp=%i %08x %08x\n", samp_fp, samp_wp, (samp_rp >> 15) * 2, samp_rp, SAMP_INC);
 }
@@ -207,7 +208,7 @@ static void pollsound(void *p)
 		memset(in_samples, 0, 16);
 
 	/*Upsample to VIDC frequency buffer*/
-	for (c = 0; c < 16; c++)
+	for (c = 0; c < 16 && !turbo_mode; c++)
 	{
 		int d;
 		int16_t sample_l, sample_r;
@@ -243,6 +244,31 @@ static void pollsound(void *p)
 	}
 }
 
+void sound_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_ARRAY(s, stereoimages);
+	SNAPSHOT_VAR(s, stereo);
+	SNAPSHOT_VAR(s, sound_timer_base_period);
+	SNAPSHOT_VAR(s, sample_period);
+	SNAPSHOT_VAR(s, sample_16_time);
+	SNAPSHOT_VAR(s, sound_clock_mhz);
+	SNAPSHOT_VAR(s, SAMP_INC);
+	timer_snapshot(s, &sound_timer);
+	timer_snapshot(s, &sound_timer_100ms);
+
+	if (s->loading)
+	{
+		/*Buffered output isn't stored - restart output from silence*/
+		memset(sound_in_buffer, 0, sizeof(sound_in_buffer));
+		sound_first_poll = 1;
+		sound_write_ptr = 0;
+		samp_rp = 0xff000000;
+		samp_wp = 0;
+		samp_fp = 0;
+		iir_gen_coefficients(sound_clock_mhz, filter_freqs[sound_filter], ACoef, BCoef);
+	}
+}
+
 static signed short convbyte(uint8_t v)
 {
 	int sign, point, chord;
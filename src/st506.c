@@ -6,6 +6,7 @@
 #include "arc.h"
 #include "config.h"
 #include "ioc.h"
+#include "snapshot.h"
 #include "st506.h"
 #include "timer.h"
 
@@ -38,11 +39,11 @@ void st506_init(st506_t *st506,
 	st506->rp = st506->wp = 0;
 	st506->drq = 0;
 	st506->first = 0;
-	st506->hdfile[0] = fopen(fn_pri, "rb+");
+	st506->hdfile[0] = blockdev_open(fn_pri, "rb+");
 	st506->spt[0] = pri_spt;
 	st506->hpc[0] = pri_hpc;
 	st506->cyl[0] = pri_cyl;
-	st506->hdfile[1] = fopen(fn_sec, "rb+");
+	st506->hdfile[1] = blockdev_open(fn_sec, "rb+");
 	st506->spt[1] = sec_spt;
 	st506->hpc[1] = sec_hpc;
 	st506->cyl[1] = sec_cyl;
@@ -51,12 +52,51 @@ void st506_init(st506_t *st506,
 	st506->irq_clear = irq_clear;
 	st506->p = p;
 }
+void st506_snapshot(snapshot_t *s, st506_t *st506)
+{
+	uint64_t pos[2] = {0, 0};
+	int c;
+
+	SNAPSHOT_STRUCT_TO(s, *st506, timer);
+	timer_snapshot(s, &st506->timer);
+	SNAPSHOT_ARRAY(s, st506->buffer);
+
+	/*Multi-sector transfers seek once and then carry on from the image
+	  position, so that has to be restored too*/
+	for (c = 0; c < 2; c++)
+	{
+		if (!s->loading && st506->hdfile[c])
+			pos[c] = blockdev_tell(st506->hdfile[c]);
+	}
+	SNAPSHOT_ARRAY(s, pos);
+	if (s->loading)
+	{
+		for (c = 0; c < 2; c++)
+		{
+			if (st506->hdfile[c])
+				blockdev_seek(st506->hdfile[c], pos[c]);
+		}
+	}
+}
+
 void st506_close(st506_t *st506)
 {
-	if (st506->hdfile[0])
-		fclose(st506->hdfile[0]);
-	if (st506->hdfile[1])
-		fclose(st506->hdfile[1]);
+	int c;
+
+	for (c = 0; c < 2; c++)
+	{
+		if (st506->hdfile[c])
+		{
+			blockdev_stats_t stats;
+
+			blockdev_get_stats(st506->hdfile[c], &stats);
+			rpclog("ST506 drive %i: %llu cache hits, %llu misses, %llu reads, %llu writes\n", c,
+				(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+				(unsigned long long)stats.reads, (unsigned long long)stats.writes);
+			blockdev_close(st506->hdfile[c]);
+			st506->hdfile[c] = NULL;
+		}
+	}
 }
 
 static void st506_updateinterrupts(st506_t *st506)
@@ -263,7 +303,7 @@ void st506_writel(st506_t *st506, uint32_t a, uint32_t v)
 			rpclog("Read data : cylinder %i head %i sector %i   length %i sectors\n",st506->lcyl,st506->lhead,st506->lsect,st506->oplen);
 			if (check_chs_params(st506, st506->drive))
 				return;
-			fseek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256), SEEK_SET);
+			blockdev_seek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256));
 //                        rpclog("Seeked to %08X\n",(((((st506->lcyl*8)+st506->lhead)*32)+st506->lsect)*256));
 			timer_set_delay_u64(&st506->timer, CMD_DELAY_US * TIMER_USEC);
 			st506->status |= 0x80;
@@ -290,7 +330,7 @@ void st506_writel(st506_t *st506, uint32_t a, uint32_t v)
 			rpclog("Check data : cylinder %i head %i sector %i   length %i sectors\n",st506->lcyl,st506->lhead,st506->lsect,st506->oplen);
 			if (check_chs_params(st506, st506->drive))
 				return;
-			fseek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256), SEEK_SET);
+			blockdev_seek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256));
 			timer_set_delay_u64(&st506->timer, CMD_DELAY_US * TIMER_USEC);
 			st506->status |= 0x80;
 			return;
@@ -316,7 +356,7 @@ void st506_writel(st506_t *st506, uint32_t a, uint32_t v)
 			rpclog("Write data : cylinder %i head %i sector %i   length %i sectors\n",st506->lcyl,st506->lhead,st506->lsect,st506->oplen);
 			if (check_chs_params(st506, st506->drive))
 				return;
-			fseek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256), SEEK_SET);
+			blockdev_seek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256));
 //                        rpclog("Seeked to %08X\n",(((((st506->lcyl*8)+st506->lhead)*32)+st506->lsect)*256));
 			timer_set_delay_u64(&st506->timer, CMD_DELAY_US * TIMER_USEC);
 			st506->status |= 0x80;
@@ -344,7 +384,7 @@ void st506_writel(st506_t *st506, uint32_t a, uint32_t v)
 			rpclog("Write format : drive %i cylinder %i head %i sector %i   length %i sectors\n",st506->drive,st506->lcyl,st506->lhead,st506->lsect,st506->oplen);
 			if (check_chs_params(st506, st506->drive))
 				return;
-			fseek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256), SEEK_SET);
+			blockdev_seek(st506->hdfile[st506->drive], (((((st506->lcyl*st506->hpc[st506->drive])+st506->lhead)*st506->spt[st506->drive])+st506->lsect)*256));
 			timer_set_delay_u64(&st506->timer, CMD_DELAY_US * TIMER_USEC);
 			st506->status |= 0x80;
 			st506->first = 1;
@@ -550,7 +590,7 @@ static void st506_callback(void *p)
 //                        rpclog("Reading from pos %08X - %i sectors left\n",ftell(st506->hdfile[st506->drive]),st506->oplen);
 			st506->oplen--;
 //                        rpclog("Read ST506buffer from %08X\n",ftell(hdfile));
-			ignore_result(fread(st506->buffer+16, 256, 1, st506->hdfile[st506->drive]));
+			blockdev_read(st506->hdfile[st506->drive], st506->buffer+16, 256);
 //                        if ((ftell(hdfile)-256)==0x2048C00) dumpst506buffer();
 			for (c = 16; c < 272; c += 2)
 			{
@@ -653,7 +693,7 @@ static void st506_callback(void *p)
 			}
 //                        rpclog("Write ST506buffer to %08X\n",ftell(hdfile));
 //                        if (ftell(hdfile)==0x2048C00) dumpst506buffer();
-			fwrite(st506->buffer+16, 256, 1, st506->hdfile[st506->drive]);
+			blockdev_write(st506->hdfile[st506->drive], st506->buffer+16, 256);
 //                        rpclog("ST506 OPLEN %i\n",st506->oplen);
 			if (st506->oplen)
 			{
@@ -711,7 +751,7 @@ static void st506_callback(void *p)
 				if (check_chs_params(st506, st506->drive))
 					break;
 				st506->oplen--;
-				fwrite(st506->buffer+16, 256, 1, st506->hdfile[st506->drive]);
+				blockdev_write(st506->hdfile[st506->drive], st506->buffer+16, 256);
 				c+=4;
 				st506->lsect++;
 				if (st506->lsect > st506->ns[st506->drive])
@@ -761,6 +801,10 @@ void st506_internal_close(void)
 {
 	st506_close(&internal_st506);
 }
+void st506_internal_snapshot(snapshot_t *s)
+{
+	st506_snapshot(s, &internal_st506);
+}
 uint8_t st506_internal_readb(uint32_t addr)
 {
 	return st506_readb(&internal_st506, addr);
@@ -1,3 +1,4 @@
+#include "blockdev.h"
 #include "timer.h"
 
 typedef struct st506_t
@@ -19,7 +20,7 @@ typedef struct st506_t
 	int spt[2], hpc[2], cyl[2];
 
 	emu_timer_t timer;
-	FILE *hdfile[2];
+	blockdev_t *hdfile[2];
 	uint8_t buffer[272];
 
 	void (*irq_raise)(struct st506_t *st506);
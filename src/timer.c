@@ -2,71 +2,117 @@
   Timer system*/
 #include <string.h>
 #include "arc.h"
+#include "snapshot.h"
 #include "timer.h"
 
 uint64_t tsc;
 
 uint64_t TIMER_USEC;
 uint32_t timer_target;
+uint64_t timer_horizon;
 
-/*Enabled timers are stored in a linked list, with the first timer to expire at
-  the head.*/
-static emu_timer_t *timer_head = NULL;
+/*Enabled timers are stored in a binary min-heap, ordered on the integer part of
+  the timestamp, so enabling, re-arming and disabling a timer are all O(log n).
+  Timers with equal timestamps run most recently enabled first, as they did
+  with the sorted list this replaces.*/
+#define TIMER_HEAP_SIZE 256
 
-void timer_enable(emu_timer_t *timer)
+static emu_timer_t *timer_heap[TIMER_HEAP_SIZE];
+static int timer_heap_count;
+static uint32_t timer_seq;
+
+/*Number of timer callbacks run since the last timer_callbacks_sample()*/
+static uint32_t timer_callback_count;
+
+static inline int timer_before(emu_timer_t *a, emu_timer_t *b)
 {
-	emu_timer_t *timer_node = timer_head;
+	int32_t diff = a->ts_integer - b->ts_integer;
 
-//	rpclog("timer->enable %p %i\n", timer, timer->enabled);
-	if (timer->enabled)
-		timer_disable(timer);
+	if (diff)
+		return diff < 0;
+	return (int32_t)(a->seq - b->seq) > 0;
+}
 
-#ifndef RELEASE_BUILD
-	if (timer->next || timer->prev)
-		fatal("timer_enable - timer->next\n");
-#endif
+static inline void timer_heap_set(int index, emu_timer_t *timer)
+{
+	timer_heap[index] = timer;
+	timer->heap_index = index;
+}
 
-	timer->enabled = 1;
+static void timer_sift_up(int index)
+{
+	emu_timer_t *timer = timer_heap[index];
 
-	/*List currently empty - add to head*/
-	if (!timer_head)
+	while (index)
 	{
-		timer_head = timer;
-		timer->next = timer->prev = NULL;
-		timer_target = timer_head->ts_integer;
-		return;
+		int parent = (index - 1) >> 1;
+
+		if (!timer_before(timer, timer_heap[parent]))
+			break;
+		timer_heap_set(index, timer_heap[parent]);
+		index = parent;
 	}
+	timer_heap_set(index, timer);
+}
 
-	timer_node = timer_head;
+static void timer_sift_down(int index)
+{
+	emu_timer_t *timer = timer_heap[index];
 
 	while (1)
 	{
-		/*Timer expires before timer_node. Add to list in front of timer_node*/
-		if (TIMER_LESS_THAN(timer, timer_node))
-		{
-			timer->next = timer_node;
-			timer->prev = timer_node->prev;
-			timer_node->prev = timer;
-			if (timer->prev)
-				timer->prev->next = timer;
-			else
-			{
-				timer_head = timer;
-				timer_target = timer_head->ts_integer;
-			}
-			return;
-		}
+		int child = index * 2 + 1;
 
-		/*timer_node is last in the list. Add timer to end of list*/
-		if (!timer_node->next)
-		{
-			timer_node->next = timer;
-			timer->prev = timer_node;
-			return;
-		}
+		if (child >= timer_heap_count)
+			break;
+		if (child + 1 < timer_heap_count && timer_before(timer_heap[child + 1], timer_heap[child]))
+			child++;
+		if (!timer_before(timer_heap[child], timer))
+			break;
+		timer_heap_set(index, timer_heap[child]);
+		index = child;
+	}
+	timer_heap_set(index, timer);
+}
+
+static void timer_heap_remove(int index)
+{
+	timer_heap_count--;
+	if (index != timer_heap_count)
+	{
+		emu_timer_t *moved = timer_heap[timer_heap_count];
+
+		timer_heap_set(index, moved);
+		timer_sift_down(index);
+		timer_sift_up(moved->heap_index);
+	}
+}
 
-		timer_node = timer_node->next;
+void timer_enable(emu_timer_t *timer)
+{
+//	rpclog("timer->enable %p %i\n", timer, timer->enabled);
+	timer->seq = timer_seq++;
+
+	if (timer->enabled)
+	{
+		/*Already queued - move to new position*/
+		timer_sift_down(timer->heap_index);
+		timer_sift_up(timer->heap_index);
+	}
+	else
+	{
+#ifndef RELEASE_BUILD
+		if (timer_heap_count == TIMER_HEAP_SIZE)
+			fatal("timer_enable - too many timers\n");
+#endif
+		timer->enabled = 1;
+		timer_heap_set(timer_heap_count++, timer);
+		timer_sift_up(timer->heap_index);
 	}
+
+	timer_target = timer_heap[0]->ts_integer;
+	if (TIMER_VAL_LESS_THAN_NE_VAL_64((uint64_t)timer_target << 32, timer_horizon))
+		timer_horizon = (uint64_t)timer_target << 32;
 }
 void timer_disable(emu_timer_t *timer)
 {
@@ -75,61 +121,92 @@ void timer_disable(emu_timer_t *timer)
 		return;
 
 #ifndef RELEASE_BUILD
-	if (!timer->next && !timer->prev && timer != timer_head)
-		fatal("timer_disable - !timer->next\n");
+	if (timer->heap_index >= timer_heap_count || timer_heap[timer->heap_index] != timer)
+		fatal("timer_disable - timer not in heap\n");
 #endif
 
 	timer->enabled = 0;
-
-	if (timer->prev)
-		timer->prev->next = timer->next;
-	else
-		timer_head = timer->next;
-	if (timer->next)
-		timer->next->prev = timer->prev;
-	timer->prev = timer->next = NULL;
-}
-static void timer_remove_head()
-{
-	if (timer_head)
-	{
-		emu_timer_t *timer = timer_head;
-//		rpclog("timer_remove_head %p %p\n", timer_head, timer_head->next);
-		timer_head = timer->next;
-		if (timer_head)
-			timer_head->prev = NULL;
-		timer->next = timer->prev = NULL;
-		timer->enabled = 0;
-	}
+	timer_heap_remove(timer->heap_index);
+	if (timer_heap_count)
+		timer_target = timer_heap[0]->ts_integer;
 }
 
 void timer_process()
 {
-	if (!timer_head)
-		return;
-
-	while (1)
+	while (timer_heap_count)
 	{
-		emu_timer_t *timer = timer_head;
+		emu_timer_t *timer = timer_heap[0];
 
 		if (!TIMER_LESS_THAN_VAL(timer, (uint32_t)(tsc >> 32)))
 			break;
 
-		timer_remove_head();
+		timer->enabled = 0;
+		timer_heap_remove(0);
+		timer_callback_count++;
 		timer->callback(timer->p);
 	}
 
-	timer_target = timer_head->ts_integer;
+	if (timer_heap_count)
+		timer_target = timer_heap[0]->ts_integer;
+}
+
+uint32_t timer_callbacks_sample()
+{
+	uint32_t count = timer_callback_count;
+
+	timer_callback_count = 0;
+	return count;
 }
 
 void timer_reset()
 {
 	rpclog("timer_reset\n");
 	timer_target = 0;
-	timer_head = NULL;
+	timer_heap_count = 0;
 	TIMER_USEC = (uint64_t)speed_mhz << 32;
 }
 
+void timer_snapshot_state(snapshot_t *s)
+{
+	SNAPSHOT_VAR(s, tsc);
+	SNAPSHOT_VAR(s, timer_seq);
+
+	if (s->loading)
+	{
+		int c;
+
+		/*Empty the queue - timers are requeued as each device is loaded*/
+		for (c = 0; c < timer_heap_count; c++)
+			timer_heap[c]->enabled = 0;
+		timer_heap_count = 0;
+		timer_target = (uint32_t)(tsc >> 32);
+	}
+}
+
+void timer_snapshot(snapshot_t *s, emu_timer_t *timer)
+{
+	int enabled = timer->enabled;
+
+	SNAPSHOT_VAR(s, enabled);
+	SNAPSHOT_VAR(s, timer->ts_integer);
+	SNAPSHOT_VAR(s, timer->ts_frac);
+	SNAPSHOT_VAR(s, timer->seq);
+
+	if (s->loading)
+	{
+		/*Requeue with the saved enable order, so timers that expire
+		  together still run in the same order*/
+		timer->enabled = 0;
+		if (enabled && timer_heap_count < TIMER_HEAP_SIZE)
+		{
+			timer->enabled = 1;
+			timer_heap_set(timer_heap_count++, timer);
+			timer_sift_up(timer->heap_index);
+			timer_target = timer_heap[0]->ts_integer;
+		}
+	}
+}
+
 void timer_add(emu_timer_t *timer, void (*callback)(void *p), void *p, int start_timer)
 {
 	memset(timer, 0, sizeof(emu_timer_t));
@@ -137,7 +214,6 @@ void timer_add(emu_timer_t *timer, void (*callback)(void *p), void *p, int start
 	timer->callback = callback;
 	timer->p = p;
 	timer->enabled = 0;
-	timer->prev = timer->next = NULL;
 	if (start_timer)
 		timer_set_delay_u64(timer, 0);
 }
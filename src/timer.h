@@ -20,13 +20,19 @@ typedef struct emu_timer_t
 	void (*callback)(void *p);
 	void *p;
 
-	struct emu_timer_t *prev, *next;
+	int heap_index; /*Position in timer queue, valid while enabled*/
+	uint32_t seq;   /*Order of enabling, to break ties between equal timestamps*/
 } emu_timer_t;
 
 /*Timestamp of nearest enabled timer. CPU emulation must call timer_process()
   when TSC matches or exceeds this.*/
 extern uint32_t timer_target;
 
+/*32:32 timestamp up to which CPU emulation may run without checking
+  timer_target. It is set by the CPU, and pulled in by timer_enable() if a timer
+  is enabled that expires before it*/
+extern uint64_t timer_horizon;
+
 /*Enable timer, without updating timestamp*/
 void timer_enable(emu_timer_t *timer);
 /*Disable timer*/
@@ -38,6 +44,9 @@ void timer_process();
 /*Reset timer system*/
 void timer_reset();
 
+/*Return the number of timer callbacks run since the previous call*/
+uint32_t timer_callbacks_sample();
+
 /*Add new timer. If start_timer is set, timer will be enabled with a zero
   timestamp - this is useful for permanently enabled timers*/
 void timer_add(emu_timer_t *timer, void (*callback)(void *p), void *p, int start_timer);
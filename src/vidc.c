@@ -16,12 +16,61 @@
 #include "keyboard.h"
 #include "mem.h"
 #include "memc.h"
+#include "snapshot.h"
 #include "sound.h"
 #include "timer.h"
 #include "vidc.h"
 #include "video.h"
 #include "plat_video.h"
 
+/*Pixel expansion uses 128-bit vectors where the host has them - SSE2 on x86,
+  NEON on ARM and SIMD128 in the WebAssembly build. Anything else uses the
+  scalar loops*/
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define VIDC_SIMD
+typedef __m128i vidc_vec_t;
+#define VEC_LOAD(p)           _mm_loadu_si128((const __m128i *)(p))
+#define VEC_LOAD2(lo, hi)     _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(lo)), _mm_loadl_epi64((const __m128i *)(hi)))
+#define VEC_SET(a, b, c, d)   _mm_set_epi32(d, c, b, a)
+#define VEC_STORE(p, v)       _mm_storeu_si128((__m128i *)(p), v)
+#define VEC_DOUBLE_LO(v)      _mm_unpacklo_epi32(v, v)
+#define VEC_DOUBLE_HI(v)      _mm_unpackhi_epi32(v, v)
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VIDC_SIMD
+typedef uint32x4_t vidc_vec_t;
+static inline uint32x4_t vidc_vec_set(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	uint32_t t[4] = {a, b, c, d};
+
+	return vld1q_u32(t);
+}
+#define VEC_LOAD(p)           vld1q_u32(p)
+#define VEC_LOAD2(lo, hi)     vcombine_u32(vld1_u32(lo), vld1_u32(hi))
+#define VEC_SET(a, b, c, d)   vidc_vec_set(a, b, c, d)
+#define VEC_STORE(p, v)       vst1q_u32(p, v)
+#define VEC_DOUBLE_LO(v)      (vzipq_u32(v, v).val[0])
+#define VEC_DOUBLE_HI(v)      (vzipq_u32(v, v).val[1])
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define VIDC_SIMD
+typedef v128_t vidc_vec_t;
+#define VEC_LOAD(p)           wasm_v128_load(p)
+#define VEC_LOAD2(lo, hi)     wasm_u32x4_make((lo)[0], (lo)[1], (hi)[0], (hi)[1])
+#define VEC_SET(a, b, c, d)   wasm_u32x4_make(a, b, c, d)
+#define VEC_STORE(p, v)       wasm_v128_store(p, v)
+#define VEC_DOUBLE_LO(v)      wasm_i32x4_shuffle(v, v, 0, 0, 1, 1)
+#define VEC_DOUBLE_HI(v)      wasm_i32x4_shuffle(v, v, 2, 2, 3, 3)
+#endif
+
+/*Native builds draw each frame on a worker thread while emulation carries on,
+  see video_frame_render*/
+#if !defined(__EMSCRIPTEN__) && !WIN32
+#include <pthread.h>
+#define VIDC_WORKER
+#endif
+
 /*RISC OS 3 sets a total of 832 horizontal and 288 vertical for MODE 12. We use
   768x576 to get a 4:3 aspect ratio. This also allows MODEs 33-36 to display
   correctly*/
@@ -93,6 +142,7 @@ void destroy_bitmap(BITMAP *b)
 int vidc_dma_length;
 extern int vidc_fetches;
 int vidc_framecount = 0;
+uint32_t vidc_linecount = 0;
 int vidc_displayon = 0;
 int blitcount=0;
 /*b - memory buffer*/
@@ -104,6 +154,119 @@ int videodma=0;
 int palchange;
 uint32_t vidlookup[256];   /*Lookup table for 4bpp modes*/
 
+/*Line change detection. Each buffer line holds a signature of the screen data
+  and VIDC state it was last drawn from, and is only redrawn (and uploaded to
+  the renderer) when that changes. 0 means the line must be redrawn*/
+static uint64_t vidc_line_sig[1536];
+static uint32_t vidc_pal_gen;
+static int vidc_dirty_y_min = 9999, vidc_dirty_y_max = 0;
+/*Indexed colour output. When the renderer supports it, buffer holds palette
+  indices (see vidc.h) instead of colours, and the renderer looks up colours
+  itself. vidc.pal/pal8 then hold indices, and vidc_rgb/vidc_rgb8 the colours.
+  Each palette in use during a frame gets a row in vidc_pal_rows, and each line
+  records the row it was displayed with, so mid-frame palette changes still
+  display correctly*/
+int vidc_indexed;
+static uint32_t vidc_rgb[20], vidc_rgb8[256];
+static uint32_t vidc_pal_rows[VIDC_PAL_ROWS][VIDC_PAL_ENTRIES];
+static uint16_t vidc_line_pal_row[1024];
+static int vidc_nr_pal_rows, vidc_pal_row_stale = 1;
+/*Renderer texture area last uploaded, so a repeated frame only uploads its
+  changed lines*/
+static struct
+{
+	int valid;
+	int src_x, src_y, dest_x, dest_y, w, h;
+} vidc_last_update;
+/*Frame rendering (video_frame_render). Rather than drawing each line as VIDC
+  reaches it, vidc_poll() records what the line is to be drawn from, including
+  the screen and cursor data fetched for it, and the frame's lines are drawn
+  together when it ends. With VIDC_WORKER that happens on a worker thread
+  while emulation carries on, and the frame is presented at the end of the
+  next one. The queue is drawn early if it fills up, and is bypassed while a
+  device on the data port needs each line as it is displayed*/
+int video_frame_render;
+
+enum
+{
+	VIDC_LINE_DISPLAY = 0, /*Line within VIDC's vertical range*/
+	VIDC_LINE_BLANK_TV,    /*Outside it, within the TV display area*/
+	VIDC_LINE_BLANK        /*Outside it*/
+};
+
+typedef struct vidc_line_t
+{
+	int type;
+	int l, mode;
+	uint32_t cr;
+	int htot, hbstart, hbend, hdstart, hdend;
+	int displayon, borderon, dma;
+	int cursor, cx;
+	uint32_t cursor_data[2];
+	int data, words; /*Screen data fetched for the line, in the frame's data*/
+	int pal; /*Palette snapshot to draw with, or -1 for the current palette*/
+	/*Copied from the globals, which the UI thread can change while the
+	  worker is drawing*/
+	int monitor_type, display_mode;
+} vidc_line_t;
+
+#define VIDC_MAX_LINES     1024
+#define VIDC_MAX_LINE_DATA 512          /*Most words of screen data a line can fetch*/
+#define VIDC_MAX_DATA      (128 * 1024) /*Words of screen data per frame*/
+#define VIDC_PAL_SNAPSHOTS 64
+
+/*Everything drawing uses to turn screen data into pixels*/
+typedef struct vidc_pal_snapshot_t
+{
+	uint32_t pal[32], pal8[256];
+	uint32_t monolook[16][4];
+#ifdef VIDC_SIMD
+	uint32_t lut1[16][4], lut1e[16][2], lut2[16][2];
+#endif
+	uint32_t gen;
+} vidc_pal_snapshot_t;
+
+typedef struct vidc_frame_t
+{
+	vidc_line_t lines[VIDC_MAX_LINES];
+	int nr_lines;
+	vidc_pal_snapshot_t pal[VIDC_PAL_SNAPSHOTS];
+	int nr_pal;
+	uint32_t data[VIDC_MAX_DATA];
+	int data_len;
+#ifdef VIDC_WORKER
+	/*Output deferred until the worker has drawn the frame*/
+	struct
+	{
+		int valid;
+		int src_x, src_y, w, h, dblscan;
+		uint32_t pal_rows[VIDC_PAL_ROWS][VIDC_PAL_ENTRIES];
+		uint16_t line_pal_row[1024];
+		int nr_pal_rows;
+	} output;
+#endif
+} vidc_frame_t;
+
+#ifdef VIDC_WORKER
+static vidc_frame_t vidc_frames[2];
+#else
+static vidc_frame_t vidc_frames[1];
+#endif
+static vidc_frame_t *vidc_frame = &vidc_frames[0]; /*Frame being recorded*/
+static int vidc_pal_snap_stale = 1;
+/*Palette the drawing code uses, owned by whichever thread is drawing*/
+static vidc_pal_snapshot_t vidc_draw_pal;
+static int vidc_draw_pal_live; /*vidc_draw_pal holds the current palette*/
+#ifdef VIDC_WORKER
+static pthread_t vidc_worker;
+static pthread_mutex_t vidc_worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vidc_worker_cond = PTHREAD_COND_INITIALIZER;
+static int vidc_worker_state; /*0 = not started, 1 = running, -1 = failed to start*/
+static int vidc_worker_quit;
+static vidc_frame_t *vidc_worker_frame;  /*Frame being drawn, NULL when idle*/
+static vidc_frame_t *vidc_pending_frame; /*Frame handed to the worker and not yet presented*/
+#endif
+
 int redrawpalette=0;
 
 int oldflash;
@@ -185,17 +348,41 @@ int vidc_getline()
 uint32_t monolook[16][4];
 uint32_t hirescurcol[4]={0,0,0,0xFFFFFF};
 
+#ifdef VIDC_SIMD
+/*Nibble expansion tables for the 1bpp and 2bpp modes, rebuilt whenever the
+  palette changes. 4bpp and 8bpp modes look up vidc.pal/vidc.pal8 directly*/
+static uint32_t vidc_lut1[16][4];  /*1bpp, four pixels per nibble*/
+static uint32_t vidc_lut1e[16][2]; /*1bpp at 8/12MHz, bits 0 and 2 only*/
+static uint32_t vidc_lut2[16][2];  /*2bpp, two pixels per nibble*/
+#endif
+
 void redolookup()
 {
 	int c;
+
+	vidc_pal_snap_stale = 1;
+	vidc_draw_pal_live = 0;
+#ifdef VIDC_SIMD
+	for (c = 0; c < 16; c++)
+	{
+		vidc_lut1[c][0] = vidc.pal[c & 1];
+		vidc_lut1[c][1] = vidc.pal[(c >> 1) & 1];
+		vidc_lut1[c][2] = vidc.pal[(c >> 2) & 1];
+		vidc_lut1[c][3] = vidc.pal[(c >> 3) & 1];
+		vidc_lut1e[c][0] = vidc.pal[c & 1];
+		vidc_lut1e[c][1] = vidc.pal[(c >> 2) & 1];
+		vidc_lut2[c][0] = vidc.pal[c & 3];
+		vidc_lut2[c][1] = vidc.pal[(c >> 2) & 3];
+	}
+#endif
 	if (monitor_type == MONITOR_MONO)
 	{
 		for (c=0;c<16;c++)
 		{
-			monolook[c][0]=(vidcr[c]&1)?0xFFFFFF:0x000000;
-			monolook[c][1]=(vidcr[c]&2)?0xFFFFFF:0x000000;
-			monolook[c][2]=(vidcr[c]&4)?0xFFFFFF:0x000000;
-			monolook[c][3]=(vidcr[c]&8)?0xFFFFFF:0x000000;
+			monolook[c][0]=(vidcr[c]&1)?hirescurcol[3]:0x000000;
+			monolook[c][1]=(vidcr[c]&2)?hirescurcol[3]:0x000000;
+			monolook[c][2]=(vidcr[c]&4)?hirescurcol[3]:0x000000;
+			monolook[c][3]=(vidcr[c]&8)?hirescurcol[3]:0x000000;
 		}
 	}
 	switch (vidcr[VIDC_CR]&0xF) /*Control Register*/
@@ -373,7 +560,8 @@ void vidc_redopalette(void)
 			.r = v & 0xf
 		};
 
-		vidc.pal[i] = vidc_make_colour(r);
+		vidc_rgb[i] = vidc_make_colour(r);
+		vidc.pal[i] = vidc_indexed ? (VIDC_INDEX_PAL + i) : vidc_rgb[i];
 	}
 
 	for (int i = 0; i < 256; i++)
@@ -395,12 +583,59 @@ void vidc_redopalette(void)
 		if (i & 0x80)
 			r.b |= 8;
 
-		vidc.pal8[i] = vidc_make_colour(r);
+		vidc_rgb8[i] = vidc_make_colour(r);
+		vidc.pal8[i] = vidc_indexed ? (VIDC_INDEX_PAL8 + i) : vidc_rgb8[i];
 	}
 
+	/*Indexed lines don't depend on the palette, so only need a new palette row*/
+	if (vidc_indexed)
+		vidc_pal_row_stale = 1;
+	else
+		vidc_pal_gen++;
 	palchange = 1;
 }
 
+/*Palette row for the current line, adding a row if the palette has changed*/
+static int vidc_pal_row(void)
+{
+	if (vidc_pal_row_stale)
+	{
+		uint32_t *row;
+
+		/*Out of rows, so overwrite the last one. Lines already displayed with
+		  it will show the newer palette*/
+		if (vidc_nr_pal_rows < VIDC_PAL_ROWS)
+			vidc_nr_pal_rows++;
+		row = vidc_pal_rows[vidc_nr_pal_rows - 1];
+
+		row[VIDC_INDEX_BLACK] = 0;
+		memcpy(&row[VIDC_INDEX_PAL], vidc_rgb, sizeof(vidc_rgb));
+		row[VIDC_INDEX_WHITE] = 0xFFFFFF;
+		memcpy(&row[VIDC_INDEX_PAL8], vidc_rgb8, sizeof(vidc_rgb8));
+		vidc_pal_row_stale = 0;
+	}
+
+	return vidc_nr_pal_rows - 1;
+}
+
+/*Colour of buffer pixel v on line l*/
+static inline uint32_t vidc_line_colour(int l, uint32_t v)
+{
+	if (!vidc_indexed)
+		return v;
+	return vidc_pal_rows[(l < 1024) ? vidc_line_pal_row[l] : (vidc_nr_pal_rows - 1)][v];
+}
+
+/*Start a new frame's set of palette rows from the current palette*/
+static void vidc_pal_rows_reset(void)
+{
+	if (vidc_nr_pal_rows > 1)
+		memcpy(vidc_pal_rows[0], vidc_pal_rows[vidc_nr_pal_rows - 1], sizeof(vidc_pal_rows[0]));
+	if (vidc_nr_pal_rows)
+		vidc_nr_pal_rows = 1;
+	memset(vidc_line_pal_row, 0, sizeof(vidc_line_pal_row));
+}
+
 void writevidc(uint32_t v)
 {
 //        char s[80];
@@ -541,9 +776,40 @@ void writevidc(uint32_t v)
 //        printf("VIDC write %08X\n",v);
 }
 
-void clearbitmap()
+static void vidc_frame_finish(void);
+
+static void vidc_frame_reset(vidc_frame_t *frame)
+{
+	frame->nr_lines = 0;
+	frame->nr_pal = 0;
+	frame->data_len = 0;
+	if (frame == vidc_frame)
+		vidc_pal_snap_stale = 1;
+}
+
+static void vidc_clear_buffer(void)
 {
+	/*Index 0 is black, so this is correct for indexed output too*/
+	vidc_frame_finish();
+	vidc_frame_reset(vidc_frame); /*Lines queued so far are cleared too*/
 	clear(buffer);
+	memset(vidc_line_sig, 0, sizeof(vidc_line_sig));
+	vidc_last_update.valid = 0;
+}
+
+void clearbitmap()
+{
+	vidc_clear_buffer();
+}
+
+void vidc_set_indexed(int indexed)
+{
+	vidc_indexed = indexed;
+	hirescurcol[3] = indexed ? VIDC_INDEX_WHITE : 0xFFFFFF;
+	vidc_redopalette();
+	redolookup();
+	if (buffer)
+		vidc_clear_buffer();
 }
 
 void initvid()
@@ -566,11 +832,24 @@ void redopalette()
 
 void setredrawall()
 {
-	clear(buffer);
+	vidc_clear_buffer();
 }
 
 void closevideo()
 {
+#ifdef VIDC_WORKER
+	if (vidc_worker_state == 1)
+	{
+		pthread_mutex_lock(&vidc_worker_mutex);
+		vidc_worker_quit = 1;
+		pthread_cond_broadcast(&vidc_worker_cond);
+		pthread_mutex_unlock(&vidc_worker_mutex);
+		pthread_join(vidc_worker, NULL);
+		vidc_worker_state = 0;
+		vidc_worker_quit = 0;
+		vidc_pending_frame = NULL;
+	}
+#endif
 }
 
 void reinitvideo()
@@ -595,360 +874,644 @@ void archline(uint8_t *bp, int x1, int y, int x2, uint32_t col)
 		((uint32_t *)bp)[x]=col;
 }
 
-static void vidc_poll(void *__p)
+/*Pixel expansion kernels. Each expands one word of screen data into host
+  pixels at p; 8MHz and 12MHz modes have every pixel doubled*/
+static inline void vidc_expand_1bpp(uint32_t *p, uint32_t temp)
 {
 	int c;
-	int mode;
-//        int col=0;
-	int x,xx;
-	uint32_t temp;
-	uint8_t *bp;
-//        char s[256];
-	int l = vidc.line;
-	int xoffset;
-	int xoffset2 __attribute__((unused));
-	int do_double_scan = (!vidc.scanrate && !dblscan);
+#ifdef VIDC_SIMD
+	for (c = 0; c < 32; c += 4, temp >>= 4)
+		VEC_STORE(&p[c], VEC_LOAD(vidc_draw_pal.lut1[temp & 0xf]));
+#else
+	for (c = 0; c < 32; c++)
+		p[c] = vidc_draw_pal.pal[(temp >> c) & 1];
+#endif
+}
 
-	if (do_double_scan)
-		l <<= 1;
+/*8MHz and 12MHz 1bpp modes have always been drawn from the even bits of each
+  word only, as 32 pixels*/
+static inline void vidc_expand_1bpp_double(uint32_t *p, uint32_t temp)
+{
+	int c;
+#ifdef VIDC_SIMD
+	for (c = 0; c < 32; c += 8, temp >>= 8)
+	{
+		vidc_vec_t v = VEC_LOAD2(vidc_draw_pal.lut1e[temp & 0xf], vidc_draw_pal.lut1e[(temp >> 4) & 0xf]);
 
-	if (output)
-		rpclog("vidc_poll: state=%i line=%i\n", vidc.state, vidc.line);
-	switch (vidc.state)
+		VEC_STORE(&p[c], VEC_DOUBLE_LO(v));
+		VEC_STORE(&p[c+4], VEC_DOUBLE_HI(v));
+	}
+#else
+	for (c = 0; c < 32; c += 2)
+		p[c] = p[c+1] = vidc_draw_pal.pal[(temp >> c) & 1];
+#endif
+}
+
+static inline void vidc_expand_2bpp(uint32_t *p, uint32_t temp)
+{
+	int c;
+#ifdef VIDC_SIMD
+	for (c = 0; c < 16; c += 4, temp >>= 8)
+		VEC_STORE(&p[c], VEC_LOAD2(vidc_draw_pal.lut2[temp & 0xf], vidc_draw_pal.lut2[(temp >> 4) & 0xf]));
+#else
+	for (c = 0; c < 16; c++)
+		p[c] = vidc_draw_pal.pal[(temp >> (c << 1)) & 3];
+#endif
+}
+
+static inline void vidc_expand_2bpp_double(uint32_t *p, uint32_t temp)
+{
+	int c;
+#ifdef VIDC_SIMD
+	for (c = 0; c < 32; c += 8, temp >>= 8)
 	{
-		case VIDC_HSYNC:
-		vidc.state = VIDC_FRONT_PORCH;
-		timer_advance_u64(&vidc.timer, vidc.front_porch_length * vidc.pixel_time);
-		break;
+		vidc_vec_t v = VEC_LOAD2(vidc_draw_pal.lut2[temp & 0xf], vidc_draw_pal.lut2[(temp >> 4) & 0xf]);
 
-		case VIDC_FRONT_PORCH:
-		vidc.state = VIDC_DISPLAY;
-		timer_advance_u64(&vidc.timer, vidc.display_length * vidc.pixel_time);
-		vidc.in_display = 1;
-		break;
+		VEC_STORE(&p[c], VEC_DOUBLE_LO(v));
+		VEC_STORE(&p[c+4], VEC_DOUBLE_HI(v));
+	}
+#else
+	for (c = 0; c < 32; c += 2)
+		p[c] = p[c+1] = vidc_draw_pal.pal[(temp >> c) & 3];
+#endif
+}
 
-		case VIDC_DISPLAY:
-		vidc.state = VIDC_BACK_PORCH;
-		timer_advance_u64(&vidc.timer, vidc.back_porch_length * vidc.pixel_time);
-		/*Delay next fetch until display starts again*/
-		memc_dma_video_req_ts += ((vidc.back_porch_length + vidc.hsync_length + vidc.front_porch_length) * vidc.pixel_time);
-		recalc_min_timer();
-		vidc.in_display = 0;
-		break;
+static inline void vidc_expand_4bpp(uint32_t *p, uint32_t temp)
+{
+	int c;
+#ifdef VIDC_SIMD
+	for (c = 0; c < 8; c += 4, temp >>= 16)
+		VEC_STORE(&p[c], VEC_SET(vidc_draw_pal.pal[temp & 0xf], vidc_draw_pal.pal[(temp >> 4) & 0xf],
+					 vidc_draw_pal.pal[(temp >> 8) & 0xf], vidc_draw_pal.pal[(temp >> 12) & 0xf]));
+#else
+	for (c = 0; c < 8; c++)
+		p[c] = vidc_draw_pal.pal[(temp >> (c << 2)) & 0xf];
+#endif
+}
 
-		case VIDC_BACK_PORCH:
-		vidc.state = VIDC_HSYNC;
+static inline void vidc_expand_4bpp_double(uint32_t *p, uint32_t temp)
+{
+	int c;
+#ifdef VIDC_SIMD
+	for (c = 0; c < 16; c += 8, temp >>= 16)
+	{
+		vidc_vec_t v = VEC_SET(vidc_draw_pal.pal[temp & 0xf], vidc_draw_pal.pal[(temp >> 4) & 0xf],
+				       vidc_draw_pal.pal[(temp >> 8) & 0xf], vidc_draw_pal.pal[(temp >> 12) & 0xf]);
 
-		/*Clock vertical count*/
-		if (vidc.line == vidc.vsync)
-		{
-			if (vidc.vsync_callback)
-				vidc.vsync_callback(vidc.callback_p, 0);
-		}
-		if (vidc.line == vidc.vbstart && !vidc.border_was_disabled)
-		{
-			vidc.borderon = 1;
-			flyback = 0;
-			if (vidc.disp_y_min > l && vidc.displayon)
-				vidc.disp_y_min = l + (do_double_scan ? 2 : 1);
-		}
-		if (vidc.line == vidc.vdstart && !vidc.display_was_disabled)
-		{
-//                        rpclog("VIDC addr %08X %08X\n",vinit,vidcr[VIDC_CR]);
-			vidc.addr = vinit;
-			vidc.caddr = cinit;
+		VEC_STORE(&p[c], VEC_DOUBLE_LO(v));
+		VEC_STORE(&p[c+4], VEC_DOUBLE_HI(v));
+	}
+#else
+	for (c = 0; c < 16; c += 2)
+		p[c] = p[c+1] = vidc_draw_pal.pal[(temp >> (c << 1)) & 0xf];
+#endif
+}
 
-			/*First cursor DMA fetch at start of hsync before first display line*/
-			memc_dma_cursor_req_ts = timer_get_ts(&vidc.timer);
-			memc_dma_cursor_req = 1;
-			/*First video DMA fetch at end of hsync before first display line.
-			  Note that first DMA fetch is double length!*/
-			memc_dma_video_req_ts = memc_dma_cursor_req_ts + (vidc.hsync_length * vidc.pixel_time);
-			memc_dma_video_req_start_ts = memc_dma_video_req_ts + (vidc.front_porch_length * vidc.pixel_time);
-			memc_dma_video_req = 2;
-			vidc.cursor_lines = 2;
-			vidc.first_line = 1;
-			recalc_min_timer();
+static inline void vidc_expand_8bpp(uint32_t *p, uint32_t temp)
+{
+#ifdef VIDC_SIMD
+	VEC_STORE(p, VEC_SET(vidc_draw_pal.pal8[temp & 0xff], vidc_draw_pal.pal8[(temp >> 8) & 0xff],
+			     vidc_draw_pal.pal8[(temp >> 16) & 0xff], vidc_draw_pal.pal8[temp >> 24]));
+#else
+	p[0] = vidc_draw_pal.pal8[temp & 0xff];
+	p[1] = vidc_draw_pal.pal8[(temp >> 8) & 0xff];
+	p[2] = vidc_draw_pal.pal8[(temp >> 16) & 0xff];
+	p[3] = vidc_draw_pal.pal8[temp >> 24];
+#endif
+}
 
-			vidc.displayon = vidc_displayon = 1;
-			vidc.fetch_count = vidc.cycles_per_fetch;
-			mem_dorefresh = memc_refresh_always;
-			flyback = 0;
-			if (vidc.disp_y_min > l && vidc.borderon)
-				vidc.disp_y_min = l + (do_double_scan ? 2 : 1);
-		}
-		if (vidc.line == vidc.vdend)
-		{
-			vidc.displayon = vidc_displayon = 0;
-			memc_dma_video_req = 0;
-			mem_dorefresh = (memc_refreshon && !vidc_displayon) || memc_refresh_always;
-			ioc_irqa(IOC_IRQA_VBLANK);
-			flyback = 0x80;
-			if (vidc.disp_y_max == -1)
-				vidc.disp_y_max = l + (do_double_scan ? 2 : 1);
-			vidc.display_was_disabled = 1;
-			LOG_VIDEO_FRAMES("Normal vsync; speed %d%%, ins=%d, inscount=%d, PC=%08X\n", inssec, ins, inscount, PC);
-		}
-		if (vidc.line == vidc.vbend)
-		{
-			vidc.borderon = 0;
-			if (vidc.disp_y_max == -1)
-				vidc.disp_y_max = l + (do_double_scan ? 2 : 1);
-			vidc.border_was_disabled = 1;
-		}
-		if (vidc.displayon && !vidc.cursor_lines)
-		{
-			/*Fetched cursor data used, request next fetch*/
-			memc_dma_cursor_req = 1;
-			vidc.cursor_lines = 2;
-		}
-		vidc.line++;
-		LOG_VIDC_TIMING("++ vidc.line == %d\n", vidc.line);
+static inline void vidc_expand_8bpp_double(uint32_t *p, uint32_t temp)
+{
+#ifdef VIDC_SIMD
+	vidc_vec_t v = VEC_SET(vidc_draw_pal.pal8[temp & 0xff], vidc_draw_pal.pal8[(temp >> 8) & 0xff],
+			       vidc_draw_pal.pal8[(temp >> 16) & 0xff], vidc_draw_pal.pal8[temp >> 24]);
+
+	VEC_STORE(p, VEC_DOUBLE_LO(v));
+	VEC_STORE(&p[4], VEC_DOUBLE_HI(v));
+#else
+	p[0] = p[1] = vidc_draw_pal.pal8[temp & 0xff];
+	p[2] = p[3] = vidc_draw_pal.pal8[(temp >> 8) & 0xff];
+	p[4] = p[5] = vidc_draw_pal.pal8[(temp >> 16) & 0xff];
+	p[6] = p[7] = vidc_draw_pal.pal8[temp >> 24];
+#endif
+}
 
-		timer_advance_u64(&vidc.timer, vidc.hsync_length * vidc.pixel_time);
-		break;
+/*Bytes of screen data fetched per pixel loop iteration, for each mode*/
+static const int vidc_fetch_step[16] = {32, 32, 32, 32, 32, 32, 16, 16, 16, 16, 8, 8, 8, 8, 4, 4};
+
+/*Horizontal range covered by the pixel loops in vidc_draw_line()*/
+static void vidc_fetch_range(const vidc_line_t *ln, int *xstart, int *xend)
+{
+	int htot = ln->htot + 1;
+
+	if (!(ln->cr & 2))
+	{
+		*xstart = MIN(ln->hdstart*2, htot*4);
+		*xend = MIN(ln->hdend*2, htot*4);
+	}
+	else
+	{
+		*xstart = MIN(ln->hdstart, htot*2);
+		*xend = MIN(ln->hdend, htot*2);
+	}
+	if (ln->monitor_type == MONITOR_MONO)
+	{
+		*xstart *= 4;
+		*xend *= 4;
 	}
+}
 
-	if (vidc.state != VIDC_BACK_PORCH)
+static inline int vidc_cursor_on_line(void)
+{
+	return ((vidc.cys>>14)+2)<=vidc.line && ((vidc.cye>>14)+2)>vidc.line;
+}
+
+/*Fetch the screen and cursor data for a recorded line as VIDC displays it,
+  advancing the video and cursor addresses exactly as the rendering loops in
+  vidc_draw_line() consume the data. Screen data goes to data, which may be
+  NULL for lines that won't be drawn*/
+static void vidc_fetch_line(vidc_line_t *ln, uint32_t *data)
+{
+	int x, xstart, xend;
+
+	ln->words = 0;
+	if (ln->type != VIDC_LINE_DISPLAY || !ln->dma || !ln->displayon)
 		return;
 
-	if (palchange)
+	vidc_fetch_range(ln, &xstart, &xend);
+	for (x = xstart; x < xend; x += vidc_fetch_step[ln->mode])
 	{
-		redolookup();
-		palchange=0;
+		if (data)
+			data[ln->words] = ram[vidc.addr];
+		ln->words++;
+		vidc.addr++;
+		if (vidc.addr == vend + 4)
+			vidc.addr = vstart;
 	}
 
-	videodma=vidc.addr;
-	mode=(vidcr[VIDC_CR]&0xF);
-	if (monitor_type == MONITOR_MONO)
-		mode = 2;
-
-	if (l>=0 && vidc.line<=1023 && l<1536)
+	if (ln->cursor)
 	{
-		int htot = (vidc.htot+1)*2;
-		bp = (uint8_t *)buffer->line[l];
-		if (!memc_videodma_enable)
+		ln->cursor_data[0] = ram[vidc.caddr];
+		ln->cursor_data[1] = ram[vidc.caddr + 1];
+		if (ln->monitor_type == MONITOR_MONO)
+			vidc.caddr += 2;
+		else if (!(ln->cr & 2))
 		{
-			if (vidc.borderon)
-			{
-				int hb_start = vidc.hbstart, hb_end = vidc.hbend;
-				int hd_start = vidc.hdstart, hd_end = vidc.hdend;
+			if ((ln->cx << 1) <= (2048 - 32*2))
+				vidc.caddr += 2;
+		}
+		else if (ln->cx <= (2048-32))
+			vidc.caddr += 2;
+	}
+}
 
-				if (!(vidcr[VIDC_CR] & 2))
-				{
-					/*8MHz or 12MHz pixel rate*/
-					hb_start *= 2;
-					hb_end *= 2;
-					hd_start *= 2;
-					hd_end *= 2;
-				}
+static inline uint64_t vidc_hash(uint64_t h, uint32_t v)
+{
+	return (((h << 5) | (h >> 59)) ^ v) * 0x9e3779b97f4a7c15ull;
+}
 
-				if (display_mode == DISPLAY_MODE_TV)
-					archline(bp, TV_X_MIN, l, hb_start-1, 0);
-				else
-					archline(bp, 0, l, hb_start-1, 0);
-				if (vidc.hdend > vidc.hbend || !vidc.displayon)
-					archline(bp, hb_start, l, hb_end-1, vidc.pal[16]);
-				else
-				{
-					archline(bp, hb_start, l, hd_start-1, vidc.pal[16]);
-					archline(bp, hd_start, l, hd_end-1, 0);
-					archline(bp, hd_end, l, hb_end-1, vidc.pal[16]);
-				}
-				if (display_mode == DISPLAY_MODE_TV)
-					archline(bp, hb_end, l, TV_X_MAX-1, 0);
-				else
-					archline(bp, hb_end, l, htot, 0);
+/*Signature of the screen data, cursor and VIDC state that a recorded line
+  would be drawn from. Only valid for lines drawn with video DMA enabled*/
+static uint64_t vidc_line_signature(const vidc_line_t *ln, const uint32_t *data)
+{
+	uint64_t h = 0;
+
+	h = vidc_hash(h, ln->mode | ((ln->cr & 0xf) << 4) | (ln->monitor_type << 8) | (ln->display_mode << 12) |
+			 (ln->displayon << 16) | (ln->borderon << 17));
+	h = vidc_hash(h, ln->htot);
+	h = vidc_hash(h, ln->hbstart);
+	h = vidc_hash(h, ln->hbend);
+	h = vidc_hash(h, ln->hdstart);
+	h = vidc_hash(h, ln->hdend);
+	h = vidc_hash(h, vidc_draw_pal.gen); /*Unchanged by palette writes when indexed*/
+
+	if (ln->displayon)
+	{
+		int c;
 
-				if (l < vidc.y_min)
-					vidc.y_min = l;
-				if ((l+1) > vidc.y_max)
-					vidc.y_max = l+1;
-				if (l < vidc.disp_y_min)
-					vidc.disp_y_min = l;
-				if ((l+1) > vidc.disp_y_max)
-					vidc.disp_y_max = l+1;
-			}
-			else
-				archline(bp, 0, l, 1023, 0);
-		}
-		else
+		for (c = 0; c < ln->words; c++)
+			h = vidc_hash(h, data[c]);
+
+		if (ln->cursor)
 		{
-			int xstart, xend;
-
-			x=vidc.hbstart;
-			if (vidc.hdstart>x) x=vidc.hdstart;
-			xx=vidc.hbend;
-			if (vidc.hdend<xx) xx=vidc.hdend;
-			xoffset=xx-x;
-			if (!(vidcr[VIDC_CR]&2))
-			{
-				/*8MHz or 12MHz pixel rate*/
-				xoffset=200-(xoffset>>1);
-				if (vidc.hdstart<vidc.hbstart) xoffset2=xoffset+(vidc.hdstart-vidc.hbstart);
-				else                           xoffset2=xoffset;
-				xoffset<<=1;
-				xoffset2<<=1;
-
-				xstart = vidc.hdstart*2;
-				if (xstart > (vidc.htot+1)*4)
-					xstart = (vidc.htot+1)*4;
-				xend = vidc.hdend*2;
-				if (xend > (vidc.htot+1)*4)
-					xend = (vidc.htot+1)*4;
-			}
-			else
-			{
-				/*16MHz or 24MHz pixel rate*/
-				xoffset=400-(xoffset>>1);
-				if (vidc.hdstart<vidc.hbstart) xoffset2=xoffset+(vidc.hdstart-vidc.hbstart);
-				else                           xoffset2=xoffset;
-
-				xstart = vidc.hdstart;
-				if (xstart > (vidc.htot+1)*2)
-					xstart = (vidc.htot+1)*2;
-				xend = vidc.hdend;
-				if (xend > (vidc.htot+1)*2)
-					xend = (vidc.htot+1)*2;
-			}
-			if (monitor_type == MONITOR_MONO)
-				xoffset2 = 0;
-			if (vidc.displayon)
-			{
-				switch (mode)
-				{
-					case 0: /*Mode 4: 320x256 8MHz 1bpp*/
-					case 1: /*12MHz 1bpp*/
-					for (x = xstart; x < xend; x += 32)
+			h = vidc_hash(h, ln->cx);
+			h = vidc_hash(h, ln->cursor_data[0]);
+			h = vidc_hash(h, ln->cursor_data[1]);
+		}
+	}
+
+	return h | 1;
+}
+
+static inline void vidc_line_dirty(int l)
+{
+	if (l < vidc_dirty_y_min)
+		vidc_dirty_y_min = l;
+	if ((l+1) > vidc_dirty_y_max)
+		vidc_dirty_y_max = l+1;
+}
+
+/*Upload the area of buffer to be presented. If the area is the same as last
+  frame only the lines redrawn since then are uploaded*/
+static void vidc_renderer_update(int src_x, int src_y, int dest_x, int dest_y, int w, int h,
+				 const uint32_t *pal_rows, int nr_pal_rows, const uint16_t *line_pal_row)
+{
+	int y_min = MAX(src_y, vidc_dirty_y_min);
+	int y_max = MIN(src_y + h, vidc_dirty_y_max);
+
+	if (!vidc_last_update.valid || take_screenshot || record_video || skip_video_render ||
+	    vidc_last_update.src_x != src_x || vidc_last_update.src_y != src_y ||
+	    vidc_last_update.dest_x != dest_x || vidc_last_update.dest_y != dest_y ||
+	    vidc_last_update.w != w || vidc_last_update.h != h)
+	{
+		vidc_last_update.valid = !skip_video_render;
+		vidc_last_update.src_x = src_x;
+		vidc_last_update.src_y = src_y;
+		vidc_last_update.dest_x = dest_x;
+		vidc_last_update.dest_y = dest_y;
+		vidc_last_update.w = w;
+		vidc_last_update.h = h;
+		y_min = src_y;
+		y_max = src_y + h;
+	}
+	else if (y_min >= y_max)
+		y_min = y_max = src_y;
+
+	/*Indexed output always sends the frame's palettes, even if no lines changed*/
+	if (vidc_indexed)
+		video_renderer_update_indexed(buffer, src_x, y_min, dest_x, dest_y + (y_min - src_y), w, y_max - y_min,
+					      pal_rows, nr_pal_rows, line_pal_row);
+	else if (y_min < y_max)
+		video_renderer_update(buffer, src_x, y_min, dest_x, dest_y + (y_min - src_y), w, y_max - y_min);
+
+	vidc_dirty_y_min = 9999;
+	vidc_dirty_y_max = 0;
+}
+
+/*Record what line l is to be drawn from. Must be called before the line's
+  data is fetched*/
+static void vidc_record_line(vidc_line_t *ln, int type, int l, int mode)
+{
+	ln->type = type;
+	ln->l = l;
+	ln->mode = mode;
+	ln->cr = vidcr[VIDC_CR];
+	ln->htot = vidc.htot;
+	ln->hbstart = vidc.hbstart;
+	ln->hbend = vidc.hbend;
+	ln->hdstart = vidc.hdstart;
+	ln->hdend = vidc.hdend;
+	ln->displayon = vidc.displayon;
+	ln->borderon = vidc.borderon;
+	ln->dma = memc_videodma_enable;
+	ln->cursor = vidc_cursor_on_line();
+	ln->cx = vidc.cx;
+	ln->data = 0;
+	ln->words = 0;
+	ln->pal = -1;
+	ln->monitor_type = monitor_type;
+	ln->display_mode = display_mode;
+}
+
+static void vidc_pal_save(vidc_pal_snapshot_t *snap)
+{
+	memcpy(snap->pal, vidc.pal, sizeof(snap->pal));
+	memcpy(snap->pal8, vidc.pal8, sizeof(snap->pal8));
+	memcpy(snap->monolook, monolook, sizeof(snap->monolook));
+#ifdef VIDC_SIMD
+	memcpy(snap->lut1, vidc_lut1, sizeof(snap->lut1));
+	memcpy(snap->lut1e, vidc_lut1e, sizeof(snap->lut1e));
+	memcpy(snap->lut2, vidc_lut2, sizeof(snap->lut2));
+#endif
+	snap->gen = vidc_pal_gen;
+}
+
+/*Draw a recorded line into buffer, unless buffer already holds it. data is the
+  screen data fetched for the line*/
+static void vidc_draw_line(const vidc_line_t *ln, const uint32_t *data)
+{
+	int l = ln->l;
+	int mode = ln->mode;
+	int htot = (ln->htot+1)*2;
+	int addr = 0;
+	int x,xx;
+	uint32_t temp;
+	uint8_t *bp;
+	int xoffset;
+	int xoffset2 __attribute__((unused));
+
+	if (ln->type == VIDC_LINE_BLANK_TV)
+	{
+		archline(buffer->line[l], TV_X_MIN, l, TV_X_MAX-1, 0);
+		vidc_line_sig[l] = 0;
+		vidc_line_dirty(l);
+		return;
+	}
+	if (ln->type == VIDC_LINE_BLANK)
+	{
+		archline(buffer->line[l], 0, l, htot, 0);
+		if (l >= 0 && l < 1536)
+		{
+			vidc_line_sig[l] = 0;
+			vidc_line_dirty(l);
+		}
+		return;
+	}
+
+	if (ln->dma)
+	{
+		uint64_t line_sig = vidc_line_signature(ln, data);
+
+		/*Line unchanged since it was last drawn*/
+		if (vidc_line_sig[l] == line_sig)
+			return;
+		vidc_line_sig[l] = line_sig;
+	}
+	else
+		vidc_line_sig[l] = 0;
+	vidc_line_dirty(l);
+
+	bp = (uint8_t *)buffer->line[l];
+	if (!ln->dma)
+	{
+		if (ln->borderon)
+		{
+			int hb_start = ln->hbstart, hb_end = ln->hbend;
+			int hd_start = ln->hdstart, hd_end = ln->hdend;
+
+			if (!(ln->cr & 2))
+			{
+				/*8MHz or 12MHz pixel rate*/
+				hb_start *= 2;
+				hb_end *= 2;
+				hd_start *= 2;
+				hd_end *= 2;
+			}
+
+			if (ln->display_mode == DISPLAY_MODE_TV)
+				archline(bp, TV_X_MIN, l, hb_start-1, 0);
+			else
+				archline(bp, 0, l, hb_start-1, 0);
+			if (ln->hdend > ln->hbend || !ln->displayon)
+				archline(bp, hb_start, l, hb_end-1, vidc_draw_pal.pal[16]);
+			else
+			{
+				archline(bp, hb_start, l, hd_start-1, vidc_draw_pal.pal[16]);
+				archline(bp, hd_start, l, hd_end-1, 0);
+				archline(bp, hd_end, l, hb_end-1, vidc_draw_pal.pal[16]);
+			}
+			if (ln->display_mode == DISPLAY_MODE_TV)
+				archline(bp, hb_end, l, TV_X_MAX-1, 0);
+			else
+				archline(bp, hb_end, l, htot, 0);
+		}
+		else
+			archline(bp, 0, l, 1023, 0);
+	}
+	else
+	{
+		int xstart, xend;
+
+		x=ln->hbstart;
+		if (ln->hdstart>x) x=ln->hdstart;
+		xx=ln->hbend;
+		if (ln->hdend<xx) xx=ln->hdend;
+		xoffset=xx-x;
+		if (!(ln->cr&2))
+		{
+			/*8MHz or 12MHz pixel rate*/
+			xoffset=200-(xoffset>>1);
+			if (ln->hdstart<ln->hbstart) xoffset2=xoffset+(ln->hdstart-ln->hbstart);
+			else                           xoffset2=xoffset;
+			xoffset<<=1;
+			xoffset2<<=1;
+
+			xstart = ln->hdstart*2;
+			if (xstart > (ln->htot+1)*4)
+				xstart = (ln->htot+1)*4;
+			xend = ln->hdend*2;
+			if (xend > (ln->htot+1)*4)
+				xend = (ln->htot+1)*4;
+		}
+		else
+		{
+			/*16MHz or 24MHz pixel rate*/
+			xoffset=400-(xoffset>>1);
+			if (ln->hdstart<ln->hbstart) xoffset2=xoffset+(ln->hdstart-ln->hbstart);
+			else                           xoffset2=xoffset;
+
+			xstart = ln->hdstart;
+			if (xstart > (ln->htot+1)*2)
+				xstart = (ln->htot+1)*2;
+			xend = ln->hdend;
+			if (xend > (ln->htot+1)*2)
+				xend = (ln->htot+1)*2;
+		}
+		if (ln->monitor_type == MONITOR_MONO)
+			xoffset2 = 0;
+		if (ln->displayon)
+		{
+			switch (mode)
+			{
+				case 0: /*Mode 4: 320x256 8MHz 1bpp*/
+				case 1: /*12MHz 1bpp*/
+				for (x = xstart; x < xend; x += 32)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
-						{
-							for (xx = 0; xx < 64; xx += 2)
-								((uint32_t *)bp)[x+xx] = ((uint32_t *)bp)[x+xx+1] = vidc.pal[(temp>>xx)&1];
-						}
-						if (vidc.addr == vend + 4)
-							vidc.addr = vstart;
+						vidc_expand_1bpp_double(&((uint32_t *)bp)[x], temp);
 					}
-					break;
-					case 2: /*Mode 0: 640x256 16MHz 1bpp*/
-					case 3: /*Mode 25: 640x480 24MHz 1bpp*/
-					for (x = ((monitor_type == MONITOR_MONO) ? xstart*4 : xstart); x < ((monitor_type == MONITOR_MONO) ? xend*4 : xend); x += 32)
+				}
+				break;
+				case 2: /*Mode 0: 640x256 16MHz 1bpp*/
+				case 3: /*Mode 25: 640x480 24MHz 1bpp*/
+				for (x = ((ln->monitor_type == MONITOR_MONO) ? xstart*4 : xstart); x < ((ln->monitor_type == MONITOR_MONO) ? xend*4 : xend); x += 32)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
+						if (ln->monitor_type == MONITOR_MONO)
 						{
-							if (monitor_type == MONITOR_MONO)
-							{
-								for (xx=0;xx<32;xx+=4)
-								{
-									((uint32_t *)bp)[x+xx]   = monolook[temp&0xF][0];
-									((uint32_t *)bp)[x+xx+1] = monolook[temp&0xF][1];
-									((uint32_t *)bp)[x+xx+2] = monolook[temp&0xF][2];
-									((uint32_t *)bp)[x+xx+3] = monolook[temp&0xF][3];
-									temp>>=4;
-								}
-							}
-							else
+							for (xx=0;xx<32;xx+=4)
 							{
-								for (xx=0;xx<32;xx++)
-									((uint32_t *)bp)[x+xx] = vidc.pal[(temp>>xx)&1];
+								((uint32_t *)bp)[x+xx]   = vidc_draw_pal.monolook[temp&0xF][0];
+								((uint32_t *)bp)[x+xx+1] = vidc_draw_pal.monolook[temp&0xF][1];
+								((uint32_t *)bp)[x+xx+2] = vidc_draw_pal.monolook[temp&0xF][2];
+								((uint32_t *)bp)[x+xx+3] = vidc_draw_pal.monolook[temp&0xF][3];
+								temp>>=4;
 							}
-//                                                        p += 32;
 						}
-						if (vidc.addr == vend + 4)
-							vidc.addr = vstart;
+						else
+							vidc_expand_1bpp(&((uint32_t *)bp)[x], temp);
+//                                                        p += 32;
 					}
-					break;
-					case 4: /*Mode 1: 320x256 8MHz 2bpp*/
-					case 5: /*12MHz 2bpp*/
-					for (x = xstart; x < xend; x += 32)
+				}
+				break;
+				case 4: /*Mode 1: 320x256 8MHz 2bpp*/
+				case 5: /*12MHz 2bpp*/
+				for (x = xstart; x < xend; x += 32)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
-						{
-							for (xx=0;xx<32;xx+=2)
-								((uint32_t *)bp)[x+xx]=((uint32_t *)bp)[x+xx+1]=vidc.pal[(temp>>xx)&3];
-						}
-						if (vidc.addr == vend + 4)
-							vidc.addr = vstart;
+						vidc_expand_2bpp_double(&((uint32_t *)bp)[x], temp);
 					}
-					break;
-					case 6: /*Mode 8: 640x256 16MHz 2bpp*/
-					case 7: /*Mode 26: 640x480 24MHz 2bpp*/
-					for (x = xstart; x < xend; x += 16)
+				}
+				break;
+				case 6: /*Mode 8: 640x256 16MHz 2bpp*/
+				case 7: /*Mode 26: 640x480 24MHz 2bpp*/
+				for (x = xstart; x < xend; x += 16)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
-						{
-							for (xx = 0; xx < 16; xx++)
-								((uint32_t *)bp)[x+xx]=vidc.pal[temp>>(xx<<1)&3];
-						}
-						if (vidc.addr == vend + 4)
-							vidc.addr = vstart;
+						vidc_expand_2bpp(&((uint32_t *)bp)[x], temp);
 					}
-					break;
-					case 8: /*Mode 9: 320x256 8MHz 4bpp*/
-					case 9: /*12MHz 4bpp*/
-					for (x = xstart; x < xend; x += 16)
+				}
+				break;
+				case 8: /*Mode 9: 320x256 8MHz 4bpp*/
+				case 9: /*12MHz 4bpp*/
+				for (x = xstart; x < xend; x += 16)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
-						{
-							for (c = 0; c < 16; c += 2)
-								((uint32_t *)bp)[x+c] = ((uint32_t *)bp)[x+c+1] = vidc.pal[(temp>>(c<<1))&0xF];
-						}
-						if (vidc.addr == vend + 4)
-							vidc.addr = vstart;
+						vidc_expand_4bpp_double(&((uint32_t *)bp)[x], temp);
 					}
-					break;
-					case 10: /*Mode 12: 640x256 16MHz 4bpp*/
-					case 11: /*Mode 27: 640x480 24MHz 4bpp*/
-					for (x = xstart; x < xend; x += 8)
+				}
+				break;
+				case 10: /*Mode 12: 640x256 16MHz 4bpp*/
+				case 11: /*Mode 27: 640x480 24MHz 4bpp*/
+				for (x = xstart; x < xend; x += 8)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
-						{
-							for (c = 0; c < 8; c++)
-								((uint32_t *)bp)[x+c]=vidc.pal[(temp>>(c<<2))&0xF];
-						}
-						if (vidc.addr==vend+4) vidc.addr=vstart;
+						vidc_expand_4bpp(&((uint32_t *)bp)[x], temp);
 					}
-					break;
-					case 12: /*Mode 13: 320x256 8bpp*/
-					case 13: /*12MHz 8bpp*/
-					for (x = xstart; x < xend/*vidc.hdend*2*/; x += 8)
+				}
+				break;
+				case 12: /*Mode 13: 320x256 8bpp*/
+				case 13: /*12MHz 8bpp*/
+				for (x = xstart; x < xend/*ln->hdend*2*/; x += 8)
+				{
+					temp=data[addr++];
+					if (x < 4096)
 					{
-						temp=ram[vidc.addr++];
-						if (x < 4096)
-						{
-							((uint32_t *)bp)[x]=((uint32_t *)bp)[x+1]=vidc.pal8[temp&0xFF];
-							((uint32_t *)bp)[x+2]=((uint32_t *)bp)[x+3]=vidc.pal8[(temp>>8)&0xFF];
-							((uint32_t *)bp)[x+4]=((uint32_t *)bp)[x+5]=vidc.pal8[(temp>>16)&0xFF];
-							((uint32_t *)bp)[x+6]=((uint32_t *)bp)[x+7]=vidc.pal8[(temp>>24)&0xFF];
-						}
-						if (vidc.addr==vend+4) vidc.addr=vstart;
+						vidc_expand_8bpp_double(&((uint32_t *)bp)[x], temp);
 					}
-					break;
-					case 14: /*Mode 15: 640x256 16MHz 8bpp*/
-					case 15: /*Mode 28: 640x480 24MHz 8bpp*/
-					for (x = xstart; x < xend; x += 4)
+				}
+				break;
+				case 14: /*Mode 15: 640x256 16MHz 8bpp*/
+				case 15: /*Mode 28: 640x480 24MHz 8bpp*/
+				for (x = xstart; x < xend; x += 4)
+				{
+					temp = data[addr++];
+					if (x < 4096)
 					{
-						temp = ram[vidc.addr++];
-						if (x < 4096)
-						{
-							((uint32_t *)bp)[x]   = vidc.pal8[temp&0xFF];
-							((uint32_t *)bp)[x+1] = vidc.pal8[(temp>>8)&0xFF];
-							((uint32_t *)bp)[x+2] = vidc.pal8[(temp>>16)&0xFF];
-							((uint32_t *)bp)[x+3] = vidc.pal8[(temp>>24)&0xFF];
-						}
-						if (vidc.addr == vend + 4)
-							vidc.addr = vstart;
+						vidc_expand_8bpp(&((uint32_t *)bp)[x], temp);
 					}
+				}
+				break;
+			}
+
+			switch (mode)
+			{
+				case 0: /*Mode 4*/
+				case 1:
+				case 4: /*Mode 1*/
+				case 5:
+				case 8: /*Mode 9*/
+				case 9:
+				case 12: /*Mode 13*/
+				case 13:
+				if (ln->hbstart<ln->hdstart)
+				{
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, TV_X_MIN, l, (ln->hdstart*2)-1, 0);
+					archline(bp, ln->hbstart*2, l, (ln->hdstart*2)-1, vidc_draw_pal.pal[0x10]);
+				}
+				else
+				{
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, TV_X_MIN, l, (ln->hbstart*2)-1, 0);
+				}
+				if (ln->hbend > ln->hdend)
+				{
+					archline(bp, ln->hdend*2, l, ln->hbend*2, vidc_draw_pal.pal[0x10]);
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, ln->hbend*2, l, TV_X_MAX-1, 0);
+				}
+				else
+				{
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, ln->hbend*2, l, TV_X_MAX-1, 0);
+				}
+				if (htot > MAX(ln->hbend, ln->hdend))
+					archline(bp, MAX(ln->hbend*2, ln->hdend*2), l, htot*2, 0);
+				break;
+				case 2:  /*Mode 0*/
+				case 3:  /*Mode 25*/
+				case 6:  /*Mode 8*/
+				case 7:  /*Mode 26*/
+				case 10: /*Mode 12*/
+				case 11: /*Mode 27*/
+				case 14: /*Mode 15*/
+				case 15: /*Mode 28*/
+				if (ln->monitor_type == MONITOR_MONO)
 					break;
+				archline(bp, 0, l, MIN(ln->hbstart, ln->hdstart)-1, 0);
+				if (ln->hbstart < ln->hdstart)
+				{
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, TV_X_MIN, l, ln->hbstart-1, 0);
+					archline(bp, ln->hbstart, l, ln->hdstart-1, vidc_draw_pal.pal[0x10]);
+				}
+				else
+				{
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, TV_X_MIN, l, ln->hbstart-1, 0);
+				}
+				if (ln->hbend > ln->hdend)
+				{
+					archline(bp, ln->hdend, l, ln->hbend, vidc_draw_pal.pal[0x10]);
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, ln->hbend, l, TV_X_MAX-1, 0);
+				}
+				else
+				{
+					if (ln->display_mode == DISPLAY_MODE_TV)
+						archline(bp, ln->hbend, l, TV_X_MAX-1, 0);
 				}
+				if (htot > MAX(ln->hbend, ln->hdend))
+					archline(bp, MAX(ln->hbend, ln->hdend), l, htot, 0);
+				break;
+			}
 
-				switch (mode)
+			if (ln->cursor)
+			{
+				if (ln->monitor_type == MONITOR_MONO)
+				{
+					x = (ln->cx << 2) - 80;
+					temp = ln->cursor_data[0];
+					for (xx = 0; xx < 64; xx += 4)
+					{
+						if (temp & 3)
+							((uint32_t *)bp)[x+xx]   = ((uint32_t *)bp)[x+xx+1] =
+							((uint32_t *)bp)[x+xx+2] = ((uint32_t *)bp)[x+xx+3] = hirescurcol[temp&3];
+						temp>>=2;
+					}
+					temp = ln->cursor_data[1];
+					for (xx = 64; xx < 128; xx += 4)
+					{
+						if (temp & 3)
+							((uint32_t *)bp)[x+xx]   = ((uint32_t *)bp)[x+xx+1] =
+							((uint32_t *)bp)[x+xx+2] = ((uint32_t *)bp)[x+xx+3] = hirescurcol[temp&3];
+						temp>>=2;
+					}
+				}
+				else switch (ln->cr&0xF)
 				{
 					case 0: /*Mode 4*/
 					case 1:
@@ -958,31 +1521,23 @@ static void vidc_poll(void *__p)
 					case 9:
 					case 12: /*Mode 13*/
 					case 13:
-					if (vidc.hbstart<vidc.hdstart)
-					{
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, TV_X_MIN, l, (vidc.hdstart*2)-1, 0);
-						archline(bp, vidc.hbstart*2, l, (vidc.hdstart*2)-1, vidc.pal[0x10]);
-					}
-					else
-					{
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, TV_X_MIN, l, (vidc.hbstart*2)-1, 0);
-					}
-					if (vidc.hbend > vidc.hdend)
+					x = ln->cx << 1;//((ln->cx-ln->hdstart)<<1)+xoffset2;
+					if (x > (2048 - 32*2))
+						break;
+					temp=ln->cursor_data[0];
+					for (xx=0;xx<32;xx+=2)
 					{
-						archline(bp, vidc.hdend*2, l, vidc.hbend*2, vidc.pal[0x10]);
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, vidc.hbend*2, l, TV_X_MAX-1, 0);
+						if (temp&3) ((uint32_t *)bp)[x+xx]=((uint32_t *)bp)[x+xx+1]=vidc_draw_pal.pal[(temp&3)|0x10];
+						temp>>=2;
 					}
-					else
+					temp=ln->cursor_data[1];
+					for (xx=32;xx<64;xx+=2)
 					{
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, vidc.hbend*2, l, TV_X_MAX-1, 0);
+						if (temp&3) ((uint32_t *)bp)[x+xx]=((uint32_t *)bp)[x+xx+1]=vidc_draw_pal.pal[(temp&3)|0x10];
+						temp>>=2;
 					}
-					if (htot > MAX(vidc.hbend, vidc.hdend))
-						archline(bp, MAX(vidc.hbend*2, vidc.hdend*2), l, htot*2, 0);
 					break;
+
 					case 2:  /*Mode 0*/
 					case 3:  /*Mode 25*/
 					case 6:  /*Mode 8*/
@@ -991,149 +1546,407 @@ static void vidc_poll(void *__p)
 					case 11: /*Mode 27*/
 					case 14: /*Mode 15*/
 					case 15: /*Mode 28*/
-					if (monitor_type == MONITOR_MONO)
+					x = ln->cx;//(ln->cx-ln->hdstart)+xoffset2;
+					if (x > (2048-32))
 						break;
-					archline(bp, 0, l, MIN(vidc.hbstart, vidc.hdstart)-1, 0);
-					if (vidc.hbstart < vidc.hdstart)
-					{
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, TV_X_MIN, l, vidc.hbstart-1, 0);
-						archline(bp, vidc.hbstart, l, vidc.hdstart-1, vidc.pal[0x10]);
-					}
-					else
+					temp=ln->cursor_data[0];
+					for (xx=0;xx<16;xx++)
 					{
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, TV_X_MIN, l, vidc.hbstart-1, 0);
+						if (temp&3) ((uint32_t *)bp)[x+xx]=vidc_draw_pal.pal[(temp&3)|0x10];
+						temp>>=2;
 					}
-					if (vidc.hbend > vidc.hdend)
+					temp=ln->cursor_data[1];
+					for (xx=16;xx<32;xx++)
 					{
-						archline(bp, vidc.hdend, l, vidc.hbend, vidc.pal[0x10]);
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, vidc.hbend, l, TV_X_MAX-1, 0);
+						if (temp&3) ((uint32_t *)bp)[x+xx]=vidc_draw_pal.pal[(temp&3)|0x10];
+						temp>>=2;
 					}
-					else
-					{
-						if (display_mode == DISPLAY_MODE_TV)
-							archline(bp, vidc.hbend, l, TV_X_MAX-1, 0);
-					}
-					if (htot > MAX(vidc.hbend, vidc.hdend))
-						archline(bp, MAX(vidc.hbend, vidc.hdend), l, htot, 0);
 					break;
 				}
-
-				if (((vidc.cys>>14)+2)<=vidc.line && ((vidc.cye>>14)+2)>vidc.line)
-				{
-					if (monitor_type == MONITOR_MONO)
-					{
-						x = (vidc.cx << 2) - 80;
-						temp = ram[vidc.caddr++];
-						for (xx = 0; xx < 64; xx += 4)
-						{
-							if (temp & 3)
-								((uint32_t *)bp)[x+xx]   = ((uint32_t *)bp)[x+xx+1] =
-								((uint32_t *)bp)[x+xx+2] = ((uint32_t *)bp)[x+xx+3] = hirescurcol[temp&3];
-							temp>>=2;
-						}
-						temp = ram[vidc.caddr++];
-						for (xx = 64; xx < 128; xx += 4)
-						{
-							if (temp & 3)
-								((uint32_t *)bp)[x+xx]   = ((uint32_t *)bp)[x+xx+1] =
-								((uint32_t *)bp)[x+xx+2] = ((uint32_t *)bp)[x+xx+3] = hirescurcol[temp&3];
-							temp>>=2;
-						}
-					}
-					else switch (vidcr[VIDC_CR]&0xF)
-					{
-						case 0: /*Mode 4*/
-						case 1:
-						case 4: /*Mode 1*/
-						case 5:
-						case 8: /*Mode 9*/
-						case 9:
-						case 12: /*Mode 13*/
-						case 13:
-						x = vidc.cx << 1;//((vidc.cx-vidc.hdstart)<<1)+xoffset2;
-						if (x > (2048 - 32*2))
-							break;
-						temp=ram[vidc.caddr++];
-						for (xx=0;xx<32;xx+=2)
-						{
-							if (temp&3) ((uint32_t *)bp)[x+xx]=((uint32_t *)bp)[x+xx+1]=vidc.pal[(temp&3)|0x10];
-							temp>>=2;
-						}
-						temp=ram[vidc.caddr++];
-						for (xx=32;xx<64;xx+=2)
-						{
-							if (temp&3) ((uint32_t *)bp)[x+xx]=((uint32_t *)bp)[x+xx+1]=vidc.pal[(temp&3)|0x10];
-							temp>>=2;
-						}
-						break;
-
-						case 2:  /*Mode 0*/
-						case 3:  /*Mode 25*/
-						case 6:  /*Mode 8*/
-						case 7:  /*Mode 26*/
-						case 10: /*Mode 12*/
-						case 11: /*Mode 27*/
-						case 14: /*Mode 15*/
-						case 15: /*Mode 28*/
-						x = vidc.cx;//(vidc.cx-vidc.hdstart)+xoffset2;
-						if (x > (2048-32))
-							break;
-						temp=ram[vidc.caddr++];
-						for (xx=0;xx<16;xx++)
-						{
-							if (temp&3) ((uint32_t *)bp)[x+xx]=vidc.pal[(temp&3)|0x10];
-							temp>>=2;
-						}
-						temp=ram[vidc.caddr++];
-						for (xx=16;xx<32;xx++)
-						{
-							if (temp&3) ((uint32_t *)bp)[x+xx]=vidc.pal[(temp&3)|0x10];
-							temp>>=2;
-						}
-						break;
-					}
-				}
 			}
-			if (vidc.borderon && !vidc.displayon)
+		}
+		if (ln->borderon && !ln->displayon)
+		{
+			int hb_start = ln->hbstart, hb_end = ln->hbend;
+
+			if (!(ln->cr & 2))
 			{
-				int hb_start = vidc.hbstart, hb_end = vidc.hbend;
+				hb_start *= 2;
+				hb_end *= 2;
+			}
 
-				if (!(vidcr[VIDC_CR] & 2))
-				{
-					hb_start *= 2;
-					hb_end *= 2;
-				}
+			if (ln->display_mode == DISPLAY_MODE_TV)
+				archline(bp, TV_X_MIN, l, hb_start-1, 0);
+			else
+				archline(bp, 0, l, hb_start-1, 0);
+			archline(bp, hb_start, l, hb_end-1, vidc_draw_pal.pal[16]);
+			if (ln->display_mode == DISPLAY_MODE_TV)
+				archline(bp, hb_end, l, TV_X_MAX-1, 0);
+			else
+				archline(bp, hb_end, l, htot, 0);
+		}
+		if (!ln->borderon && ln->displayon)
+			archline(bp,0,l,MAX(1023,htot),0);
+		if (!ln->borderon && !ln->displayon)
+			archline(bp,0,l,MAX(1023,htot),0);
+	}
+}
 
-				if (display_mode == DISPLAY_MODE_TV)
-					archline(bp, TV_X_MIN, l, hb_start-1, 0);
-				else
-					archline(bp, 0, l, hb_start-1, 0);
-				archline(bp, hb_start, l, hb_end-1, vidc.pal[16]);
-				if (display_mode == DISPLAY_MODE_TV)
-					archline(bp, hb_end, l, TV_X_MAX-1, 0);
-				else
-					archline(bp, hb_end, l, htot, 0);
-			}
-			if (!vidc.borderon && vidc.displayon)
-				archline(bp,0,l,MAX(1023,htot),0);
-			if (!vidc.borderon && !vidc.displayon)
-				archline(bp,0,l,MAX(1023,htot),0);
-			if (vidc.borderon && l < vidc.y_min)
-				vidc.y_min = l;
-			if (vidc.borderon && (l+1) > vidc.y_max)
-				vidc.y_max = l+1;
+/*Draw a frame's queued lines, each with the palette it was displayed with.
+  Runs on the worker thread when there is one*/
+static void vidc_draw_frame(vidc_frame_t *frame)
+{
+	int pal = -1;
+	int c;
+
+	for (c = 0; c < frame->nr_lines; c++)
+	{
+		vidc_line_t *ln = &frame->lines[c];
+
+		if (ln->pal != -1 && ln->pal != pal)
+		{
+			pal = ln->pal;
+			vidc_draw_pal = frame->pal[pal];
+		}
+		vidc_draw_line(ln, &frame->data[ln->data]);
+	}
+}
+
+#ifdef VIDC_WORKER
+static void *vidc_worker_thread(void *p)
+{
+	pthread_mutex_lock(&vidc_worker_mutex);
+	while (1)
+	{
+		while (!vidc_worker_frame && !vidc_worker_quit)
+			pthread_cond_wait(&vidc_worker_cond, &vidc_worker_mutex);
+		if (!vidc_worker_frame)
+			break;
+
+		pthread_mutex_unlock(&vidc_worker_mutex);
+		vidc_draw_frame(vidc_worker_frame);
+		pthread_mutex_lock(&vidc_worker_mutex);
+
+		vidc_worker_frame = NULL;
+		pthread_cond_broadcast(&vidc_worker_cond);
+	}
+	pthread_mutex_unlock(&vidc_worker_mutex);
+
+	return NULL;
+}
+
+static int vidc_worker_start(void)
+{
+	if (!vidc_worker_state)
+	{
+		if (pthread_create(&vidc_worker, NULL, vidc_worker_thread, NULL))
+		{
+			rpclog("vidc: can't start worker thread, drawing frames on the emulation thread\n");
+			vidc_worker_state = -1;
+		}
+		else
+			vidc_worker_state = 1;
+	}
+
+	return vidc_worker_state == 1;
+}
+#endif
+
+/*Wait for the worker to draw the frame handed to it, and present it. Must be
+  called before anything else touches buffer*/
+static void vidc_frame_finish(void)
+{
+#ifdef VIDC_WORKER
+	vidc_frame_t *frame = vidc_pending_frame;
+
+	if (!frame)
+		return;
+
+	pthread_mutex_lock(&vidc_worker_mutex);
+	while (vidc_worker_frame)
+		pthread_cond_wait(&vidc_worker_cond, &vidc_worker_mutex);
+	pthread_mutex_unlock(&vidc_worker_mutex);
+
+	vidc_pending_frame = NULL;
+	if (frame->output.valid)
+	{
+		vidc_renderer_update(frame->output.src_x, frame->output.src_y, 0, 0, frame->output.w, frame->output.h,
+				     frame->output.pal_rows[0], frame->output.nr_pal_rows, frame->output.line_pal_row);
+		video_renderer_present(0, 0, frame->output.w, frame->output.h, frame->output.dblscan);
+	}
+	vidc_frame_reset(frame);
+#endif
+}
+
+/*Draw all queued lines now, on this thread*/
+static void vidc_flush_lines(void)
+{
+	vidc_frame_finish();
+	if (!vidc_frame->nr_lines)
+		return;
+
+	vidc_draw_pal_live = 0;
+	vidc_draw_frame(vidc_frame);
+	vidc_frame_reset(vidc_frame);
+}
+
+/*Start drawing the frame that has just ended. Its output is deferred until it
+  has been drawn if that happens on the worker*/
+static void vidc_frame_end(void)
+{
+	vidc_frame_finish();
+#ifdef VIDC_WORKER
+	if (vidc_frame->nr_lines && vidc_worker_start())
+	{
+		vidc_frame_t *frame = vidc_frame;
+
+		vidc_draw_pal_live = 0;
+		frame->output.valid = 0;
+		vidc_pending_frame = frame;
+		vidc_frame = (frame == &vidc_frames[0]) ? &vidc_frames[1] : &vidc_frames[0];
+		vidc_frame_reset(vidc_frame);
+
+		pthread_mutex_lock(&vidc_worker_mutex);
+		vidc_worker_frame = frame;
+		pthread_cond_broadcast(&vidc_worker_cond);
+		pthread_mutex_unlock(&vidc_worker_mutex);
+		return;
+	}
+#endif
+	vidc_flush_lines();
+}
+
+/*Send the frame that has just ended to the renderer*/
+static void vidc_output(int src_x, int src_y, int w, int h, int dblscan)
+{
+#ifdef VIDC_WORKER
+	if (vidc_pending_frame)
+	{
+		vidc_frame_t *frame = vidc_pending_frame;
+
+		frame->output.valid = 1;
+		frame->output.src_x = src_x;
+		frame->output.src_y = src_y;
+		frame->output.w = w;
+		frame->output.h = h;
+		frame->output.dblscan = dblscan;
+		/*The palettes will have moved on by the time the frame is presented*/
+		frame->output.nr_pal_rows = vidc_nr_pal_rows;
+		if (vidc_indexed)
+		{
+			memcpy(frame->output.pal_rows, vidc_pal_rows, vidc_nr_pal_rows * sizeof(vidc_pal_rows[0]));
+			memcpy(frame->output.line_pal_row, vidc_line_pal_row, sizeof(vidc_line_pal_row));
 		}
+		return;
 	}
+#endif
+	vidc_renderer_update(src_x, src_y, 0, 0, w, h, vidc_pal_rows[0], vidc_nr_pal_rows, vidc_line_pal_row);
+	video_renderer_present(0, 0, w, h, dblscan);
+}
+
+/*Add line l to the queue, drawing the queue first if it is full*/
+static vidc_line_t *vidc_queue_line(int type, int l, int mode)
+{
+	vidc_frame_t *frame = vidc_frame;
+	vidc_line_t *ln;
+
+	if (frame->nr_lines == VIDC_MAX_LINES || frame->data_len + VIDC_MAX_LINE_DATA > VIDC_MAX_DATA ||
+	    (type == VIDC_LINE_DISPLAY && vidc_pal_snap_stale && frame->nr_pal == VIDC_PAL_SNAPSHOTS))
+		vidc_flush_lines();
+
+	ln = &frame->lines[frame->nr_lines++];
+	vidc_record_line(ln, type, l, mode);
+	if (type == VIDC_LINE_DISPLAY)
+	{
+		if (vidc_pal_snap_stale)
+		{
+			vidc_pal_save(&frame->pal[frame->nr_pal++]);
+			vidc_pal_snap_stale = 0;
+		}
+		ln->pal = frame->nr_pal - 1;
+	}
+	ln->data = frame->data_len;
+	vidc_fetch_line(ln, &frame->data[ln->data]);
+	frame->data_len += ln->words;
+
+	return ln;
+}
+
+static void vidc_poll(void *__p)
+{
+	int mode, type;
+//        int col=0;
+	int x;
+	vidc_line_t line;
+//        char s[256];
+	int l = vidc.line;
+	int do_double_scan = (!vidc.scanrate && !dblscan);
+
+	if (do_double_scan)
+		l <<= 1;
+
+	if (output)
+		rpclog("vidc_poll: state=%i line=%i\n", vidc.state, vidc.line);
+	switch (vidc.state)
+	{
+		case VIDC_HSYNC:
+		vidc.state = VIDC_FRONT_PORCH;
+		timer_advance_u64(&vidc.timer, vidc.front_porch_length * vidc.pixel_time);
+		break;
+
+		case VIDC_FRONT_PORCH:
+		vidc.state = VIDC_DISPLAY;
+		timer_advance_u64(&vidc.timer, vidc.display_length * vidc.pixel_time);
+		vidc.in_display = 1;
+		break;
+
+		case VIDC_DISPLAY:
+		vidc.state = VIDC_BACK_PORCH;
+		timer_advance_u64(&vidc.timer, vidc.back_porch_length * vidc.pixel_time);
+		/*Delay next fetch until display starts again*/
+		memc_dma_video_req_ts += ((vidc.back_porch_length + vidc.hsync_length + vidc.front_porch_length) * vidc.pixel_time);
+		recalc_min_timer();
+		vidc.in_display = 0;
+		break;
+
+		case VIDC_BACK_PORCH:
+		vidc.state = VIDC_HSYNC;
+
+		/*Clock vertical count*/
+		if (vidc.line == vidc.vsync)
+		{
+			if (vidc.vsync_callback)
+				vidc.vsync_callback(vidc.callback_p, 0);
+		}
+		if (vidc.line == vidc.vbstart && !vidc.border_was_disabled)
+		{
+			vidc.borderon = 1;
+			flyback = 0;
+			if (vidc.disp_y_min > l && vidc.displayon)
+				vidc.disp_y_min = l + (do_double_scan ? 2 : 1);
+		}
+		if (vidc.line == vidc.vdstart && !vidc.display_was_disabled)
+		{
+//                        rpclog("VIDC addr %08X %08X\n",vinit,vidcr[VIDC_CR]);
+			vidc.addr = vinit;
+			vidc.caddr = cinit;
+
+			/*First cursor DMA fetch at start of hsync before first display line*/
+			memc_dma_cursor_req_ts = timer_get_ts(&vidc.timer);
+			memc_dma_cursor_req = 1;
+			/*First video DMA fetch at end of hsync before first display line.
+			  Note that first DMA fetch is double length!*/
+			memc_dma_video_req_ts = memc_dma_cursor_req_ts + (vidc.hsync_length * vidc.pixel_time);
+			memc_dma_video_req_start_ts = memc_dma_video_req_ts + (vidc.front_porch_length * vidc.pixel_time);
+			memc_dma_video_req = 2;
+			vidc.cursor_lines = 2;
+			vidc.first_line = 1;
+			recalc_min_timer();
+
+			vidc.displayon = vidc_displayon = 1;
+			vidc.fetch_count = vidc.cycles_per_fetch;
+			mem_dorefresh = memc_refresh_always;
+			flyback = 0;
+			if (vidc.disp_y_min > l && vidc.borderon)
+				vidc.disp_y_min = l + (do_double_scan ? 2 : 1);
+		}
+		if (vidc.line == vidc.vdend)
+		{
+			vidc.displayon = vidc_displayon = 0;
+			memc_dma_video_req = 0;
+			mem_dorefresh = (memc_refreshon && !vidc_displayon) || memc_refresh_always;
+			ioc_irqa(IOC_IRQA_VBLANK);
+			flyback = 0x80;
+			if (vidc.disp_y_max == -1)
+				vidc.disp_y_max = l + (do_double_scan ? 2 : 1);
+			vidc.display_was_disabled = 1;
+			LOG_VIDEO_FRAMES("Normal vsync; speed %d%%, ins=%d, inscount=%d, PC=%08X\n", inssec, ins, inscount, PC);
+		}
+		if (vidc.line == vidc.vbend)
+		{
+			vidc.borderon = 0;
+			if (vidc.disp_y_max == -1)
+				vidc.disp_y_max = l + (do_double_scan ? 2 : 1);
+			vidc.border_was_disabled = 1;
+		}
+		if (vidc.displayon && !vidc.cursor_lines)
+		{
+			/*Fetched cursor data used, request next fetch*/
+			memc_dma_cursor_req = 1;
+			vidc.cursor_lines = 2;
+		}
+		vidc.line++;
+		vidc_linecount++;
+		LOG_VIDC_TIMING("++ vidc.line == %d\n", vidc.line);
+
+		timer_advance_u64(&vidc.timer, vidc.hsync_length * vidc.pixel_time);
+		break;
+	}
+
+	if (vidc.state != VIDC_BACK_PORCH)
+		return;
+
+	if (palchange)
+	{
+		redolookup();
+		palchange=0;
+	}
+
+	if (vidc_indexed && l >= 0 && l < 1024)
+		vidc_line_pal_row[l] = vidc_pal_row();
+
+	videodma=vidc.addr;
+	mode=(vidcr[VIDC_CR]&0xF);
+	if (monitor_type == MONITOR_MONO)
+		mode = 2;
+
+	if (l>=0 && vidc.line<=1023 && l<1536)
+		type = VIDC_LINE_DISPLAY;
 	else if (display_mode == DISPLAY_MODE_TV && l >= TV_Y_MIN && l < TV_Y_MAX)
-		archline(buffer->line[l], TV_X_MIN, l, TV_X_MAX-1, 0);
+		type = VIDC_LINE_BLANK_TV;
 	else
+		type = VIDC_LINE_BLANK;
+
+	if (turbo_mode && !vidc.data_callback)
 	{
-		int htot = (vidc.htot+1)*2;
+		/*Nothing is drawn, but the line's data is still fetched*/
+		vidc_record_line(&line, type, l, mode);
+		vidc_fetch_line(&line, NULL);
+	}
+	else
+	{
+		if (video_frame_render && !vidc.data_callback)
+			vidc_queue_line(type, l, mode);
+		else
+		{
+			/*Devices on the data port need each line as it is displayed*/
+			uint32_t data[VIDC_MAX_LINE_DATA];
 
-		archline(buffer->line[l], 0, l, htot, 0);
+			vidc_flush_lines();
+			vidc_record_line(&line, type, l, mode);
+			vidc_fetch_line(&line, data);
+			if (!vidc_draw_pal_live)
+			{
+				vidc_pal_save(&vidc_draw_pal);
+				vidc_draw_pal_live = 1;
+			}
+			vidc_draw_line(&line, data);
+		}
+
+		if (type == VIDC_LINE_DISPLAY && vidc.borderon)
+		{
+			if (l < vidc.y_min)
+				vidc.y_min = l;
+			if ((l+1) > vidc.y_max)
+				vidc.y_max = l+1;
+			if (!memc_videodma_enable)
+			{
+				if (l < vidc.disp_y_min)
+					vidc.disp_y_min = l;
+				if ((l+1) > vidc.disp_y_max)
+					vidc.disp_y_max = l+1;
+			}
+		}
 	}
 	if (vidc.data_callback)
 	{
@@ -1146,13 +1959,13 @@ static void vidc_poll(void *__p)
 			{
 				int pixels = (vidc.htot+1)*2;
 				for (x = 0; x < pixels; x++)
-					out_data[x] = (((uint32_t *)buffer->line[l])[x] >> 20) & 0x1f;
+					out_data[x] = (vidc_line_colour(l, ((uint32_t *)buffer->line[l])[x]) >> 20) & 0x1f;
 			}
 			else
 			{
 				int pixels = (vidc.htot+1)*4;
 				for (x = 0; x < pixels; x += 2)
-					out_data[x>>1] = (((uint32_t *)buffer->line[l])[x] >> 20) & 0x1f;
+					out_data[x>>1] = (vidc_line_colour(l, ((uint32_t *)buffer->line[l])[x]) >> 20) & 0x1f;
 			}
 		}
 		else
@@ -1164,6 +1977,7 @@ static void vidc_poll(void *__p)
 	if (vidc.line>=vidc.vtot)
 	{
 		LOG_VIDEO_FRAMES("Frame over!  vidc.line=%d, vidc.vtot=%d\n", vidc.line, vidc.vtot);
+		vidc_frame_end();
 		if (vidc.displayon)
 		{
 			vidc.displayon = vidc_displayon = 0;
@@ -1176,7 +1990,7 @@ static void vidc_poll(void *__p)
 
 		oldflash=readflash[0]|readflash[1]|readflash[2]|readflash[3];
 
-		if (vidc.output_enable)
+		if (vidc.output_enable && !turbo_mode)
 		{
 			if ((display_mode == DISPLAY_MODE_NO_BORDERS) || (monitor_type == MONITOR_MONO))
 			{
@@ -1200,16 +2014,14 @@ static void vidc_poll(void *__p)
 					LOG_VIDEO_FRAMES("PRESENT: normal display\n");
 					update_screen_geometry(0, 0, hd_end-hd_start, height);
 					updatewindowsize(hd_end-hd_start, height);
-					video_renderer_update(buffer, hd_start, vidc.disp_y_min, 0, 0, hd_end-hd_start, height);
-					video_renderer_present(0, 0, hd_end-hd_start, height, 0);
+					vidc_output(hd_start, vidc.disp_y_min, hd_end-hd_start, height, 0);
 				}
 				else
 				{
 					LOG_VIDEO_FRAMES("PRESENT: line doubled");
 					update_screen_geometry(0, 0, hd_end-hd_start, height * 2);
 					updatewindowsize(hd_end-hd_start, height * 2);
-					video_renderer_update(buffer, hd_start, vidc.disp_y_min, 0, 0, hd_end-hd_start, height);
-					video_renderer_present(0, 0, hd_end-hd_start, height, 1);
+					vidc_output(hd_start, vidc.disp_y_min, hd_end-hd_start, height, 1);
 				}
 			}
 			else if (display_mode == DISPLAY_MODE_NATIVE_BORDERS)
@@ -1237,16 +2049,14 @@ static void vidc_poll(void *__p)
 					LOG_VIDEO_FRAMES("UPDATE AND PRESENT: fullborders|fullscreen no doubling\n");
 					update_screen_geometry(hb_width, vb_height, disp_width, disp_height);
 					updatewindowsize(hb_end-hb_start, vidc.y_max-vidc.y_min);
-					video_renderer_update(buffer, hb_start, vidc.y_min, 0, 0, hb_end-hb_start, vidc.y_max-vidc.y_min);
-					video_renderer_present(0, 0, hb_end-hb_start, vidc.y_max-vidc.y_min, 0);
+					vidc_output(hb_start, vidc.y_min, hb_end-hb_start, vidc.y_max-vidc.y_min, 0);
 				}
 				else
 				{
 					LOG_VIDEO_FRAMES("UPDATE AND PRESENT: fullborders|fullscreen + doubling\n");
 					update_screen_geometry(hb_width, vb_height * 2, disp_width, disp_height * 2);
 					updatewindowsize(hb_end-hb_start, (vidc.y_max-vidc.y_min) * 2);
-					video_renderer_update(buffer, hb_start, vidc.y_min, 0, 0, hb_end-hb_start, vidc.y_max-vidc.y_min);
-					video_renderer_present(0, 0, hb_end-hb_start, vidc.y_max-vidc.y_min, 1);
+					vidc_output(hb_start, vidc.y_min, hb_end-hb_start, vidc.y_max-vidc.y_min, 1);
 				}
 			}
 			else
@@ -1257,26 +2067,22 @@ static void vidc_poll(void *__p)
 				{
 					if (dblscan)
 					{
-						video_renderer_update(buffer, TV_X_MIN_24, TV_Y_MIN, 0, 0, TV_X_MAX_24-TV_X_MIN_24, TV_Y_MAX-TV_Y_MIN);
-						video_renderer_present(0, 0, TV_X_MAX_24-TV_X_MIN_24, TV_Y_MAX-TV_Y_MIN, 1);
+						vidc_output(TV_X_MIN_24, TV_Y_MIN, TV_X_MAX_24-TV_X_MIN_24, TV_Y_MAX-TV_Y_MIN, 1);
 					}
 					else
 					{
-						video_renderer_update(buffer, TV_X_MIN_24, TV_Y_MIN*2, 0, 0, TV_X_MAX_24-TV_X_MIN_24, (TV_Y_MAX-TV_Y_MIN)*2);
-						video_renderer_present(0, 0, TV_X_MAX_24-TV_X_MIN_24, (TV_Y_MAX-TV_Y_MIN)*2, 0);
+						vidc_output(TV_X_MIN_24, TV_Y_MIN*2, TV_X_MAX_24-TV_X_MIN_24, (TV_Y_MAX-TV_Y_MIN)*2, 0);
 					}
 				}
 				else
 				{
 					if (dblscan)
 					{
-						video_renderer_update(buffer, TV_X_MIN, TV_Y_MIN, 0, 0, TV_X_MAX-TV_X_MIN, TV_Y_MAX-TV_Y_MIN);
-						video_renderer_present(0, 0, TV_X_MAX-TV_X_MIN, TV_Y_MAX-TV_Y_MIN, 1);
+						vidc_output(TV_X_MIN, TV_Y_MIN, TV_X_MAX-TV_X_MIN, TV_Y_MAX-TV_Y_MIN, 1);
 					}
 					else
 					{
-						video_renderer_update(buffer, TV_X_MIN, TV_Y_MIN*2, 0, 0, TV_X_MAX-TV_X_MIN, (TV_Y_MAX-TV_Y_MIN)*2);
-						video_renderer_present(0, 0, TV_X_MAX-TV_X_MIN, (TV_Y_MAX-TV_Y_MIN)*2, 0);
+						vidc_output(TV_X_MIN, TV_Y_MIN*2, TV_X_MAX-TV_X_MIN, (TV_Y_MAX-TV_Y_MIN)*2, 0);
 					}
 				}
 			}
@@ -1291,9 +2097,10 @@ static void vidc_poll(void *__p)
 			if (vidc.clear_pending)
 			{
 				vidc.clear_pending = 0;
-				clear(buffer);
+				vidc_clear_buffer();
 			}
 		}
+		vidc_pal_rows_reset();
 
 		vidc.line=0;
 		if (vidc.vsync_callback)
@@ -1365,6 +2172,25 @@ void vidc_reset()
 }
 
 
+void vidc_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_ARRAY(s, vidcr);
+	SNAPSHOT_STRUCT_TO(s, vidc, timer);
+	timer_snapshot(s, &vidc.timer);
+	SNAPSHOT_VAR(s, soundhz);
+	SNAPSHOT_VAR(s, soundper);
+	SNAPSHOT_VAR(s, flyback);
+	SNAPSHOT_VAR(s, vidc_displayon);
+
+	if (s->loading)
+	{
+		/*Host colours depend on the current black level setting*/
+		vidc_redopalette();
+		redolookup();
+		clearbitmap();
+	}
+}
+
 void vidc_attach(void (*vidc_data)(uint8_t *data, int pixels, int hsync_length, int resolution, void *p), void (*vidc_vsync)(void *p, int state), void *p)
 {
 	vidc.data_callback = vidc_data;
@@ -1374,6 +2200,9 @@ void vidc_attach(void (*vidc_data)(uint8_t *data, int pixels, int hsync_length,
 
 void vidc_output_enable(int ena)
 {
+	/*Another device may have drawn over the renderer's copy of the screen*/
+	if (ena && !vidc.output_enable)
+		vidc_last_update.valid = 0;
 	vidc.output_enable = ena;
 }
 
@@ -17,6 +17,8 @@ void vidc_attach(void (*vidc_data)(uint8_t *data, int pixels, int hsync_length,
 void vidc_output_enable(int ena);
 
 extern int vidc_framecount;
+/*Number of scanlines VIDC has clocked through, for benchmarking*/
+extern uint32_t vidc_linecount;
 extern int vidc_dma_length;
 
 void vidc_reset();
@@ -27,6 +29,24 @@ int vidc_cursor_visible();
 
 void vidc_debug_print(char *s);
 
+/*Indexed colour output, for renderers that can look colours up themselves.
+  Buffer pixels are then indices into a row of VIDC_PAL_ENTRIES colours :
+	VIDC_INDEX_BLACK - black
+	VIDC_INDEX_PAL   - VIDC palette entries 0-19 (16 logical colours, border
+			   and cursor colours)
+	VIDC_INDEX_WHITE - white, for monochrome modes
+	VIDC_INDEX_PAL8  - 256 colours of the 8bpp modes*/
+#define VIDC_INDEX_BLACK 0
+#define VIDC_INDEX_PAL   1
+#define VIDC_INDEX_WHITE 21
+#define VIDC_INDEX_PAL8  256
+#define VIDC_PAL_ENTRIES 512
+/*Maximum number of different palettes displayed in one frame*/
+#define VIDC_PAL_ROWS    256
+
+extern int vidc_indexed;
+void vidc_set_indexed(int indexed);
+
 
 typedef struct
 {
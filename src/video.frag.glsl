@@ -1,10 +1,27 @@
 #version 300 es
 precision highp float;
+precision highp usampler2D;
 out vec4 FragColor;
 in vec3 ourColor;
 in vec2 TexCoord;
 uniform sampler2D texture1;
+// Indexed VIDC output: palette index per pixel, one palette row per
+// palette used in the frame, and the palette row for each line
+uniform usampler2D indices;
+uniform sampler2D palette;
+uniform usampler2D palette_rows;
+uniform int indexed;
 uniform vec4 zoom;
+
+vec4 indexed_texel(ivec2 p)
+{
+    ivec2 isize = textureSize(indices, 0);
+    p = clamp(p, ivec2(0, 0), isize - 1);
+    uint row = texelFetch(palette_rows, ivec2(p.y, 0), 0).r;
+    uint index = texelFetch(indices, p, 0).r;
+    return texelFetch(palette, ivec2(index, row), 0);
+}
+
 void main()
 {
     vec4 izoom = zoom;
@@ -17,11 +34,22 @@ void main()
     // pan and zoom into the texture wherever we're told by the VIDC
     vec2 zoomed = izoom.xy / size + TexCoord * (izoom.zw / size);
 
-    // We've copied the VIDC memory directly into the texture, 
-    // which is BGRA with alpha at 0.
-    //
-    // So flip it to RGBA which is the portable format the texture is set up for,
-    // and force the alpha to 1.0.
-    FragColor = texture(texture1, zoomed).bgra;
+    if (indexed != 0) {
+        // Integer textures can't be filtered, so look up the four
+        // nearest texels and filter the colours ourselves
+        vec2 p = zoomed * size - 0.5;
+        ivec2 p0 = ivec2(floor(p));
+        vec2 f = fract(p);
+        vec4 top = mix(indexed_texel(p0), indexed_texel(p0 + ivec2(1, 0)), f.x);
+        vec4 bottom = mix(indexed_texel(p0 + ivec2(0, 1)), indexed_texel(p0 + ivec2(1, 1)), f.x);
+        FragColor = mix(top, bottom, f.y).bgra;
+    } else {
+        // We've copied the VIDC memory directly into the texture, 
+        // which is BGRA with alpha at 0.
+        //
+        // So flip it to RGBA which is the portable format the texture is set up for,
+        // and force the alpha to 1.0.
+        FragColor = texture(texture1, zoomed).bgra;
+    }
     FragColor.a = 1.0;
 }
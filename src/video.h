@@ -60,6 +60,8 @@ enum
 };
 
 extern int video_linear_filtering;
+/*Draw VIDC output a frame at a time rather than a line at a time*/
+extern int video_frame_render;
 
 enum
 {
@@ -270,6 +270,18 @@ void video_renderer_update(BITMAP *src, int src_x, int src_y, int dest_x, int de
 #endif
 }
 
+/*This renderer only takes colour bitmaps, so never enables indexed output*/
+void video_renderer_update_indexed(BITMAP *src, int src_x, int src_y, int dest_x, int dest_y, int w, int h,
+				   const uint32_t *palette, int nr_rows, const uint16_t *line_rows)
+{
+}
+
+/*No frame pacing counters are kept by this renderer*/
+void video_renderer_get_stats(video_stats_t *stats, int reset)
+{
+	memset(stats, 0, sizeof(video_stats_t));
+}
+
 static void sdl_scale(int scale, SDL_Rect src, SDL_Rect *dst, int w, int h)
 {
 	double t, b, l, r;
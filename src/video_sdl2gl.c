@@ -4,7 +4,8 @@
  * 
  * This back-end started as a copy of video_sdl2.c. It conforms to
  * the expectations of the emulated VIDC, and is expected to keep
- * track of the latest data for the screen in a single big texture.
+ * track of the latest data for the screen in a big texture (really a
+ * small ring of them, see texture_ring_t).
  * 
  * The VIDC maintains its own memory and then calls these two
  * functions at 50Hz. I'm not sure why they're separate because they
@@ -49,7 +50,57 @@
 // other SDL code references this
 SDL_Window *sdl_main_window = NULL;
 static SDL_GLContext context = NULL;
-static GLuint screenTexture;
+
+/* This 2048×1024 is the screen memory hardwired into the VIDC emulation */
+#define TEXTURE_W 2048
+#define TEXTURE_H 1024
+
+/* The display is streamed into a ring of textures, so an upload never has
+ * to wait for the GPU to finish drawing the previous frame from the same
+ * texture. VIDC only sends the lines that changed since its last update,
+ * so each slot remembers which rows it has missed since it was last
+ * written, and catches up from the source bitmap when its turn comes.
+ *
+ * On native GL uploads go through a pixel buffer object per slot, so
+ * glTexSubImage2D() returns without waiting for the copy. WebGL can't map
+ * buffers, so there we upload from client memory as before.
+ */
+#define TEXTURE_RING_SIZE 3
+
+typedef struct texture_ring_t
+{
+    GLuint textures[TEXTURE_RING_SIZE];
+#ifndef __EMSCRIPTEN__
+    GLuint pbos[TEXTURE_RING_SIZE];
+#endif
+    /* Slot last uploaded, which is the one to draw */
+    int current;
+    /* Rows of each slot that are out of date */
+    int y_min[TEXTURE_RING_SIZE], y_max[TEXTURE_RING_SIZE];
+    /* Where the last update came from. If this changes, every slot needs
+     * the whole of the next update */
+    BITMAP *src;
+    int src_dx, src_dy;
+    int x, w;
+
+    int bytes_per_pixel;
+    GLenum format, type;
+} texture_ring_t;
+
+/* RGBA output, used by VIDC without indexed output, A4 LCD and G332 */
+static texture_ring_t screen_ring;
+/* Indexed VIDC output: 16-bit palette indices, a row of colours for each
+ * palette used in the frame, and the palette row for each line */
+static texture_ring_t index_ring;
+static GLuint paletteTexture, lineRowTexture;
+/* Set if the last update was indexed */
+static int present_indexed;
+
+/* Frame pacing counters, see video_renderer_get_stats(). A present more
+ * than one and a half 50Hz frames after the last one counts as late. */
+#define VIDEO_LATE_FRAME_US 30000
+static video_stats_t stats;
+static uint64_t last_present_us;
 
 // FIXME: vestigial bits left in to avoid changes to other files
 int selected_video_renderer;
@@ -125,10 +176,185 @@ video_window_info_t video_window_info() {
     return info;
 }
 
+static uint64_t video_time_us(void)
+{
+    return (SDL_GetPerformanceCounter() * 1000000) / SDL_GetPerformanceFrequency();
+}
+
+static void texture_ring_init(texture_ring_t *ring, GLenum internal_format, GLenum format, GLenum type, int bytes_per_pixel, GLint filter)
+{
+    int c;
+
+    memset(ring, 0, sizeof(texture_ring_t));
+    ring->format = format;
+    ring->type = type;
+    ring->bytes_per_pixel = bytes_per_pixel;
+
+    glGenTextures(TEXTURE_RING_SIZE, ring->textures);
+    CHECK_GL_ERROR;
+    for (c = 0; c < TEXTURE_RING_SIZE; c++)
+    {
+        glBindTexture(GL_TEXTURE_2D, ring->textures[c]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, TEXTURE_W, TEXTURE_H, 0, format, type, NULL);
+        CHECK_GL_ERROR;
+        /* Sometimes repeating the pattern is useful to see when we mess something up */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        CHECK_GL_ERROR;
+        /* The default is to assume our textures have mipmaps, so must turn that off  */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        CHECK_GL_ERROR;
+    }
+#ifndef __EMSCRIPTEN__
+    glGenBuffers(TEXTURE_RING_SIZE, ring->pbos);
+    CHECK_GL_ERROR;
+#endif
+}
+
+/* Copy rows y to y+h of the ring's area from src, packed, to dest */
+static void texture_ring_copy(texture_ring_t *ring, BITMAP *src, uint8_t *dest, int y, int h)
+{
+    int w = ring->w;
+    int x, c;
+
+    for (c = 0; c < h; c++)
+    {
+        const uint32_t *s = (const uint32_t *)src->dat + (y + c + ring->src_dy) * src->w + ring->x + ring->src_dx;
+
+        if (ring->bytes_per_pixel == 4)
+            memcpy(&dest[c * w * 4], s, w * 4);
+        else
+        {
+            /* Indices never exceed 16 bits, so halve the upload */
+            uint16_t *d = (uint16_t *)&dest[c * w * 2];
+
+            for (x = 0; x < w; x++)
+                d[x] = s[x];
+        }
+    }
+}
+
+/* Copy rows of src to the next slot in the ring, then make it current.
+ * texture_rect is the (clipped) area that changed, at src_x, src_y in src.
+ */
+static void texture_ring_update(texture_ring_t *ring, BITMAP *src, int src_x, int src_y, SDL_Rect *texture_rect)
+{
+    uint64_t start_us = video_time_us();
+    int src_dx = src_x - texture_rect->x, src_dy = src_y - texture_rect->y;
+    int slot, y_min, y_max, w, h;
+#ifndef __EMSCRIPTEN__
+    uint8_t *dest;
+#endif
+    size_t size;
+
+    if (texture_rect->y >= TEXTURE_H)
+        return;
+    if (texture_rect->y + texture_rect->h > TEXTURE_H)
+        texture_rect->h = TEXTURE_H - texture_rect->y;
+
+    /* Every slot has missed this update */
+    if (ring->src != src || ring->src_dx != src_dx || ring->src_dy != src_dy ||
+        ring->x != texture_rect->x || ring->w != texture_rect->w)
+    {
+        ring->src = src;
+        ring->src_dx = src_dx;
+        ring->src_dy = src_dy;
+        ring->x = texture_rect->x;
+        ring->w = texture_rect->w;
+        for (slot = 0; slot < TEXTURE_RING_SIZE; slot++)
+        {
+            ring->y_min[slot] = texture_rect->y;
+            ring->y_max[slot] = texture_rect->y + texture_rect->h;
+        }
+    }
+    else
+    {
+        for (slot = 0; slot < TEXTURE_RING_SIZE; slot++)
+        {
+            if (ring->y_min[slot] >= ring->y_max[slot])
+            {
+                ring->y_min[slot] = texture_rect->y;
+                ring->y_max[slot] = texture_rect->y + texture_rect->h;
+            }
+            else
+            {
+                ring->y_min[slot] = MIN(ring->y_min[slot], texture_rect->y);
+                ring->y_max[slot] = MAX(ring->y_max[slot], texture_rect->y + texture_rect->h);
+            }
+        }
+    }
+
+    slot = (ring->current + 1) % TEXTURE_RING_SIZE;
+    y_min = ring->y_min[slot];
+    y_max = ring->y_max[slot];
+    ring->y_min[slot] = ring->y_max[slot] = 0;
+    ring->current = slot;
+
+    w = ring->w;
+    h = y_max - y_min;
+    size = (size_t)w * h * ring->bytes_per_pixel;
+
+    LOG_VIDEO_FRAMES("texture_ring_update: slot %d rows %d-%d\n", slot, y_min, y_max);
+
+    glBindTexture(GL_TEXTURE_2D, ring->textures[slot]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, ring->bytes_per_pixel);
+    CHECK_GL_ERROR;
+#ifdef __EMSCRIPTEN__
+    if (ring->bytes_per_pixel == 4)
+    {
+        /* Upload straight from the bitmap */
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, src->w);
+        CHECK_GL_ERROR;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, ring->x, y_min, w, h, ring->format, ring->type,
+                        src->dat + ((y_min + src_dy) * src->w * 4) + (ring->x + src_dx) * 4);
+        CHECK_GL_ERROR;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        CHECK_GL_ERROR;
+    }
+    else
+    {
+        static uint16_t staging[TEXTURE_W * TEXTURE_H];
+
+        texture_ring_copy(ring, src, (uint8_t *)staging, y_min, h);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, ring->x, y_min, w, h, ring->format, ring->type, staging);
+        CHECK_GL_ERROR;
+    }
+#else
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->pbos[slot]);
+    /* Orphan the old storage rather than waiting for its last upload */
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    CHECK_GL_ERROR;
+    texture_ring_copy(ring, src, dest, y_min, h);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    /* Returns straight away, the copy from the PBO happens on the GPU */
+    glTexSubImage2D(GL_TEXTURE_2D, 0, ring->x, y_min, w, h, ring->format, ring->type, (void *)0);
+    CHECK_GL_ERROR;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    CHECK_GL_ERROR;
+#endif
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    CHECK_GL_ERROR;
+
+    stats.uploads++;
+    stats.upload_bytes += size;
+    stats.upload_us += video_time_us() - start_us;
+}
+
+void video_renderer_get_stats(video_stats_t *s, int reset)
+{
+    *s = stats;
+    if (reset)
+        memset(&stats, 0, sizeof(stats));
+}
+
 /* Object id for our shader program */
 GLuint shaderProgram;
 /* Uniform index for the "zoom" vec4 */
 GLuint monitorZoomLoc;
+/* Uniform index for the "indexed" flag */
+GLuint monitorIndexedLoc;
 /* Vertex array object listing virtual monitor coordinates */
 GLuint monitorVao;
 
@@ -218,8 +444,22 @@ int video_renderer_init(void *unused)
     CHECK_GL_ERROR;
     glUniform1i(loc, 0);
     CHECK_GL_ERROR;
+    loc = glGetUniformLocation(shaderProgram, "indices");
+    CHECK_GL_ERROR;
+    glUniform1i(loc, 1);
+    CHECK_GL_ERROR;
+    loc = glGetUniformLocation(shaderProgram, "palette");
+    CHECK_GL_ERROR;
+    glUniform1i(loc, 2);
+    CHECK_GL_ERROR;
+    loc = glGetUniformLocation(shaderProgram, "palette_rows");
+    CHECK_GL_ERROR;
+    glUniform1i(loc, 3);
+    CHECK_GL_ERROR;
     monitorZoomLoc = glGetUniformLocation(shaderProgram, "zoom");
     CHECK_GL_ERROR;
+    monitorIndexedLoc = glGetUniformLocation(shaderProgram, "indexed");
+    CHECK_GL_ERROR;
 
     /* Build the vertex array object for the "monitor" - a rectangle that fills the viewport. 
      * Through OpenGL bindings this references a vertex buffer object and an element buffer object,
@@ -269,24 +509,34 @@ int video_renderer_init(void *unused)
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(6 * sizeof(float)));
     glEnableVertexAttribArray(2);
 
-    /* Create the texture object to which we'll stream the Archimedes display */
+    /* Create the texture objects to which we'll stream the Archimedes display.
+     * it's BGRA really but OpenGL ES won't do that - so the fragment shader swaps it */
+    texture_ring_init(&screen_ring, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, 4, GL_LINEAR);
 
-    glGenTextures(1, &screenTexture);
-    glBindTexture(GL_TEXTURE_2D, screenTexture);
-    /* This 2048×1024 is the screen memory hardwired into the VIDC emulation */
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 2048, 1024, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    CHECK_GL_ERROR;
-    /* Sometimes repeating the pattern is useful to see when we mess something up */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    /* Textures for indexed VIDC output. Integer textures can't be filtered,
+     * so the fragment shader reads all of these with texelFetch() and does
+     * its own filtering after the palette lookup */
+    texture_ring_init(&index_ring, GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 2, GL_NEAREST);
+
+    glGenTextures(1, &paletteTexture);
+    glBindTexture(GL_TEXTURE_2D, paletteTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, VIDC_PAL_ENTRIES, VIDC_PAL_ROWS, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     CHECK_GL_ERROR;
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     CHECK_GL_ERROR;
-    /* The default is to assume our textures have mipmaps, so must turn that off  */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+    glGenTextures(1, &lineRowTexture);
+    glBindTexture(GL_TEXTURE_2D, lineRowTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, 1024, 1, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
     CHECK_GL_ERROR;
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     CHECK_GL_ERROR;
 
+    /* VIDC can now send us palette indices rather than colours */
+    vidc_set_indexed(1);
+
     return SDL_TRUE;
 }
 
@@ -305,65 +555,76 @@ void video_renderer_close()
     }
 }
 
-/*Update display texture from memory bitmap src.*/
-void video_renderer_update(BITMAP *src, int src_x, int src_y, int dest_x, int dest_y, int w, int h)
+/* Clip an update to the 2048x2048 bitmap and texture. Returns 0 if there
+ * is nothing left to update.
+ */
+static int video_clip_update(int *src_x, int *src_y, SDL_Rect *texture_rect, int dest_x, int dest_y, int w, int h)
 {
-    if (skip_video_render) {
-        return;
-    }
-    LOG_VIDEO_FRAMES("video_renderer_update: src=%i,%i dest=%i,%i size=%i,%i\n", src_x, src_y, dest_x, dest_y, w, h);
-
     /* Not sure why the VIDC emulation sends us negative widths etc. that we need to cope with 
      * but will leave this code here until I can understand it.
      */
-    SDL_Rect texture_rect;
+    texture_rect->x = dest_x;
+    texture_rect->y = dest_y;
+    texture_rect->w = w;
+    texture_rect->h = h;
 
-    texture_rect.x = dest_x;
-    texture_rect.y = dest_y;
-    texture_rect.w = w;
-    texture_rect.h = h;
-
-    if (src_x < 0)
+    if (*src_x < 0)
     {
-        texture_rect.w += src_x;
-        src_x = 0;
+        texture_rect->w += *src_x;
+        *src_x = 0;
     }
-    if (src_x > 2047)
-        return;
-    if ((src_x + texture_rect.w) > 2047)
-        texture_rect.w = 2048 - src_x;
+    if (*src_x > 2047)
+        return 0;
+    if ((*src_x + texture_rect->w) > 2047)
+        texture_rect->w = 2048 - *src_x;
 
-    if (src_y < 0)
+    if (*src_y < 0)
     {
-        texture_rect.h += src_y;
-        src_y = 0;
+        texture_rect->h += *src_y;
+        *src_y = 0;
     }
-    if (src_y > 2047)
-        return;
-    if ((src_y + texture_rect.h) > 2047)
-        texture_rect.h = 2048 - src_y;
+    if (*src_y > 2047)
+        return 0;
+    if ((*src_y + texture_rect->h) > 2047)
+        texture_rect->h = 2048 - *src_y;
 
-    if (texture_rect.x < 0)
+    if (texture_rect->x < 0)
     {
-        texture_rect.w += texture_rect.x;
-        texture_rect.x = 0;
+        texture_rect->w += texture_rect->x;
+        texture_rect->x = 0;
     }
-    if (texture_rect.x > 2047)
-        return;
-    if ((texture_rect.x + texture_rect.w) > 2047)
-        texture_rect.w = 2048 - texture_rect.x;
+    if (texture_rect->x > 2047)
+        return 0;
+    if ((texture_rect->x + texture_rect->w) > 2047)
+        texture_rect->w = 2048 - texture_rect->x;
 
-    if (texture_rect.y < 0)
+    if (texture_rect->y < 0)
     {
-        texture_rect.h += texture_rect.y;
-        texture_rect.y = 0;
+        texture_rect->h += texture_rect->y;
+        texture_rect->y = 0;
     }
-    if (texture_rect.y > 2047)
+    if (texture_rect->y > 2047)
+        return 0;
+    if ((texture_rect->y + texture_rect->h) > 2047)
+        texture_rect->h = 2048 - texture_rect->y;
+
+    return texture_rect->w > 0 && texture_rect->h > 0;
+}
+
+/*Update display texture from memory bitmap src.*/
+void video_renderer_update(BITMAP *src, int src_x, int src_y, int dest_x, int dest_y, int w, int h)
+{
+    if (skip_video_render) {
         return;
-    if ((texture_rect.y + texture_rect.h) > 2047)
-        texture_rect.h = 2048 - texture_rect.y;
+    }
+    LOG_VIDEO_FRAMES("video_renderer_update: src=%i,%i dest=%i,%i size=%i,%i\n", src_x, src_y, dest_x, dest_y, w, h);
+
+    SDL_Rect texture_rect;
 
-    if (texture_rect.w <= 0 || texture_rect.h <= 0)
+    /* Anything drawn in colour (eg A4 LCD) replaces indexed output */
+    present_indexed = 0;
+
+    if (!video_clip_update(&src_x, &src_y, &texture_rect, dest_x, dest_y, w, h))
         return;
 
     LOG_VIDEO_FRAMES("SDL_UpdateTexture (%d, %d)+(%d, %d) from src (%d, %d) w %d\n",
@@ -371,24 +632,7 @@ void video_renderer_update(BITMAP *src, int src_x, int src_y, int dest_x, int de
                      texture_rect.w, texture_rect.h,
                      src_x, src_y, src->w);
 
-    /* We continually update a single texture because that 's the old 
-    *  interface from the VIDC, the data is just pushed at us.  It might be
-    *  faster to use 2 or 3 textures and swap them, but don't know yet.
-    */
-
-    glBindTexture(GL_TEXTURE_2D, screenTexture);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, src->w);
-    CHECK_GL_ERROR;
-    glTexSubImage2D(
-        GL_TEXTURE_2D, 0,
-        texture_rect.x, texture_rect.y, texture_rect.w, texture_rect.h,
-        /* it's BGRA really but OpenGL ES won't do that - so the fragment shader swaps it */
-        GL_RGBA,
-        GL_UNSIGNED_BYTE,
-        src->dat + (src_y * src->w * 4) + src_x * 4);
-    CHECK_GL_ERROR;
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    CHECK_GL_ERROR;
+    texture_ring_update(&screen_ring, src, src_x, src_y, &texture_rect);
 
 #ifdef __EMSCRIPTEN__
 	if (take_screenshot || record_video) {
@@ -406,12 +650,89 @@ void video_renderer_update(BITMAP *src, int src_x, int src_y, int dest_x, int de
      */
 }
 
+/*Update display from memory bitmap src holding VIDC palette indices. The
+  fragment shader looks up each index in the palette row for its line.*/
+void video_renderer_update_indexed(BITMAP *src, int src_x, int src_y, int dest_x, int dest_y, int w, int h,
+                                   const uint32_t *palette, int nr_rows, const uint16_t *line_rows)
+{
+    static uint16_t texture_rows[1024];
+    SDL_Rect texture_rect;
+    int line_offset = src_y - dest_y;
+    int y;
+
+    if (skip_video_render) {
+        return;
+    }
+    LOG_VIDEO_FRAMES("video_renderer_update_indexed: src=%i,%i dest=%i,%i size=%i,%i rows=%i\n", src_x, src_y, dest_x, dest_y, w, h, nr_rows);
+
+    present_indexed = 1;
+
+    /* Palette rows and the row for each line change every frame, but are
+     * tiny. Line rows are moved to texture coordinates here so the shader
+     * doesn't need to know about the source offset.
+     */
+    for (y = 0; y < 1024; y++)
+        texture_rows[y] = (y + line_offset >= 0 && y + line_offset < 1024) ? line_rows[y + line_offset] : 0;
+
+    glBindTexture(GL_TEXTURE_2D, paletteTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VIDC_PAL_ENTRIES, nr_rows, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+    CHECK_GL_ERROR;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glBindTexture(GL_TEXTURE_2D, lineRowTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1024, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, texture_rows);
+    CHECK_GL_ERROR;
+
+    /* Unchanged lines don't need uploading at all */
+    if (h > 0 && video_clip_update(&src_x, &src_y, &texture_rect, dest_x, dest_y, w, h)
+        && texture_rect.y < TEXTURE_H)
+    {
+        texture_ring_update(&index_ring, src, src_x, src_y, &texture_rect);
+
+#ifdef __EMSCRIPTEN__
+	/* VIDC always sends the whole frame when capturing. Capture wants
+	 * colours, so expand the indices through the palettes. */
+	if (take_screenshot || record_video) {
+		static uint32_t capture[2048 * 1024];
+		int x;
+		SDL_Rect window_rect;
+
+		take_screenshot = 0;
+		SDL_GetWindowSize(sdl_main_window, &window_rect.w, &window_rect.h);
+		for (y = 0; y < texture_rect.h; y++) {
+			const uint32_t *s = (const uint32_t *)src->dat + (src_y + y) * src->w + src_x;
+			const uint32_t *pal = &palette[texture_rows[texture_rect.y + y] * VIDC_PAL_ENTRIES];
+
+			for (x = 0; x < texture_rect.w; x++)
+				capture[y * texture_rect.w + x] = pal[s[x]];
+		}
+		EM_ASM({
+			capture_frame($0,$1,$2,$3,$4,$5,$6,$7,$8);
+		}, capture, texture_rect.w, texture_rect.h, 0, 0, texture_rect.w, texture_rect.h, window_rect.w, window_rect.h);
+	}
+#endif
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    CHECK_GL_ERROR;
+}
+
 /*Render display texture to video window.*/
 void video_renderer_present(int src_x, int src_y, int src_w, int src_h, int dblscan)
 {
 	if (skip_video_render)
 		return;
 
+    uint64_t start_us = video_time_us();
+    if (last_present_us)
+    {
+        uint32_t interval_us = start_us - last_present_us;
+
+        if (interval_us > stats.present_interval_max_us)
+            stats.present_interval_max_us = interval_us;
+        if (interval_us > VIDEO_LATE_FRAME_US)
+            stats.late_frames++;
+    }
+    last_present_us = start_us;
+
     LOG_VIDEO_FRAMES("video_renderer_present: %d,%d + %d,%d\n", src_x, src_y, src_w, src_h);
 
     /* Adjust viewport so we display 4:3 as best we can in the window */
@@ -443,14 +764,22 @@ void video_renderer_present(int src_x, int src_y, int src_w, int src_h, int dbls
 
     glUniform4f(monitorZoomLoc, src_x, src_y, src_w, src_h);
     CHECK_GL_ERROR;
+    glUniform1i(monitorIndexedLoc, present_indexed);
+    CHECK_GL_ERROR;
 
     glClearColor(0.0f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     /* Draw the monitor */
 
+    glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
+    glBindTexture(GL_TEXTURE_2D, index_ring.textures[index_ring.current]); CHECK_GL_ERROR;
+    glActiveTexture(GL_TEXTURE2); CHECK_GL_ERROR;
+    glBindTexture(GL_TEXTURE_2D, paletteTexture); CHECK_GL_ERROR;
+    glActiveTexture(GL_TEXTURE3); CHECK_GL_ERROR;
+    glBindTexture(GL_TEXTURE_2D, lineRowTexture); CHECK_GL_ERROR;
     glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-    glBindTexture(GL_TEXTURE_2D, screenTexture); CHECK_GL_ERROR;
+    glBindTexture(GL_TEXTURE_2D, screen_ring.textures[screen_ring.current]); CHECK_GL_ERROR;
     glUseProgram(shaderProgram); CHECK_GL_ERROR;
     glBindVertexArray(monitorVao); CHECK_GL_ERROR;
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
@@ -458,4 +787,7 @@ void video_renderer_present(int src_x, int src_y, int src_w, int src_h, int dbls
     /* Should we handle framebuffers a bit more explicitly? This seems to work. */
 
     SDL_GL_SwapWindow(sdl_main_window);
+
+    stats.frames++;
+    stats.present_us += video_time_us() - start_us;
 }
@@ -7,6 +7,7 @@
 #include "config.h"
 #include "disc.h"
 #include "ioc.h"
+#include "snapshot.h"
 #include "timer.h"
 #include "wd1770.h"
 
@@ -47,6 +48,12 @@ void wd1770_reset()
 	}
 }
 
+void wd1770_snapshot(snapshot_t *s)
+{
+	SNAPSHOT_STRUCT_TO(s, wd1770, timer);
+	timer_snapshot(s, &wd1770.timer);
+}
+
 static void wd1770_spinup()
 {
 //        rpclog("WD1770_spinup\n");
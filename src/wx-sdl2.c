@@ -194,6 +194,8 @@ static int arc_main_thread(void *p)
 
 			if (!video_renderer_reinit(NULL))
 				fatal("Video renderer init failed");
+			/*New renderer has no screen contents yet*/
+			setredrawall();
 		}
 
 		// Run for 10 ms of processor time